@@ -13,6 +13,14 @@ function handleMessage(message_event) {
       console.log('Calling callback');
       callback('end');
     }
+  } else if (data.substr(0, 5) == 'word:' ||
+             data.substr(0, 9) == 'sentence:') {
+    // Progress events look like "word:<utterance id>:<char index>".
+    var fields = data.split(':');
+    var callback = callbackMap[fields[1]];
+    if (callback) {
+      callback(fields[0], parseInt(fields[2], 10));
+    }
   } else if (data == 'error') {
     console.log('error');
   }
@@ -48,10 +56,14 @@ var speakListener = function(utterance, options, callback) {
     var tokens = ['speak', rate, pitch, volume, utteranceId, escapedUtterance];
     ttsObj.postMessage(tokens.join(':'));
     console.log('Plug-in args are ' + tokens.join(':'));
-    callbackMap[utteranceId] = function(type) {
+    callbackMap[utteranceId] = function(type, charIndex) {
       console.log('Doing callback ' + type + ' for ' + utteranceId);
       var response = {type: type};
-      response.charIndex = (type == 'end' ? utterance.length : 0);
+      if (charIndex !== undefined) {
+        response.charIndex = charIndex;
+      } else {
+        response.charIndex = (type == 'end' ? utterance.length : 0);
+      }
       callback(response);
       if (type == 'end' || type == 'interrupted' ||
           type == 'cancelled' || type == 'error') {
@@ -0,0 +1,54 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Minimal atomic operations for lock-free communication between threads,
+// built on the GCC __sync builtins so that they work with the Native Client
+// toolchain as well as on a Linux host.
+//
+// Only naturally-aligned values no larger than a pointer may be used.
+// AcquireLoad and ReleaseStore are the only ordering primitives needed for
+// single-producer/single-consumer structures: the producer fills in data
+// and then publishes an index with ReleaseStore; the consumer reads the
+// index with AcquireLoad before touching the data it guards.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_ATOMIC_OPS_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_ATOMIC_OPS_H_
+
+namespace tts_service {
+
+// Load |*ptr| such that no later memory access is reordered before it.
+template<typename T> inline T AcquireLoad(volatile const T* ptr) {
+  T value = *ptr;
+  __sync_synchronize();
+  return value;
+}
+
+// Store |value| to |*ptr| such that no earlier memory access is reordered
+// after it.
+template<typename T> inline void ReleaseStore(volatile T* ptr, T value) {
+  __sync_synchronize();
+  *ptr = value;
+}
+
+// Full memory barrier: no memory access is reordered across it.  Needed
+// when a store must be visible before a following load of another value.
+inline void MemoryBarrier() {
+  __sync_synchronize();
+}
+
+// Atomically add |increment| to |*ptr| and return the new value.
+template<typename T> inline T AtomicIncrement(volatile T* ptr, T increment) {
+  return __sync_add_and_fetch(ptr, increment);
+}
+
+// Atomically replace |*ptr| with |new_value| if it's equal to |old_value|.
+// Returns true if the swap happened.
+template<typename T> inline bool AtomicCompareAndSwap(volatile T* ptr,
+                                                      T old_value,
+                                                      T new_value) {
+  return __sync_bool_compare_and_swap(ptr, old_value, new_value);
+}
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_ATOMIC_OPS_H_
@@ -0,0 +1,128 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <string.h>
+
+#include "audio_sink.h"
+#include "log.h"
+
+namespace tts_service {
+
+namespace {
+
+const int kWavHeaderSize = 44;
+
+void PutUInt16(uint8_t* p, uint16_t value) {
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+void PutUInt32(uint8_t* p, uint32_t value) {
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  p[2] = (value >> 16) & 0xff;
+  p[3] = value >> 24;
+}
+
+}  // namespace
+
+//
+// BufferAudioSink
+//
+
+BufferAudioSink::BufferAudioSink(vector<int16_t>* samples)
+    : samples_(samples),
+      channel_count_(0) {
+}
+
+bool BufferAudioSink::Start(int sample_rate, int channel_count) {
+  channel_count_ = channel_count;
+  samples_->clear();
+  return true;
+}
+
+bool BufferAudioSink::Write(const int16_t* samples, int frame_count) {
+  samples_->insert(samples_->end(),
+                   samples, samples + frame_count * channel_count_);
+  return true;
+}
+
+bool BufferAudioSink::Finish() {
+  return true;
+}
+
+//
+// WavFileAudioSink
+//
+
+WavFileAudioSink::WavFileAudioSink(const char* path)
+    : path_(path),
+      fp_(NULL),
+      sample_rate_(0),
+      channel_count_(0),
+      data_bytes_(0) {
+}
+
+WavFileAudioSink::~WavFileAudioSink() {
+  if (fp_)
+    fclose(fp_);
+}
+
+bool WavFileAudioSink::Start(int sample_rate, int channel_count) {
+  sample_rate_ = sample_rate;
+  channel_count_ = channel_count;
+  data_bytes_ = 0;
+  fp_ = fopen(path_, "wb");
+  if (!fp_) {
+    LOG(ERROR) << "Unable to create " << path_;
+    return false;
+  }
+  // Write the header now to reserve its space; Finish rewrites it with
+  // the final sizes.
+  return WriteHeader();
+}
+
+bool WavFileAudioSink::Write(const int16_t* samples, int frame_count) {
+  if (!fp_)
+    return false;
+  size_t sample_count = frame_count * channel_count_;
+  if (fwrite(samples, sizeof(int16_t), sample_count, fp_) != sample_count) {
+    LOG(ERROR) << "Error writing " << path_;
+    return false;
+  }
+  data_bytes_ += sample_count * sizeof(int16_t);
+  return true;
+}
+
+bool WavFileAudioSink::Finish() {
+  if (!fp_)
+    return false;
+  bool ok = (fseek(fp_, 0, SEEK_SET) == 0 && WriteHeader());
+  if (fclose(fp_) != 0)
+    ok = false;
+  fp_ = NULL;
+  if (!ok)
+    LOG(ERROR) << "Error writing " << path_;
+  return ok;
+}
+
+bool WavFileAudioSink::WriteHeader() {
+  uint8_t header[kWavHeaderSize];
+  int block_align = channel_count_ * sizeof(int16_t);
+  memcpy(&header[0], "RIFF", 4);
+  PutUInt32(&header[4], kWavHeaderSize - 8 + data_bytes_);
+  memcpy(&header[8], "WAVE", 4);
+  memcpy(&header[12], "fmt ", 4);
+  PutUInt32(&header[16], 16);
+  PutUInt16(&header[20], 1);  // PCM
+  PutUInt16(&header[22], channel_count_);
+  PutUInt32(&header[24], sample_rate_);
+  PutUInt32(&header[28], sample_rate_ * block_align);
+  PutUInt16(&header[32], block_align);
+  PutUInt16(&header[34], 16);
+  memcpy(&header[36], "data", 4);
+  PutUInt32(&header[40], data_bytes_);
+  return fwrite(header, 1, kWavHeaderSize, fp_) == kWavHeaderSize;
+}
+
+}  // namespace tts_service
@@ -0,0 +1,75 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Destinations for audio rendered offline by TtsService::RenderToSink, as
+// fast as the engine can synthesize it, rather than played in real time
+// through an AudioOutput.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_AUDIO_SINK_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_AUDIO_SINK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+using std::vector;
+
+namespace tts_service {
+
+class AudioSink {
+ public:
+  virtual ~AudioSink() { }
+
+  // Called before any audio is written.  Returns false on error.
+  virtual bool Start(int sample_rate, int channel_count) = 0;
+
+  // |samples| is an array of |frame_count| interleaved frames.  Returns
+  // false to stop rendering, for example on a write error.
+  virtual bool Write(const int16_t* samples, int frame_count) = 0;
+
+  // Called after the last audio, even if rendering stopped early.
+  // Returns false on error.
+  virtual bool Finish() = 0;
+};
+
+// Collects the rendered audio in memory.
+class BufferAudioSink : public AudioSink {
+ public:
+  // Replaces the contents of |samples| with the interleaved frames.
+  explicit BufferAudioSink(vector<int16_t>* samples);
+
+  virtual bool Start(int sample_rate, int channel_count);
+  virtual bool Write(const int16_t* samples, int frame_count);
+  virtual bool Finish();
+
+ private:
+  vector<int16_t>* samples_;
+  int channel_count_;
+};
+
+// Writes the rendered audio to a 16-bit PCM WAV file as it's rendered, so
+// memory use doesn't grow with the length of the text.  The sizes in the
+// header are filled in by Finish.
+class WavFileAudioSink : public AudioSink {
+ public:
+  explicit WavFileAudioSink(const char* path);
+  virtual ~WavFileAudioSink();
+
+  virtual bool Start(int sample_rate, int channel_count);
+  virtual bool Write(const int16_t* samples, int frame_count);
+  virtual bool Finish();
+
+ private:
+  bool WriteHeader();
+
+  const char* path_;
+  FILE* fp_;
+  int sample_rate_;
+  int channel_count_;
+  uint32_t data_bytes_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_AUDIO_SINK_H_
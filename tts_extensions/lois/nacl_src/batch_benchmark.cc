@@ -0,0 +1,108 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Measures how BatchSynthesizer throughput scales with the number of
+// threads.  Built for the host rather than Native Client, reading the
+// lingware from a directory:
+//
+//   make batch_benchmark
+//   ./batch_benchmark data/ [max_threads] [utterance_count]
+//
+// For each thread count it prints the utterances rendered per second, the
+// real-time factor (processing time divided by the duration of the audio
+// produced) and the speedup over one thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "batch_synthesizer.h"
+#include "pico_tts_engine.h"
+#include "threading.h"
+
+using std::string;
+using std::vector;
+
+using namespace tts_service;
+
+namespace {
+
+const int kSampleRate = 16000;
+
+const char* kSentences[] = {
+  "Bookmark this page.",
+  "Open link in new tab.",
+  "The download is complete.",
+  "You have three unread messages.",
+  "Press enter to activate, or escape to cancel.",
+  "This page is asking you to confirm that you want to leave.",
+  "Settings have been saved.",
+  "Search the web, or type a web address.",
+};
+const int kSentenceCount = sizeof(kSentences) / sizeof(kSentences[0]);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s <data directory> [max_threads] [utterance_count]\n",
+            argv[0]);
+    return 1;
+  }
+  string base_path = argv[1];
+  if (base_path[base_path.size() - 1] != '/')
+    base_path += '/';
+  int max_threads = argc > 2 ? atoi(argv[2]) : 4;
+  int utterance_count = argc > 3 ? atoi(argv[3]) : 200;
+
+  Threading threading;
+  double single_thread_rate = 0;
+  printf("threads  utt/s     RTF       speedup\n");
+  for (int thread_count = 1; thread_count <= max_threads; thread_count++) {
+    vector<TtsEngine*> engines;
+    for (int i = 0; i < thread_count; i++)
+      engines.push_back(new PicoTtsEngine(base_path));
+    BatchSynthesizer batch(engines, &threading);
+
+    // The engines are initialized by their first utterance; keep that out
+    // of the measurement.
+    vector<vector<int16_t> > results;
+    for (int i = 0; i < thread_count; i++)
+      batch.Add(kSentences[0]);
+    if (batch.Render(kSampleRate, 1, &results) != 0) {
+      fprintf(stderr, "Unable to initialize the engines.\n");
+      return 1;
+    }
+
+    for (int i = 0; i < utterance_count; i++)
+      batch.Add(kSentences[i % kSentenceCount]);
+
+    int64_t start_time = threading.GetTimeMilliseconds();
+    int failure_count = batch.Render(kSampleRate, 1, &results);
+    int64_t elapsed = threading.GetTimeMilliseconds() - start_time;
+    if (elapsed < 1)
+      elapsed = 1;
+
+    int64_t frame_count = 0;
+    for (size_t i = 0; i < results.size(); i++)
+      frame_count += results[i].size();
+    double audio_seconds = static_cast<double>(frame_count) / kSampleRate;
+    double elapsed_seconds = elapsed / 1000.0;
+    double rate = utterance_count / elapsed_seconds;
+    if (thread_count == 1)
+      single_thread_rate = rate;
+
+    printf("%-8d %-9.1f %-9.4f %.2f",
+           thread_count,
+           rate,
+           elapsed_seconds / audio_seconds,
+           rate / single_thread_rate);
+    if (failure_count)
+      printf("  (%d failed)", failure_count);
+    printf("\n");
+  }
+  return 0;
+}
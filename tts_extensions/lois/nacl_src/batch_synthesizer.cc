@@ -0,0 +1,207 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include "batch_synthesizer.h"
+#include "log.h"
+#include "tts_engine.h"
+
+namespace tts_service {
+
+struct BatchResult {
+  bool success;
+  vector<int16_t> samples;
+};
+
+// One thread with its own engine, rendering through a TtsService that's
+// never started, so it only uses the engine and never an audio output.
+class BatchWorker : public Runnable {
+ public:
+  BatchWorker(BatchSynthesizer *batch,
+              int index,
+              TtsEngine *engine,
+              Threading *threading)
+      : queue_mutex_(threading->CreateMutex()),
+        batch_(batch),
+        index_(index),
+        engine_(engine),
+        service_(new TtsService(engine, NULL, threading)) {}
+
+  virtual ~BatchWorker() {
+    delete service_;
+    delete engine_;
+    delete queue_mutex_;
+  }
+
+  virtual void Run() {
+    int job_index;
+    while (batch_->TakeJob(index_, &job_index)) {
+      const BatchSynthesizer::Job& job = batch_->jobs_[job_index];
+      BatchResult *result = new BatchResult;
+      result->success = service_->RenderToBuffer(job.text,
+                                                 job.options,
+                                                 batch_->sample_rate_,
+                                                 batch_->channel_count_,
+                                                 &result->samples);
+      batch_->FinishJob(job_index, result);
+    }
+  }
+
+  // The indices of the jobs dealt to this worker that nobody has taken
+  // yet, protected by the queue mutex.  The worker takes them from the
+  // front; other workers steal from the back, which is needed last.
+  deque<int> queue_;
+  Mutex *queue_mutex_;
+
+ private:
+  BatchSynthesizer *batch_;
+  int index_;
+  TtsEngine *engine_;
+  TtsService *service_;
+};
+
+BatchSynthesizer::BatchSynthesizer(const vector<TtsEngine*>& engines,
+                                   Threading *threading)
+    : threading_(threading),
+      sample_rate_(0),
+      channel_count_(0),
+      listener_(NULL),
+      mutex_(threading->CreateMutex()),
+      next_result_(0),
+      delivering_(false),
+      failure_count_(0) {
+  for (size_t i = 0; i < engines.size(); i++)
+    workers_.push_back(new BatchWorker(this, i, engines[i], threading));
+}
+
+BatchSynthesizer::~BatchSynthesizer() {
+  for (size_t i = 0; i < workers_.size(); i++)
+    delete workers_[i];
+  for (size_t i = 0; i < jobs_.size(); i++)
+    delete jobs_[i].options;
+  delete mutex_;
+}
+
+int BatchSynthesizer::Add(const string& text, UtteranceOptions *options) {
+  Job job;
+  job.text = text;
+  job.options = options ? new UtteranceOptions(*options) : NULL;
+  jobs_.push_back(job);
+  return jobs_.size() - 1;
+}
+
+int BatchSynthesizer::Render(int sample_rate,
+                             int channel_count,
+                             BatchListener *listener) {
+  if (workers_.empty()) {
+    LOG(ERROR) << "No engines to render with.";
+    return jobs_.size();
+  }
+
+  sample_rate_ = sample_rate;
+  channel_count_ = channel_count;
+  listener_ = listener;
+  results_.assign(jobs_.size(), NULL);
+  next_result_ = 0;
+  delivering_ = false;
+  failure_count_ = 0;
+
+  // Deal the jobs out in turn, so that every worker starts near the front
+  // and results can be delivered in order early on.
+  for (size_t i = 0; i < jobs_.size(); i++)
+    workers_[i % workers_.size()]->queue_.push_back(i);
+
+  vector<Thread*> threads;
+  for (size_t i = 0; i < workers_.size(); i++)
+    threads.push_back(threading_->StartJoinableThread(workers_[i]));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i]->Join();
+
+  for (size_t i = 0; i < jobs_.size(); i++)
+    delete jobs_[i].options;
+  jobs_.clear();
+  results_.clear();
+  return failure_count_;
+}
+
+namespace {
+
+class VectorBatchListener : public BatchListener {
+ public:
+  explicit VectorBatchListener(vector<vector<int16_t> > *results)
+      : results_(results) {}
+
+  virtual void OnUtteranceRendered(int index,
+                                   bool success,
+                                   const vector<int16_t>& samples) {
+    (*results_)[index] = samples;
+  }
+
+ private:
+  vector<vector<int16_t> > *results_;
+};
+
+}  // namespace
+
+int BatchSynthesizer::Render(int sample_rate,
+                             int channel_count,
+                             vector<vector<int16_t> > *results) {
+  results->clear();
+  results->resize(jobs_.size());
+  VectorBatchListener listener(results);
+  return Render(sample_rate, channel_count, &listener);
+}
+
+bool BatchSynthesizer::TakeJob(int worker_index, int *job_index) {
+  // Take the next job of our own first, then steal.
+  int worker_count = workers_.size();
+  for (int i = 0; i < worker_count; i++) {
+    BatchWorker *worker = workers_[(worker_index + i) % worker_count];
+    ScopedLock sl(worker->queue_mutex_);
+    if (worker->queue_.empty())
+      continue;
+    if (i == 0) {
+      *job_index = worker->queue_.front();
+      worker->queue_.pop_front();
+    } else {
+      *job_index = worker->queue_.back();
+      worker->queue_.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void BatchSynthesizer::FinishJob(int job_index, BatchResult *result) {
+  {
+    ScopedLock sl(mutex_);
+    results_[job_index] = result;
+    if (!result->success)
+      failure_count_++;
+    if (delivering_) {
+      // The worker delivering will get to this result.
+      return;
+    }
+    delivering_ = true;
+  }
+
+  // Deliver every result that's next in order, without holding the mutex
+  // while the listener runs.
+  for (;;) {
+    int index;
+    {
+      ScopedLock sl(mutex_);
+      if (next_result_ == static_cast<int>(results_.size()) ||
+          results_[next_result_] == NULL) {
+        delivering_ = false;
+        return;
+      }
+      index = next_result_++;
+      result = results_[index];
+      results_[index] = NULL;
+    }
+    listener_->OnUtteranceRendered(index, result->success, result->samples);
+    delete result;
+  }
+}
+
+}  // namespace tts_service
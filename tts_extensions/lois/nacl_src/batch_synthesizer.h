@@ -0,0 +1,103 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Renders a large batch of utterances offline, such as all the prompts of
+// a user interface for one locale, using several engines on separate
+// threads.  Each engine is completely independent (a PicoTtsEngine has
+// its own Pico system and memory area, and Pico keeps no other mutable
+// state), so throughput scales with the number of cores.
+//
+// Utterances are dealt out to the threads in turn; a thread that runs out
+// of work takes the last utterance waiting for another thread.  Results
+// are delivered in the order the utterances were added, each as soon as
+// it and all the ones before it are done.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_BATCH_SYNTHESIZER_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_BATCH_SYNTHESIZER_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "threading.h"
+#include "tts_service.h"
+
+using std::deque;
+using std::string;
+using std::vector;
+
+namespace tts_service {
+
+class BatchWorker;
+struct BatchResult;
+
+class BatchListener {
+ public:
+  virtual ~BatchListener() { }
+
+  // Called for each utterance in the order in which they were added, with
+  // its audio as interleaved frames.  |success| is false if it couldn't
+  // be rendered.  Called on one of the worker threads, but never on two
+  // at once.
+  virtual void OnUtteranceRendered(int index,
+                                   bool success,
+                                   const vector<int16_t>& samples) = 0;
+};
+
+class BatchSynthesizer {
+ public:
+  // Takes ownership of |engines|, which must all be distinct; one thread
+  // is used per engine.  Each engine is initialized on its own thread
+  // when it renders its first utterance.
+  BatchSynthesizer(const vector<TtsEngine*>& engines, Threading *threading);
+  ~BatchSynthesizer();
+
+  // Adds an utterance to the next batch and returns its index in it.
+  // Only the voice, rate, pitch and volume in |options| are used.
+  int Add(const string& text, UtteranceOptions *options = NULL);
+
+  // Renders the utterances added since the last call at |sample_rate| with
+  // |channel_count| channels, and passes them to |listener|.  Blocks until
+  // they have all been delivered.  Returns the number that failed.
+  int Render(int sample_rate, int channel_count, BatchListener *listener);
+
+  // Renders into |results|, which is replaced with one vector of
+  // interleaved frames per utterance.
+  int Render(int sample_rate,
+             int channel_count,
+             vector<vector<int16_t> > *results);
+
+ private:
+  friend class BatchWorker;
+
+  struct Job {
+    string text;
+    UtteranceOptions *options;
+  };
+
+  // Called by the workers.
+  bool TakeJob(int worker_index, int *job_index);
+  void FinishJob(int job_index, BatchResult *result);
+
+  Threading *threading_;
+  vector<BatchWorker*> workers_;
+  vector<Job> jobs_;
+
+  // The state of the batch being rendered.
+  int sample_rate_;
+  int channel_count_;
+  BatchListener *listener_;
+
+  // Protects the fields below.
+  Mutex *mutex_;
+  vector<BatchResult*> results_;
+  int next_result_;
+  bool delivering_;
+  int failure_count_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_BATCH_SYNTHESIZER_H_
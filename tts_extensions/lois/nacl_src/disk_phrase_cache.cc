@@ -0,0 +1,400 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <stddef.h>
+#include <string.h>
+
+#ifndef EMBED_FILES
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <vector>
+
+#include "disk_phrase_cache.h"
+#include "log.h"
+#include "phrase_cache.h"
+
+using std::vector;
+
+namespace tts_service {
+
+namespace {
+
+const char kMagic[4] = { 'P', 'H', 'R', 'C' };
+// Version 2 keeps marker offsets into the normalized text of the key.
+const uint32_t kVersion = 2;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t bucket_count;
+  uint32_t end_offset;
+  uint32_t entry_count;
+};
+
+// The header and the buckets fill the first page.
+const int kPageSize = 4096;
+const uint32_t kBucketCount = (kPageSize - sizeof(FileHeader)) / 4;
+const uint32_t kFirstRecordOffset = kPageSize;
+
+// Followed by the key, padded to a multiple of 4 bytes, the markers as
+// three 32-bit values each, and the ADPCM data, also padded.
+struct RecordHeader {
+  // The offset of the next record in the same bucket, or 0.
+  uint32_t next;
+  uint32_t hash;
+  uint32_t key_size;
+  uint32_t marker_count;
+  uint32_t sample_count;
+  uint32_t sample_rate;
+};
+
+uint32_t Pad(uint32_t size) {
+  return (size + 3) & ~3;
+}
+
+// Whether a whole record at |offset| in |data| fits before |end_offset|,
+// and links only to an earlier record, so that a corrupt file can't make
+// a lookup read past the mapping or loop forever.
+bool IsValidRecord(const uint8_t *data, uint32_t offset,
+                   uint32_t end_offset) {
+  if (offset < kFirstRecordOffset || (offset & 3) != 0 ||
+      static_cast<uint64_t>(offset) + sizeof(RecordHeader) > end_offset) {
+    return false;
+  }
+  const RecordHeader *record =
+      reinterpret_cast<const RecordHeader *>(data + offset);
+  uint64_t record_end = static_cast<uint64_t>(offset) +
+      sizeof(RecordHeader) +
+      Pad(record->key_size) +
+      static_cast<uint64_t>(record->marker_count) * 3 * sizeof(uint32_t) +
+      Pad(record->sample_count / 2 + (record->sample_count & 1));
+  return record->key_size <= end_offset &&
+      record_end <= end_offset &&
+      record->next < offset;
+}
+
+uint32_t HashKey(const string& key) {
+  // FNV-1a.
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < key.size(); i++) {
+    hash ^= static_cast<uint8_t>(key[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+//
+// IMA ADPCM, starting from a predicted value and step index of zero, with
+// the first sample of each byte in its low nibble.
+//
+
+const int kIndexTable[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+const int kStepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+  19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+  130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+  5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+class AdpcmState {
+ public:
+  AdpcmState() : predicted_(0), index_(0) { }
+
+  int Encode(int sample) {
+    int step = kStepTable[index_];
+    int diff = sample - predicted_;
+    int code = 0;
+    if (diff < 0) {
+      code = 8;
+      diff = -diff;
+    }
+    if (diff >= step) {
+      code |= 4;
+      diff -= step;
+    }
+    if (diff >= step >> 1) {
+      code |= 2;
+      diff -= step >> 1;
+    }
+    if (diff >= step >> 2)
+      code |= 1;
+    Decode(code);
+    return code;
+  }
+
+  int Decode(int code) {
+    int step = kStepTable[index_];
+    int delta = step >> 3;
+    if (code & 4)
+      delta += step;
+    if (code & 2)
+      delta += step >> 1;
+    if (code & 1)
+      delta += step >> 2;
+    predicted_ += (code & 8) ? -delta : delta;
+    if (predicted_ > 32767)
+      predicted_ = 32767;
+    if (predicted_ < -32768)
+      predicted_ = -32768;
+    index_ += kIndexTable[code];
+    if (index_ < 0)
+      index_ = 0;
+    if (index_ > 88)
+      index_ = 88;
+    return predicted_;
+  }
+
+ private:
+  int predicted_;
+  int index_;
+};
+
+}  // namespace
+
+DiskPhraseCache::DiskPhraseCache()
+    : fd_(-1),
+      max_size_in_bytes_(0),
+      data_(NULL),
+      mapped_size_(0),
+      end_offset_(0),
+      entry_count_(0) {
+}
+
+DiskPhraseCache::~DiskPhraseCache() {
+  Close();
+}
+
+#ifndef EMBED_FILES
+
+bool DiskPhraseCache::Open(const char *path, int max_size_in_bytes) {
+  Close();
+  max_size_in_bytes_ = max_size_in_bytes;
+  fd_ = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Unable to open phrase cache " << path;
+    return false;
+  }
+
+  struct stat st;
+  FileHeader header;
+  bool valid = (fstat(fd_, &st) == 0 &&
+                st.st_size >= static_cast<off_t>(kFirstRecordOffset) &&
+                pread(fd_, &header, sizeof(header), 0) == sizeof(header) &&
+                memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+                header.version == kVersion &&
+                header.bucket_count == kBucketCount &&
+                header.end_offset >= kFirstRecordOffset &&
+                static_cast<off_t>(header.end_offset) <= st.st_size);
+  if (!valid) {
+    LOG(INFO) << "Creating phrase cache " << path;
+    vector<uint8_t> page(kPageSize, 0);
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.bucket_count = kBucketCount;
+    header.end_offset = kFirstRecordOffset;
+    header.entry_count = 0;
+    memcpy(&page[0], &header, sizeof(header));
+    if (ftruncate(fd_, 0) != 0 || !WriteAt(0, &page[0], kPageSize)) {
+      Close();
+      return false;
+    }
+  } else if (static_cast<off_t>(header.end_offset) < st.st_size &&
+             ftruncate(fd_, header.end_offset) != 0) {
+    // Drop a record that wasn't finished.
+    LOG(ERROR) << "Unable to truncate phrase cache " << path;
+    Close();
+    return false;
+  }
+  end_offset_ = header.end_offset;
+  entry_count_ = header.entry_count;
+
+  if (!MapFile()) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void DiskPhraseCache::Close() {
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), mapped_size_);
+  data_ = NULL;
+  mapped_size_ = 0;
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+  end_offset_ = 0;
+  entry_count_ = 0;
+}
+
+bool DiskPhraseCache::MapFile() {
+  if (data_ && mapped_size_ >= end_offset_)
+    return true;
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), mapped_size_);
+  void *data = mmap(NULL, end_offset_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Unable to map phrase cache";
+    data_ = NULL;
+    mapped_size_ = 0;
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  mapped_size_ = end_offset_;
+  return true;
+}
+
+bool DiskPhraseCache::WriteAt(uint32_t offset, const void *data, int size) {
+  if (pwrite(fd_, data, size, offset) != size) {
+    LOG(ERROR) << "Error writing phrase cache";
+    return false;
+  }
+  return true;
+}
+
+#else  // EMBED_FILES
+
+bool DiskPhraseCache::Open(const char *path, int max_size_in_bytes) {
+  LOG(ERROR) << "No file access for the phrase cache " << path;
+  return false;
+}
+
+void DiskPhraseCache::Close() {
+}
+
+bool DiskPhraseCache::MapFile() {
+  return false;
+}
+
+bool DiskPhraseCache::WriteAt(uint32_t offset, const void *data, int size) {
+  return false;
+}
+
+#endif  // EMBED_FILES
+
+uint32_t DiskPhraseCache::FindRecord(const string& key, uint32_t hash) {
+  const uint32_t *buckets =
+      reinterpret_cast<const uint32_t *>(data_ + sizeof(FileHeader));
+  uint32_t offset = buckets[hash % kBucketCount];
+  while (offset != 0) {
+    if (!IsValidRecord(data_, offset, end_offset_)) {
+      LOG(ERROR) << "Corrupt phrase cache record at " << offset;
+      return 0;
+    }
+    const RecordHeader *record =
+        reinterpret_cast<const RecordHeader *>(data_ + offset);
+    if (record->hash == hash &&
+        record->key_size == key.size() &&
+        memcmp(record + 1, key.data(), key.size()) == 0) {
+      return offset;
+    }
+    offset = record->next;
+  }
+  return 0;
+}
+
+bool DiskPhraseCache::Lookup(const string& key, PhraseAudio *audio) {
+  if (!data_)
+    return false;
+  uint32_t offset = FindRecord(key, HashKey(key));
+  if (offset == 0)
+    return false;
+
+  const RecordHeader *record =
+      reinterpret_cast<const RecordHeader *>(data_ + offset);
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(record + 1) +
+      Pad(record->key_size);
+  const uint32_t *marker_data = reinterpret_cast<const uint32_t *>(p);
+  audio->markers.resize(record->marker_count);
+  for (uint32_t i = 0; i < record->marker_count; i++) {
+    audio->markers[i].frame = marker_data[i * 3];
+    audio->markers[i].type =
+        static_cast<tts_marker_type>(marker_data[i * 3 + 1]);
+    audio->markers[i].text_offset = marker_data[i * 3 + 2];
+  }
+  p += record->marker_count * 3 * sizeof(uint32_t);
+
+  audio->sample_rate = record->sample_rate;
+  audio->channel_count = 1;
+  audio->samples.resize(record->sample_count);
+  AdpcmState state;
+  for (uint32_t i = 0; i < record->sample_count; i++) {
+    int code = (i & 1) ? p[i >> 1] >> 4 : p[i >> 1] & 0xf;
+    audio->samples[i] = static_cast<int16_t>(state.Decode(code));
+  }
+  return true;
+}
+
+bool DiskPhraseCache::Insert(const string& key, const PhraseAudio& audio) {
+  if (!data_ || audio.channel_count != 1)
+    return false;
+  uint32_t hash = HashKey(key);
+  if (FindRecord(key, hash) != 0)
+    return true;
+
+  uint32_t sample_count = audio.samples.size();
+  uint32_t marker_count = audio.markers.size();
+  uint32_t record_size = sizeof(RecordHeader) +
+      Pad(key.size()) +
+      marker_count * 3 * sizeof(uint32_t) +
+      Pad((sample_count + 1) / 2);
+  if (end_offset_ + record_size > static_cast<uint32_t>(max_size_in_bytes_))
+    return true;
+
+  vector<uint8_t> buffer(record_size, 0);
+  const uint32_t *buckets =
+      reinterpret_cast<const uint32_t *>(data_ + sizeof(FileHeader));
+  uint32_t bucket = hash % kBucketCount;
+  RecordHeader *record = reinterpret_cast<RecordHeader *>(&buffer[0]);
+  record->next = buckets[bucket];
+  record->hash = hash;
+  record->key_size = key.size();
+  record->marker_count = marker_count;
+  record->sample_count = sample_count;
+  record->sample_rate = audio.sample_rate;
+  uint8_t *p = reinterpret_cast<uint8_t *>(record + 1);
+  memcpy(p, key.data(), key.size());
+  p += Pad(key.size());
+  uint32_t *marker_data = reinterpret_cast<uint32_t *>(p);
+  for (uint32_t i = 0; i < marker_count; i++) {
+    marker_data[i * 3] = audio.markers[i].frame;
+    marker_data[i * 3 + 1] = audio.markers[i].type;
+    marker_data[i * 3 + 2] = audio.markers[i].text_offset;
+  }
+  p += marker_count * 3 * sizeof(uint32_t);
+  AdpcmState state;
+  for (uint32_t i = 0; i < sample_count; i++) {
+    int code = state.Encode(audio.samples[i]);
+    p[i >> 1] |= (i & 1) ? code << 4 : code;
+  }
+
+  // Write the record and move the end offset past it before linking it
+  // in, so that the buckets never point past the end.
+  uint32_t offset = end_offset_;
+  uint32_t new_end_offset = offset + record_size;
+  uint32_t new_entry_count = entry_count_ + 1;
+  if (!WriteAt(offset, &buffer[0], record_size) ||
+      !WriteAt(offsetof(FileHeader, end_offset), &new_end_offset, 4) ||
+      !WriteAt(sizeof(FileHeader) + bucket * 4, &offset, 4) ||
+      !WriteAt(offsetof(FileHeader, entry_count), &new_entry_count, 4)) {
+    return false;
+  }
+  end_offset_ = new_end_offset;
+  entry_count_ = new_entry_count;
+  return MapFile();
+}
+
+}  // namespace tts_service
@@ -0,0 +1,76 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// A phrase cache kept in a file, so that synthesized phrases survive a
+// restart.  It backs the in-memory PhraseCache.
+//
+// The file is only ever appended to, and it's memory-mapped for reading.
+// It starts with a header and a hash table of the offsets of the first
+// record in each bucket, which together fill one page, followed by the
+// records.  Each record has the offset of the next one in its bucket, the
+// key, the markers and the audio, compressed with IMA ADPCM to 4 bits per
+// sample.  A record is only linked into its bucket once it's completely
+// written and the header's end offset has been moved past it, so a record
+// cut short by a crash is ignored.
+//
+// Everything is in the host's byte order, and the file must only be used
+// by one process at a time.  Only mono audio is stored, which is what
+// the Pico engine produces.  Not thread-safe; PhraseCache serializes
+// access.  File access isn't available when the lingware is embedded
+// (the Native Client build), so Open always fails there.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_DISK_PHRASE_CACHE_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_DISK_PHRASE_CACHE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+using std::string;
+
+namespace tts_service {
+
+struct PhraseAudio;
+
+class DiskPhraseCache {
+ public:
+  DiskPhraseCache();
+  ~DiskPhraseCache();
+
+  // Opens the cache file at |path|, creating it if it doesn't exist or
+  // isn't a valid cache file.  Nothing more is added once the file is
+  // |max_size_in_bytes| long.  Returns false on error.
+  bool Open(const char *path, int max_size_in_bytes);
+  void Close();
+
+  // If |key| is in the file, decompresses its audio to |audio| and returns
+  // true.
+  bool Lookup(const string& key, PhraseAudio *audio);
+
+  // Appends the audio for |key|, unless it's already there, it isn't mono,
+  // or the file is full.  Returns false on error.
+  bool Insert(const string& key, const PhraseAudio& audio);
+
+  // The number of phrases in the file.
+  int entry_count() { return entry_count_; }
+
+  // The size of the file in bytes.
+  int size_in_bytes() { return end_offset_; }
+
+ private:
+  // Maps everything up to the end offset, if it isn't already.
+  bool MapFile();
+  bool WriteAt(uint32_t offset, const void *data, int size);
+  uint32_t FindRecord(const string& key, uint32_t hash);
+
+  int fd_;
+  int max_size_in_bytes_;
+  const uint8_t *data_;
+  uint32_t mapped_size_;
+  uint32_t end_offset_;
+  int entry_count_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_DISK_PHRASE_CACHE_H_
@@ -5,14 +5,27 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "atomic_ops.h"
+#include "audio_sink.h"
 #include "earcon_manager.h"
 #include "log.h"
+#include "mapped_file.h"
+#include "polyphase_resampler.h"
 #include "resampler.h"
 #include "tts_receiver.h"
 
 namespace tts_service {
 
+// The number of frames resampled at a time; the same for every earcon, so
+// that they can all use the same resampler.
+static const int kResampleBufferFrames = 4096;
+
 struct WavFormatChunk {
   uint16_t format;
   uint16_t channels;
@@ -29,26 +42,119 @@ inline const uint32_t FourCharUInt32(const char *str) {
   return *reinterpret_cast<const uint32_t *>(str);
 }
 
+// The audio in a WAV file.
+struct WavAudio {
+  int channels;
+  int rate;
+  int frame_count;
+  // Points into the file if there's a single data chunk, which can be used
+  // in place, otherwise into |joined|, which has all the data chunks.
+  const int16_t* samples;
+  vector<int16_t> joined;
+};
+
+// Checks the WAV file in |data| and finds its audio.  Only 16-bit PCM
+// with one or two channels is supported.  Returns false on error.
+static bool ParseWav(const uint8_t* data, uint32_t size, WavAudio* audio) {
+  if (size < 12 ||
+      reinterpret_cast<const uint32_t*>(data)[0] != FourCharUInt32("RIFF") ||
+      reinterpret_cast<const uint32_t*>(data)[2] != FourCharUInt32("WAVE")) {
+    LOG(ERROR) << "File is not WAV format.";
+    return false;
+  }
+
+  audio->channels = 0;
+  audio->rate = 0;
+  audio->frame_count = 0;
+  audio->samples = NULL;
+  audio->joined.clear();
+
+  // The data chunks, which are almost always just one.
+  vector<uint32_t> data_offsets;
+  vector<uint32_t> data_bytes;
+
+  uint32_t pos = 12;
+  while (size - pos >= 8) {
+    uint32_t label;
+    uint32_t chunk_bytes;
+    memcpy(&label, &data[pos], 4);
+    memcpy(&chunk_bytes, &data[pos + 4], 4);
+    if (size - pos - 8 < chunk_bytes)
+      return false;
+    if (label == FourCharUInt32("fmt ")) {
+      if (chunk_bytes < sizeof(WavFormatChunk))
+        return false;
+      if (chunk_bytes > 1024)
+        return false;
+      WavFormatChunk format;
+      memcpy(&format, &data[pos + 8], sizeof(format));
+      if (format.format != 1)
+        return false;
+      if (format.channels < 1 || format.channels > 2)
+        return false;
+      if (format.bits_per_sample != 16)
+        return false;
+      unsigned int expected_byterate =
+          format.samplerate * format.channels * format.bits_per_sample / 8;
+      if (format.byterate != expected_byterate)
+        return false;
+      if (format.block_align != format.channels * format.bits_per_sample / 8)
+        return false;
+      audio->rate = format.samplerate;
+      audio->channels = format.channels;
+    } else if (label == FourCharUInt32("data")) {
+      if (audio->rate == 0 || audio->channels == 0)
+        return false;
+      int frames = chunk_bytes / (2 * audio->channels);
+      data_offsets.push_back(pos + 8);
+      data_bytes.push_back(frames * 2 * audio->channels);
+      audio->frame_count += frames;
+    }
+
+    // Chunks are padded to an even size.
+    pos += 8 + chunk_bytes + (chunk_bytes & 1);
+    if (pos > size)
+      break;
+  }
+  if (audio->frame_count == 0)
+    return false;
+
+  // Samples can only be used in place if they're properly aligned.
+  if (data_offsets.size() == 1 && (data_offsets[0] & 1) == 0) {
+    audio->samples = reinterpret_cast<const int16_t*>(&data[data_offsets[0]]);
+    return true;
+  }
+  audio->joined.resize(audio->frame_count * audio->channels);
+  uint8_t* joined = reinterpret_cast<uint8_t*>(&audio->joined[0]);
+  for (size_t i = 0; i < data_offsets.size(); i++) {
+    memcpy(joined, &data[data_offsets[i]], data_bytes[i]);
+    joined += data_bytes[i];
+  }
+  audio->samples = &audio->joined[0];
+  return true;
+}
+
+// Returns a 64-bit FNV-1a hash of |data|.
+static uint64_t HashData(const uint8_t* data, int size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Collects the output of a Resampler.
 class EarconReceiver : public TtsDataReceiver {
  public:
-  explicit EarconReceiver(Earcon* earcon) : earcon_(earcon) {}
+  explicit EarconReceiver(vector<int16_t>* samples) : samples_(samples) {}
 
   virtual tts_callback_status Receive(int rate,
                                       int num_channels,
                                       const int16_t* data,
                                       int num_samples) {
-    int count = num_samples;
-    if (count > earcon_->frame_count - earcon_->position)
-      count = earcon_->frame_count - earcon_->position;
-
-    for (int i = 0; i < count * num_channels; i++)
-      earcon_->data[num_channels * earcon_->position + i] = data[i];
-
-    earcon_->position += num_samples;
-    if (earcon_->position == earcon_->frame_count)
-      return TTS_CALLBACK_HALT;
-    else
-      return TTS_CALLBACK_CONTINUE;
+    samples_->insert(samples_->end(), data, data + num_samples);
+    return TTS_CALLBACK_CONTINUE;
   }
 
   virtual tts_callback_status Done() {
@@ -56,191 +162,401 @@ class EarconReceiver : public TtsDataReceiver {
   }
 
  private:
-  Earcon* earcon_;
+  vector<int16_t>* samples_;
 };
 
-EarconManager::EarconManager(int output_frame_rate, int output_channels)
-    : rate_(output_frame_rate), channels_(output_channels) {
+// Appends the output |resampler| has available to |samples|.
+static void ReadAvailableFrames(PolyphaseResampler* resampler,
+                                vector<int16_t>* samples) {
+  int frame_count = resampler->GetAvailableFrames();
+  if (frame_count == 0)
+    return;
+  int start = samples->size();
+  samples->resize(start + frame_count);
+  resampler->Read(&(*samples)[start], 1, frame_count);
+}
+
+// Adds |sample_count| samples of |input| to |output|, clipping the sums.
+// If |gains| isn't NULL, each sample of |input| is scaled first by the
+// gain of its channel, with 15 fractional bits.
+static void MixSamples(const int16_t* input,
+                       int16_t* output,
+                       int sample_count,
+                       int channel_count,
+                       const int16_t* gains) {
+  int i = 0;
+#if defined(__SSE2__)
+  // The gains repeat every channel_count samples, which divides 8.
+  if (channel_count == 1 || channel_count == 2) {
+    if (gains) {
+      __m128i gains8 = channel_count == 1 ?
+          _mm_set1_epi16(gains[0]) :
+          _mm_set_epi16(gains[1], gains[0], gains[1], gains[0],
+                        gains[1], gains[0], gains[1], gains[0]);
+      for (; i + 8 <= sample_count; i += 8) {
+        __m128i input8 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(input + i));
+        __m128i scaled8 = _mm_mulhi_epi16(input8, gains8);
+        scaled8 = _mm_add_epi16(scaled8, scaled8);
+        __m128i* output8 = reinterpret_cast<__m128i*>(output + i);
+        _mm_storeu_si128(output8,
+                         _mm_adds_epi16(_mm_loadu_si128(output8), scaled8));
+      }
+    } else {
+      for (; i + 8 <= sample_count; i += 8) {
+        __m128i input8 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(input + i));
+        __m128i* output8 = reinterpret_cast<__m128i*>(output + i);
+        _mm_storeu_si128(output8,
+                         _mm_adds_epi16(_mm_loadu_si128(output8), input8));
+      }
+    }
+  }
+#endif
+  // The same as above, one sample at a time.
+  for (; i < sample_count; i++) {
+    int sample = input[i];
+    if (gains)
+      sample = ((sample * gains[i % channel_count]) >> 16) * 2;
+    int value = output[i] + sample;
+    if (value > 32767)
+      value = 32767;
+    if (value < -32768)
+      value = -32768;
+    output[i] = value;
+  }
+}
+
+
+EarconManager::EarconManager(int output_frame_rate,
+                             int output_channels,
+                             ResamplerCache *resampler_cache)
+    : playing_(NULL),
+      command_read_(0),
+      command_write_(0),
+      stop_all_count_(0),
+      stopped_all_count_(0),
+      rate_(output_frame_rate),
+      channels_(output_channels),
+      resampler_cache_(resampler_cache) {
 }
 
 EarconManager::~EarconManager() {
   for (unsigned int i = 0; i < earcons_.size(); i++) {
-    delete[] earcons_[i].data;
+    delete earcons_[i]->file;
+    delete[] earcons_[i]->buffer;
+    delete earcons_[i];
   }
 }
 
+void EarconManager::SetCacheDirectory(const string& path) {
+  cache_directory_ = path;
+}
+
 int EarconManager::LoadEarcon(int frame_count,
                               int16_t* data,
                               int source_channels,
                               int source_rate,
                               bool loop) {
-  int earcon_id = earcons_.size();
-  earcons_.push_back(Earcon());
-  int16_t* new_data = new int16_t[frame_count * channels_];
+  vector<int16_t> samples;
+  ConvertAudio(data, frame_count, source_channels, source_rate, &samples);
+  int16_t* buffer = new int16_t[samples.size()];
+  if (!samples.empty())
+    memcpy(buffer, &samples[0], samples.size() * sizeof(int16_t));
+  return AddEarcon(buffer, samples.size() / channels_, NULL, buffer, loop);
+}
+
+int EarconManager::LoadEarconFromWavFile(const char *path, bool loop) {
+  MappedFile* file = new MappedFile();
+  WavAudio audio;
+  if (!file->Open(path) || !ParseWav(file->data(), file->size(), &audio)) {
+    LOG(ERROR) << "Error reading WAV file " << path;
+    delete file;
+    return -1;
+  }
+
+  // If the audio is already in the output format, play it straight from
+  // the file.
+  if (audio.rate == rate_ &&
+      audio.channels == channels_ &&
+      audio.joined.empty()) {
+    return AddEarcon(audio.samples, audio.frame_count, file, NULL, loop);
+  }
+
+  // Otherwise, look for it in the cache, converted earlier.
+  string cache_path;
+  if (!cache_directory_.empty()) {
+    char name[64];
+    snprintf(name, sizeof(name), "/earcon-%016llx-%d-%d.wav",
+             static_cast<unsigned long long>(
+                 HashData(file->data(), file->size())),
+             rate_, channels_);
+    cache_path = cache_directory_ + name;
+    int earcon_id = LoadCachedEarcon(cache_path, loop);
+    if (earcon_id >= 0) {
+      delete file;
+      return earcon_id;
+    }
+  }
+
+  vector<int16_t> samples;
+  ConvertAudio(audio.samples, audio.frame_count, audio.channels, audio.rate,
+               &samples);
+  delete file;
+
+  // Save it in the cache, and play it from there; if that fails, keep it
+  // in memory.
+  if (!cache_path.empty() && !samples.empty()) {
+    string temp_path = cache_path + ".tmp";
+    WavFileAudioSink sink(temp_path.c_str());
+    if (sink.Start(rate_, channels_)) {
+      bool saved = sink.Write(&samples[0], samples.size() / channels_);
+      saved = sink.Finish() && saved;
+      if (saved && rename(temp_path.c_str(), cache_path.c_str()) == 0) {
+        int earcon_id = LoadCachedEarcon(cache_path, loop);
+        if (earcon_id >= 0)
+          return earcon_id;
+      }
+      remove(temp_path.c_str());
+    }
+    LOG(ERROR) << "Unable to cache earcon " << cache_path;
+  }
+  int16_t* buffer = new int16_t[samples.size()];
+  if (!samples.empty())
+    memcpy(buffer, &samples[0], samples.size() * sizeof(int16_t));
+  return AddEarcon(buffer, samples.size() / channels_, NULL, buffer, loop);
+}
+
+int EarconManager::LoadCachedEarcon(const string& path, bool loop) {
+  MappedFile* file = new MappedFile();
+  WavAudio audio;
+  if (file->Open(path.c_str()) &&
+      ParseWav(file->data(), file->size(), &audio) &&
+      audio.rate == rate_ &&
+      audio.channels == channels_ &&
+      audio.joined.empty()) {
+    return AddEarcon(audio.samples, audio.frame_count, file, NULL, loop);
+  }
+  delete file;
+  return -1;
+}
+
+int EarconManager::AddEarcon(const int16_t* data,
+                             int frame_count,
+                             MappedFile* file,
+                             int16_t* buffer,
+                             bool loop) {
+  Earcon* earcon = new Earcon();
+  earcon->frame_count = frame_count;
+  earcon->data = data;
+  earcon->file = file;
+  earcon->buffer = buffer;
+  earcon->is_playing = false;
+  earcon->position = 0;
+  earcon->loop = loop;
+  earcon->scaled = false;
+  earcon->listed = false;
+  earcon->next_playing = NULL;
+  earcons_.push_back(earcon);
+  return earcons_.size() - 1;
+}
 
+void EarconManager::ConvertAudio(const int16_t* data,
+                                 int frame_count,
+                                 int source_channels,
+                                 int source_rate,
+                                 vector<int16_t>* output) {
   // Convert from the source channels to the destination number of
   // channels.
+  vector<int16_t> converted(frame_count * channels_);
   if (source_channels == 1 && channels_ == 2) {
     for (int i = 0; i < frame_count; i++) {
-      new_data[2 * i] = data[i];
-      new_data[2 * i + 1] = data[i];
+      converted[2 * i] = data[i];
+      converted[2 * i + 1] = data[i];
     }
   } else if (source_channels == 2 && channels_ == 1) {
     for (int i = 0; i < frame_count; i++)
-      new_data[i] = (data[2 * i] + data[2 * i + 1]) / 2;
+      converted[i] = (data[2 * i] + data[2 * i + 1]) / 2;
   } else if (source_channels == channels_) {
     for (int i = 0; i < frame_count * channels_; i++)
-      new_data[i] = data[i];
+      converted[i] = data[i];
   } else {
     LOG(ERROR) << "Fatal: unsupported number of channels";
     exit(0);
   }
 
-  // Initialize the earcon. If the sample rate is unchanged, we're done.
-  Earcon* earcon = &earcons_.back();
-  earcon->is_playing = false;
-  earcon->position = 0;
-  earcon->loop = loop;
+  // If the sample rate is unchanged, we're done.
   if (source_rate == rate_) {
-    earcon->frame_count = frame_count;
-    earcon->data = new_data;
-    return earcon_id;
-  }
-
-  // Resample if needed.
-  int new_size = frame_count * rate_ / source_rate;
-  earcon->frame_count = new_size;
-  earcon->data = new int16_t[new_size * channels_];
-  EarconReceiver receiver(earcon);
-  Resampler resampler(&receiver, source_rate, rate_, new_size);
-  resampler.Receive(source_rate, channels_, data, frame_count);
-  resampler.Done();
-  earcon->frame_count = earcon->position;
-  earcon->position = 0;
-  delete[] new_data;
-  return earcon_id;
-}
-
-int EarconManager::LoadEarconFromWavFile(const char *path, bool loop) {
-  FILE* fp = fopen(path, "rb");
-  if (!fp || ferror(fp)) {
-    return -1;
-  }
-  fseek(fp, 0, SEEK_END);
-  unsigned int filelen = static_cast<unsigned int>(ftell(fp));
-  if (filelen < 40) {
-    LOG(ERROR) << "File too short to be a WAV file.";
-    return -1;
-  }
-  fseek(fp, 0, SEEK_SET);
-  char* data = new char[filelen];
-  if (filelen != fread(data, 1, filelen, fp)) {
-    LOG(ERROR) << "Error reading file.";
-    delete[] data;
-    return -1;
+    output->swap(converted);
+    return;
   }
 
-  if (reinterpret_cast<uint32_t*>(data)[0] != FourCharUInt32("RIFF") ||
-      reinterpret_cast<uint32_t*>(data)[2] != FourCharUInt32("WAVE")) {
-    LOG(ERROR) << "File is not WAV format.";
-    delete[] data;
-    return -1;
-  }
-
-  int channels = 0;
-  int rate = 0;
-  int bitrate = 0;
-  int frames = 0;
-  int16_t* audio_data = new int16_t[1];
-
-  int pos = 12;
-  while (filelen - pos >= 8) {
-    uint32_t label = reinterpret_cast<uint32_t*>(&data[pos])[0];
-    uint32_t chunk_bytes = reinterpret_cast<uint32_t*>(&data[pos])[1];
-    if (filelen - pos < chunk_bytes)
-      goto err;
-    if (label == FourCharUInt32("fmt ")) {
-      if (chunk_bytes < sizeof(WavFormatChunk))
-        goto err;
-      if (chunk_bytes > 1024)
-        goto err;
-      WavFormatChunk* format =
-          reinterpret_cast<WavFormatChunk*>(&data[pos + 8]);
-      if (format->format != 1)
-        goto err;
-      if (format->channels < 1 || format->channels > 2)
-        goto err;
-      if (format->bits_per_sample != 16)
-        goto err;
-      unsigned int expected_byterate =
-          format->samplerate * format->channels *
-          format->bits_per_sample / 8;
-      if (format->byterate != expected_byterate)
-        goto err;
-      if (format->block_align !=
-          format->channels * format->bits_per_sample / 8)
-        goto err;
-      rate = format->samplerate;
-      channels = format->channels;
-      bitrate = format->byterate + 8;
-    } else if (label == FourCharUInt32("data")) {
-      if (rate == 0 || channels == 0)
-        goto err;
-      int new_frames = chunk_bytes / (2 * channels);
-      int16_t* new_audio_data = reinterpret_cast<int16_t*>(&data[pos + 8]);
-      int16_t* old_audio_data = audio_data;
-      audio_data = new int16_t[(frames + new_frames) * channels];
-      for (int i = 0; i < frames * channels; i++)
-        audio_data[i] = old_audio_data[i];
-      for (int i = 0; i < new_frames * channels; i++)
-        audio_data[i + frames * channels] = new_audio_data[i];
-      delete[] old_audio_data;
-      frames += new_frames;
+  // Resample one channel at a time, since the resamplers are mono.
+  vector<int16_t> input(frame_count);
+  vector<vector<int16_t> > resampled(channels_);
+  int output_frames = -1;
+  for (int c = 0; c < channels_; c++) {
+    for (int i = 0; i < frame_count; i++)
+      input[i] = converted[i * channels_ + c];
+    vector<int16_t>* channel = &resampled[c];
+    if (PolyphaseResampler::IsSupported(source_rate, rate_)) {
+      PolyphaseResampler *resampler =
+          resampler_cache_->GetPolyphaseResampler(source_rate, rate_);
+      // A block at a time, so that the resampler's positions, in
+      // fractions of a frame, can't overflow on a long earcon.
+      for (int i = 0; i < frame_count; i += kResampleBufferFrames) {
+        int block_frames = frame_count - i;
+        if (block_frames > kResampleBufferFrames)
+          block_frames = kResampleBufferFrames;
+        resampler->AddInput(&input[i], block_frames);
+        ReadAvailableFrames(resampler, channel);
+      }
+      resampler->Finish();
+      ReadAvailableFrames(resampler, channel);
+      resampler_cache_->ReleasePolyphaseResampler(resampler);
+    } else {
+      EarconReceiver receiver(channel);
+      Resampler *resampler = resampler_cache_->GetResampler(
+          &receiver, source_rate, rate_, kResampleBufferFrames, false);
+      resampler->Receive(source_rate, 1, &input[0], frame_count);
+      resampler->Done();
+      resampler_cache_->ReleaseResampler(resampler);
     }
-
-    pos += chunk_bytes + 8;
+    if (output_frames < 0 || static_cast<int>(channel->size()) < output_frames)
+      output_frames = channel->size();
   }
 
-  if (frames && channels && rate) {
-    int earcon_id = LoadEarcon(frames, audio_data, channels, rate, loop);
-    delete[] data;
-    delete[] audio_data;
-    return earcon_id;
+  output->resize(output_frames * channels_);
+  for (int c = 0; c < channels_; c++) {
+    for (int i = 0; i < output_frames; i++)
+      (*output)[i * channels_ + c] = resampled[c][i];
   }
-
- err:
-  LOG(ERROR) << "Error reading WAV file";
-  delete[] data;
-  delete[] audio_data;
-  return -1;
 }
 
 void EarconManager::Play(int earcon_id) {
-  earcons_[earcon_id].is_playing = true;
-  earcons_[earcon_id].position = 0;
+  Play(earcon_id, 1, 0);
+}
+
+void EarconManager::Play(int earcon_id, float gain, float pan) {
+  EarconCommand command;
+  command.type = EARCON_COMMAND_PLAY;
+  command.earcon = earcons_[earcon_id];
+  SetGains(gain, pan, &command);
+  SendCommand(command);
+}
+
+void EarconManager::SetGain(int earcon_id, float gain, float pan) {
+  EarconCommand command;
+  command.type = EARCON_COMMAND_SET_GAIN;
+  command.earcon = earcons_[earcon_id];
+  SetGains(gain, pan, &command);
+  SendCommand(command);
 }
 
 void EarconManager::Stop(int earcon_id) {
-  earcons_[earcon_id].is_playing = false;
+  EarconCommand command;
+  command.type = EARCON_COMMAND_STOP;
+  command.earcon = earcons_[earcon_id];
+  SendCommand(command);
 }
 
 void EarconManager::StopAll() {
-  for (unsigned int i = 0; i < earcons_.size(); i++)
-    earcons_[i].is_playing = false;
+  // This doesn't go through the queue, so that it can't be dropped; the
+  // commands sent after it carry the new count.
+  ReleaseStore(&stop_all_count_, stop_all_count_ + 1);
 }
 
 bool EarconManager::IsPlaying(int earcon_id) {
-  return earcons_[earcon_id].is_playing;
+  return AcquireLoad(&earcons_[earcon_id]->is_playing);
 }
 
 bool EarconManager::IsAnythingPlaying() {
-  for (unsigned int i = 0; i < earcons_.size(); i++) {
-    if (earcons_[i].is_playing)
+  for (Earcon* earcon = playing_; earcon; earcon = earcon->next_playing) {
+    if (earcon->is_playing)
       return true;
   }
   return false;
 }
 
+void EarconManager::SetGains(float gain, float pan, EarconCommand* command) {
+  if (gain < 0)
+    gain = 0;
+  if (gain > 1)
+    gain = 1;
+  if (pan < -1)
+    pan = -1;
+  if (pan > 1)
+    pan = 1;
+
+  // The gains are worked out here, so that mixing costs the same whatever
+  // they are, and nothing extra when they're 1.
+  float left = gain * (pan > 0 ? 1 - pan : 1);
+  float right = gain * (pan < 0 ? 1 + pan : 1);
+  if (channels_ == 1)
+    left = right = gain;
+  command->scaled = (left < 1 || right < 1);
+  command->channel_gains[0] = static_cast<int16_t>(left * 32767 + 0.5f);
+  command->channel_gains[1] = static_cast<int16_t>(right * 32767 + 0.5f);
+}
+
+void EarconManager::SendCommand(const EarconCommand& command) {
+  unsigned int write = command_write_;
+  if (write - AcquireLoad(&command_read_) > kCommandMask) {
+    LOG(ERROR) << "Too many earcon commands pending, dropping one";
+    return;
+  }
+  commands_[write & kCommandMask] = command;
+  commands_[write & kCommandMask].stop_all_count = stop_all_count_;
+  ReleaseStore(&command_write_, write + 1);
+}
+
+void EarconManager::StopAllPlaying(unsigned int stop_all_count) {
+  for (Earcon* earcon = playing_; earcon; earcon = earcon->next_playing)
+    ReleaseStore(&earcon->is_playing, false);
+  stopped_all_count_ = stop_all_count;
+}
+
+void EarconManager::ProcessCommands() {
+  // Read the stop-all count first: any command sent after a later StopAll
+  // carries a count it hasn't caught up with yet.  Counts are only ever
+  // compared to see which is newer, so that a stale one can never stop a
+  // later Play or move stopped_all_count_ backwards.
+  unsigned int stop_all_count = AcquireLoad(&stop_all_count_);
+  unsigned int read = command_read_;
+  unsigned int write = AcquireLoad(&command_write_);
+  for (; read != write; read++) {
+    const EarconCommand& command = commands_[read & kCommandMask];
+    if (static_cast<int>(command.stop_all_count - stopped_all_count_) > 0)
+      StopAllPlaying(command.stop_all_count);
+    Earcon* earcon = command.earcon;
+    if (command.type == EARCON_COMMAND_PLAY ||
+        command.type == EARCON_COMMAND_SET_GAIN) {
+      earcon->scaled = command.scaled;
+      earcon->channel_gains[0] = command.channel_gains[0];
+      earcon->channel_gains[1] = command.channel_gains[1];
+    }
+    switch (command.type) {
+      case EARCON_COMMAND_PLAY:
+        earcon->position = 0;
+        ReleaseStore(&earcon->is_playing, true);
+        if (!earcon->listed) {
+          earcon->listed = true;
+          earcon->next_playing = playing_;
+          playing_ = earcon;
+        }
+        break;
+      case EARCON_COMMAND_SET_GAIN:
+        break;
+      case EARCON_COMMAND_STOP:
+        ReleaseStore(&earcon->is_playing, false);
+        break;
+    }
+  }
+  ReleaseStore(&command_read_, read);
+  if (static_cast<int>(stop_all_count - stopped_all_count_) > 0)
+    StopAllPlaying(stop_all_count);
+}
+
 void EarconManager::FillAudioBuffer(int16_t* data,
                                     int frame_count,
                                     int channel_count) {
@@ -251,32 +567,43 @@ void EarconManager::FillAudioBuffer(int16_t* data,
     exit(-1);
   }
 
-  for (unsigned int i = 0; i < earcons_.size(); i++) {
-    // Skip earcons that aren't playing now.
-    if (!earcons_[i].is_playing)
+  ProcessCommands();
+
+  Earcon** link = &playing_;
+  while (*link) {
+    Earcon* earcon = *link;
+
+    // Take earcons that were stopped off the list.
+    if (!earcon->is_playing) {
+      *link = earcon->next_playing;
+      earcon->next_playing = NULL;
+      earcon->listed = false;
       continue;
+    }
 
-    // Figure out how many frames of this earcon to play.
-    int count = frame_count;
-    if (count > earcons_[i].frame_count - earcons_[i].position)
-      count = earcons_[i].frame_count - earcons_[i].position;
-
-    // Mix in this earcon with the existing audio, and handle
-    // clipping properly.
-    int16_t* earcon_data = &earcons_[i].data[
-        channels_ * earcons_[i].position];
-    for (int j = 0; j < count * channels_; j++) {
-      int value = data[j] + earcon_data[j];
-      if (value > 32767)
-        value = 32767;
-      if (value < -32768)
-        value = -32768;
-      data[j] = value;
+    // Mix in as much of this earcon as fits, starting over at the end if
+    // it loops.
+    const int16_t* gains = earcon->scaled ? earcon->channel_gains : NULL;
+    int frame = 0;
+    while (frame < frame_count && earcon->is_playing) {
+      int count = frame_count - frame;
+      if (count > earcon->frame_count - earcon->position)
+        count = earcon->frame_count - earcon->position;
+      MixSamples(&earcon->data[channels_ * earcon->position],
+                 &data[channels_ * frame],
+                 count * channels_,
+                 channels_,
+                 gains);
+      frame += count;
+      earcon->position += count;
+      if (earcon->position == earcon->frame_count) {
+        earcon->position = 0;
+        if (!earcon->loop || earcon->frame_count == 0)
+          ReleaseStore(&earcon->is_playing, false);
+      }
     }
 
-    earcons_[i].position += count;
-    if (earcons_[i].position == earcons_[i].frame_count)
-      earcons_[i].is_playing = false;
+    link = &earcon->next_playing;
   }
 }
 
@@ -8,47 +8,104 @@
 // set of earcons from audio files and then handles playing them, mixing
 // them with an audio stream.
 //
-// The earcons are stored in memory, uncompressed, and they're resampled
-// to the correct rate on load.  The memory requirements should be
-// minimal because earcons are short and there shouldn't be a reason
-// to have more than a few dozen at most.
+// Earcons loaded from WAV files are played straight from the memory-mapped
+// file when they're already at the output's rate and channel count, so
+// even long looping sounds are never copied to the heap.  Others are
+// converted on load, and if there's a cache directory, saved there as WAV
+// files named after a hash of the original and the output format, to be
+// mapped and played in place from then on.  Otherwise they're kept in
+// memory, uncompressed; the memory requirements should be minimal because
+// earcons are short and there shouldn't be a reason to have more than a
+// few dozen at most.
 //
 // Any number of earcons can all be playing at once. This class keeps
 // track of the play/pause status of all earcons and their current playback
 // position. It doesn't manage any audio output or threading, it just
 // implements a FillBuffer method that mixes in all playing earcons
-// with whatever audio data is already in the buffer.
+// with whatever audio data is already in the buffer.  The playing earcons
+// are kept in a list of their own, so the time that takes depends on how
+// many are playing, not on how many are loaded.
 //
 // A single earcon can only be playing once - playing it again restarts
 // it from the beginning.
+//
+// Play, SetGain and Stop don't touch the earcons; they add a command to a
+// fixed-size single-producer, single-consumer queue, which FillAudioBuffer
+// works through before mixing.  StopAll just counts the calls, so that
+// stopping everything is never dropped when the queue is full.  None of
+// them block or wait for the audio thread, and only the audio thread
+// changes what's playing.  They must all be called on one thread at a
+// time, which also loads the earcons.
 
 #ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_EARCON_MANAGER_H_
 #define SPEECH_CLIENT_SYNTHESIS_SERVICE_EARCON_MANAGER_H_
 
 #include <stdint.h>
 
+#include <string>
 #include <vector>
 
-#include "resampler.h"
+#include "resampler_cache.h"
 
+using std::string;
 using std::vector;
 
 namespace tts_service {
 
+class MappedFile;
+
 struct Earcon {
  public:
   int frame_count;
-  int16_t* data;
-  bool is_playing;
+  // The audio, in the output format, either in |file| or in |buffer|,
+  // which belong to the earcon.
+  const int16_t* data;
+  MappedFile* file;
+  int16_t* buffer;
+  // Only changed by the audio thread.
+  volatile bool is_playing;
   int position;
   bool loop;
+  // The gain of each output channel, with 15 fractional bits, set when
+  // the earcon starts playing; only used if |scaled|, otherwise the gain
+  // is 1.
+  int16_t channel_gains[2];
+  bool scaled;
+  // Whether the earcon is in the list of those playing, and the next one
+  // in it.  A stopped earcon stays there until the next FillAudioBuffer.
+  bool listed;
+  Earcon* next_playing;
+};
+
+enum EarconCommandType {
+  EARCON_COMMAND_PLAY,
+  EARCON_COMMAND_SET_GAIN,
+  EARCON_COMMAND_STOP
+};
+
+// A request to the audio thread; the gains are only set for
+// EARCON_COMMAND_PLAY and EARCON_COMMAND_SET_GAIN.
+struct EarconCommand {
+  EarconCommandType type;
+  Earcon* earcon;
+  int16_t channel_gains[2];
+  bool scaled;
+  // The number of StopAll calls before this command was sent.
+  unsigned int stop_all_count;
 };
 
 class EarconManager {
  public:
-  EarconManager(int output_frame_rate, int output_channels);
+  // Resamples earcons with resamplers from |resampler_cache|, which must
+  // outlive this object.
+  EarconManager(int output_frame_rate,
+                int output_channels,
+                ResamplerCache *resampler_cache);
   virtual ~EarconManager();
 
+  // Keep converted earcons in the directory at |path|, which must exist.
+  void SetCacheDirectory(const string& path);
+
   // Load audio data from memory, return an earcon id.  Makes a copy of
   // the audio data, so the caller should free |data| as needed.
   int LoadEarcon(int frame_count,
@@ -64,16 +121,25 @@ class EarconManager {
   // starts it playing again from the beginning.
   void Play(int earcon_id);
 
+  // The same, with a |gain| from 0 to 1 and a |pan| from -1 (left) to 1
+  // (right); at 0 both channels are at full gain.
+  void Play(int earcon_id, float gain, float pan);
+
+  // Changes the gain and pan of the given earcon, without restarting it.
+  void SetGain(int earcon_id, float gain, float pan);
+
   // Stop playing the given earcon.
   void Stop(int earcon_id);
 
   // Stop all earcons from playing.
   void StopAll();
 
-  // Returns whether or not the given earcon is playing.
+  // Returns whether or not the given earcon is playing, as of the last
+  // FillAudioBuffer.
   bool IsPlaying(int earcon_id);
 
-  // Returns whether or not any earcon is playing.
+  // Returns whether or not any earcon is playing.  Must be called on the
+  // audio thread.
   bool IsAnythingPlaying();
 
   // Mix any playing earcons into the given audio buffer and increment
@@ -81,9 +147,57 @@ class EarconManager {
   void FillAudioBuffer(int16_t* data, int frame_count, int channel_count);
 
  private:
-  vector<Earcon> earcons_;
+  // Loads an earcon converted earlier from the cache file at |path|;
+  // returns -1 if there's none.
+  int LoadCachedEarcon(const string& path, bool loop);
+
+  // Adds an earcon with |frame_count| frames of |data|, which is in |file|
+  // or |buffer|, and returns its id.
+  int AddEarcon(const int16_t* data,
+                int frame_count,
+                MappedFile* file,
+                int16_t* buffer,
+                bool loop);
+
+  // Sets the channel gains in |command| for |gain| and |pan|.
+  void SetGains(float gain, float pan, EarconCommand* command);
+
+  // Adds |command| to the queue, or drops it if the queue is full.
+  void SendCommand(const EarconCommand& command);
+
+  // Carries out the commands in the queue; called on the audio thread.
+  void ProcessCommands();
+
+  // Stops every earcon, as of StopAll call number |stop_all_count|.
+  void StopAllPlaying(unsigned int stop_all_count);
+
+  // Converts |frame_count| frames of |data| to the output's rate and
+  // channel count.
+  void ConvertAudio(const int16_t* data,
+                    int frame_count,
+                    int source_channels,
+                    int source_rate,
+                    vector<int16_t>* output);
+
+  vector<Earcon*> earcons_;
+  // The earcons playing, most recently started first.
+  Earcon* playing_;
+
+  // The command queue.  command_write_ is only modified by the thread
+  // sending commands and command_read_ only by the audio thread.
+  static const unsigned int kCommandMask = 255;
+  EarconCommand commands_[kCommandMask + 1];
+  volatile unsigned int command_read_;
+  volatile unsigned int command_write_;
+
+  // The number of StopAll calls, and the number the audio thread has
+  // carried out.
+  volatile unsigned int stop_all_count_;
+  unsigned int stopped_all_count_;
   int rate_;
   int channels_;
+  ResamplerCache *resampler_cache_;
+  string cache_directory_;
 };
 }  // namespace tts_service
 
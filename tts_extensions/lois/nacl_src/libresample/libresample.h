@@ -24,6 +24,17 @@ void *resample_open(int      highQuality,
 
 void *resample_dup(const void *handle);
 
+/* Like resample_open, but uses the filter of filterHandle, which must
+   stay open until this handle is closed, instead of computing a new
+   one; the quality is the same as filterHandle's. */
+void *resample_open_shared(const void *filterHandle,
+                           double      minFactor,
+                           double      maxFactor);
+
+/* Discards any input and output held in the handle, so that it can be
+   used for a new stream. */
+void resample_reset(void *handle);
+
 int resample_get_filter_width(const void *handle);
 
 int resample_process(void   *handle,
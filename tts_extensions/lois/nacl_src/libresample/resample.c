@@ -44,8 +44,41 @@ typedef struct {
    float  *Y;
    UWORD   Yp;
    double  Time;
+   int     ownsFilter; /* FALSE if Imp and ImpD belong to another handle */
 } rsdata;
 
+/* Sets up the input and output buffers of a handle whose filter
+   is already there, for the given range of factors */
+static void resample_init_buffers(rsdata *hp,
+                                  double minFactor,
+                                  double maxFactor)
+{
+   UWORD   Xoff_min, Xoff_max;
+
+   hp->minFactor = minFactor;
+   hp->maxFactor = maxFactor;
+
+   /* Calc reach of LP filter wing (plus some creeping room) */
+   Xoff_min = ((hp->Nmult+1)/2.0) * MAX(1.0, 1.0/minFactor) + 10;
+   Xoff_max = ((hp->Nmult+1)/2.0) * MAX(1.0, 1.0/maxFactor) + 10;
+   hp->Xoff = MAX(Xoff_min, Xoff_max);
+
+   /* Make the inBuffer size at least 4096, but larger if necessary
+      in order to store the minimum reach of the LP filter and then some.
+      Then allocate the buffer an extra Xoff larger so that
+      we can zero-pad up to Xoff zeros at the end when we reach the
+      end of the input samples. */
+   hp->XSize = MAX(2*hp->Xoff+10, 4096);
+   hp->X = (float *)malloc((hp->XSize + hp->Xoff) * sizeof(float));
+
+   /* Make the outBuffer long enough to hold the entire processed
+      output of one inBuffer */
+   hp->YSize = (int)(((double)hp->XSize)*maxFactor+2.0);
+   hp->Y = (float *)malloc(hp->YSize * sizeof(float));
+
+   resample_reset(hp);
+}
+
 void *resample_dup(const void *	handle)
 {
    const rsdata *cpy = (const rsdata *)handle;
@@ -73,6 +106,7 @@ void *resample_dup(const void *	handle)
    memcpy(hp->Y, cpy->Y, hp->YSize * sizeof(float));
    hp->Yp = cpy->Yp;
    hp->Time = cpy->Time;
+   hp->ownsFilter = TRUE;
 
    return (void *)hp;
 }
@@ -82,7 +116,6 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
    double *Imp64;
    double Rolloff, Beta;
    rsdata *hp;
-   UWORD   Xoff_min, Xoff_max;
    int i;
 
    /* Just exit if we get invalid factors */
@@ -98,9 +131,6 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
 
    hp = (rsdata *)malloc(sizeof(rsdata));
 
-   hp->minFactor = minFactor;
-   hp->maxFactor = maxFactor;
-
    if (highQuality)
       hp->Nmult = 35;
    else
@@ -118,6 +148,7 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
 
    hp->Imp = (float *)malloc(hp->Nwing * sizeof(float));
    hp->ImpD = (float *)malloc(hp->Nwing * sizeof(float));
+   hp->ownsFilter = TRUE;
    for(i=0; i<hp->Nwing; i++)
       hp->Imp[i] = Imp64[i];
 
@@ -131,18 +162,42 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
 
    free(Imp64);
 
-   /* Calc reach of LP filter wing (plus some creeping room) */
-   Xoff_min = ((hp->Nmult+1)/2.0) * MAX(1.0, 1.0/minFactor) + 10;
-   Xoff_max = ((hp->Nmult+1)/2.0) * MAX(1.0, 1.0/maxFactor) + 10;
-   hp->Xoff = MAX(Xoff_min, Xoff_max);
+   resample_init_buffers(hp, minFactor, maxFactor);
+
+   return (void *)hp;
+}
+
+void *resample_open_shared(const void *filterHandle,
+                           double      minFactor,
+                           double      maxFactor)
+{
+   const rsdata *filter = (const rsdata *)filterHandle;
+   rsdata *hp;
+
+   /* Just exit if we get invalid factors */
+   if (minFactor <= 0.0 || maxFactor <= 0.0 || maxFactor < minFactor)
+      return 0;
+
+   hp = (rsdata *)malloc(sizeof(rsdata));
+
+   /* The filter doesn't depend on the factors, so it can be used as is */
+   hp->Nmult = filter->Nmult;
+   hp->LpScl = filter->LpScl;
+   hp->Nwing = filter->Nwing;
+   hp->Imp = filter->Imp;
+   hp->ImpD = filter->ImpD;
+   hp->ownsFilter = FALSE;
+
+   resample_init_buffers(hp, minFactor, maxFactor);
+
+   return (void *)hp;
+}
+
+void resample_reset(void *handle)
+{
+   rsdata *hp = (rsdata *)handle;
+   int i;
 
-   /* Make the inBuffer size at least 4096, but larger if necessary
-      in order to store the minimum reach of the LP filter and then some.
-      Then allocate the buffer an extra Xoff larger so that
-      we can zero-pad up to Xoff zeros at the end when we reach the
-      end of the input samples. */
-   hp->XSize = MAX(2*hp->Xoff+10, 4096);
-   hp->X = (float *)malloc((hp->XSize + hp->Xoff) * sizeof(float));
    hp->Xp = hp->Xoff;
    hp->Xread = hp->Xoff;
 
@@ -150,15 +205,9 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
    for(i=0; i<hp->Xoff; i++)
       hp->X[i]=0;
 
-   /* Make the outBuffer long enough to hold the entire processed
-      output of one inBuffer */
-   hp->YSize = (int)(((double)hp->XSize)*maxFactor+2.0);
-   hp->Y = (float *)malloc(hp->YSize * sizeof(float));
    hp->Yp = 0;
 
    hp->Time = (double)hp->Xoff; /* Current-time pointer for converter */
-
-   return (void *)hp;
 }
 
 int resample_get_filter_width(const void   *handle)
@@ -340,8 +389,10 @@ void resample_close(void *handle)
    rsdata *hp = (rsdata *)handle;
    free(hp->X);
    free(hp->Y);
-   free(hp->Imp);
-   free(hp->ImpD);
+   if (hp->ownsFilter) {
+      free(hp->Imp);
+      free(hp->ImpD);
+   }
    free(hp);
 }
 
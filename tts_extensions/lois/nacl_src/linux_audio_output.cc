@@ -0,0 +1,411 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+#ifdef HAVE_PULSEAUDIO
+#include <pulse/error.h>
+#include <pulse/simple.h>
+#endif
+
+#include "atomic_ops.h"
+#include "audio_sink.h"
+#include "linux_audio_output.h"
+#include "log.h"
+
+namespace tts_service {
+
+namespace {
+
+int64_t GetTimeMicroseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+}  // namespace
+
+LinuxAudioOptions::LinuxAudioOptions()
+    : backend(LINUX_AUDIO_NULL),
+      sample_rate(44100),
+      channel_count(2),
+      period_frames(1024),
+      period_count(4),
+      clock_speed(1),
+      path(NULL),
+      device(NULL) {
+#if defined(HAVE_PULSEAUDIO)
+  backend = LINUX_AUDIO_PULSEAUDIO;
+#elif defined(HAVE_ALSA)
+  backend = LINUX_AUDIO_ALSA;
+#endif
+}
+
+AudioOutput* CreateLinuxAudioOutput(Threading* threading,
+                                    const LinuxAudioOptions& options) {
+  switch (options.backend) {
+    case LINUX_AUDIO_NULL:
+      return new VirtualClockAudioOutput(threading, options, NULL);
+    case LINUX_AUDIO_WAV_FILE:
+      return new WavFileAudioOutput(threading, options);
+#ifdef HAVE_ALSA
+    case LINUX_AUDIO_ALSA:
+      return new AlsaAudioOutput(threading, options);
+#endif
+#ifdef HAVE_PULSEAUDIO
+    case LINUX_AUDIO_PULSEAUDIO:
+      return new PulseAudioOutput(threading, options);
+#endif
+    default:
+      LOG(ERROR) << "Audio backend " << options.backend << " isn't built in.";
+      return NULL;
+  }
+}
+
+// static
+AudioOutput* AudioOutput::Create(Threading *threading) {
+  return CreateLinuxAudioOutput(threading, LinuxAudioOptions());
+}
+
+//
+// ThreadedAudioOutput
+//
+
+ThreadedAudioOutput::ThreadedAudioOutput(Threading* threading,
+                                         const LinuxAudioOptions& options)
+    : threading_(threading),
+      options_(options),
+      provider_(NULL),
+      thread_(NULL),
+      opened_(false),
+      running_(false),
+      played_periods_(0),
+      underrun_count_(0) {
+}
+
+ThreadedAudioOutput::~ThreadedAudioOutput() {
+  StopAudio();
+}
+
+bool ThreadedAudioOutput::Init(AudioProvider* provider) {
+  if (!opened_) {
+    if (options_.sample_rate <= 0 ||
+        options_.channel_count <= 0 ||
+        options_.period_frames <= 0 ||
+        options_.period_count <= 0) {
+      LOG(ERROR) << "Invalid audio output settings.";
+      return false;
+    }
+    if (!Open())
+      return false;
+    opened_ = true;
+    LOG(INFO) << "Audio output: " << options_.sample_rate << " Hz, "
+              << options_.channel_count << " channels, "
+              << options_.period_count << " periods of "
+              << options_.period_frames << " frames";
+  }
+  provider_ = provider;
+  period_.resize(options_.period_frames * options_.channel_count);
+  return true;
+}
+
+void ThreadedAudioOutput::StartAudio() {
+  if (thread_ || !opened_)
+    return;
+  running_ = true;
+  thread_ = threading_->StartJoinableThread(this);
+}
+
+void ThreadedAudioOutput::StopAudio() {
+  if (!thread_)
+    return;
+  running_ = false;
+  thread_->Join();
+  delete thread_;
+  thread_ = NULL;
+}
+
+int ThreadedAudioOutput::GetSampleRate() {
+  return options_.sample_rate;
+}
+
+int ThreadedAudioOutput::GetChannelCount() {
+  return options_.channel_count;
+}
+
+int ThreadedAudioOutput::GetChunkSizeInFrames() {
+  return options_.period_frames;
+}
+
+int ThreadedAudioOutput::GetTotalBufferSizeInFrames() {
+  return options_.period_frames * options_.period_count;
+}
+
+void ThreadedAudioOutput::Run() {
+  while (running_) {
+    if (!provider_->FillAudioBuffer(&period_[0],
+                                    options_.period_frames,
+                                    options_.channel_count)) {
+      break;
+    }
+    if (!WritePeriod(&period_[0]))
+      break;
+    AtomicIncrement(&played_periods_, 1);
+  }
+}
+
+int64_t ThreadedAudioOutput::GetPlayedFrames() {
+  return static_cast<int64_t>(AcquireLoad(&played_periods_)) *
+      options_.period_frames;
+}
+
+int ThreadedAudioOutput::GetUnderrunCount() {
+  return AcquireLoad(&underrun_count_);
+}
+
+void ThreadedAudioOutput::AddUnderrun() {
+  AtomicIncrement(&underrun_count_, 1);
+}
+
+//
+// VirtualClockAudioOutput
+//
+
+VirtualClockAudioOutput::VirtualClockAudioOutput(
+    Threading* threading,
+    const LinuxAudioOptions& options,
+    AudioSink* sink)
+    : ThreadedAudioOutput(threading, options),
+      sink_(sink),
+      next_period_start_(0),
+      period_duration_(0),
+      playing_(false) {
+}
+
+VirtualClockAudioOutput::~VirtualClockAudioOutput() {
+  StopAudio();
+}
+
+void VirtualClockAudioOutput::StartAudio() {
+  // Start over with an empty device buffer.
+  playing_ = false;
+  ThreadedAudioOutput::StartAudio();
+}
+
+bool VirtualClockAudioOutput::Open() {
+  if (options_.clock_speed > 0) {
+    period_duration_ = static_cast<int64_t>(
+        options_.period_frames * 1000000.0 /
+        (options_.sample_rate * options_.clock_speed));
+  }
+  if (sink_ && !sink_->Start(options_.sample_rate, options_.channel_count))
+    return false;
+  return true;
+}
+
+bool VirtualClockAudioOutput::WritePeriod(const int16_t* samples) {
+  if (sink_ && !sink_->Write(samples, options_.period_frames))
+    return false;
+  if (options_.clock_speed <= 0)
+    return true;
+
+  // The first period starts playing as soon as it's written, and each
+  // one after that as soon as the one before it ends.
+  int64_t now = GetTimeMicroseconds();
+  if (!playing_) {
+    playing_ = true;
+    next_period_start_ = now;
+  } else if (now > next_period_start_) {
+    AddUnderrun();
+    next_period_start_ = now;
+  }
+  next_period_start_ += period_duration_;
+
+  // Wait until the device has room for the next period, which is when the
+  // oldest one it has buffered has finished playing.
+  int64_t room_time =
+      next_period_start_ - (options_.period_count - 1) * period_duration_;
+  if (room_time > now)
+    usleep(static_cast<useconds_t>(room_time - now));
+  return true;
+}
+
+//
+// WavFileAudioOutput
+//
+
+WavFileAudioOutput::WavFileAudioOutput(Threading* threading,
+                                       const LinuxAudioOptions& options)
+    : VirtualClockAudioOutput(threading, options, NULL),
+      file_sink_(new WavFileAudioSink(options.path ? options.path : "")) {
+  sink_ = file_sink_;
+}
+
+WavFileAudioOutput::~WavFileAudioOutput() {
+  StopAudio();
+  file_sink_->Finish();
+  delete file_sink_;
+}
+
+//
+// AlsaAudioOutput
+//
+
+#ifdef HAVE_ALSA
+
+AlsaAudioOutput::AlsaAudioOutput(Threading* threading,
+                                 const LinuxAudioOptions& options)
+    : ThreadedAudioOutput(threading, options),
+      pcm_(NULL) {
+}
+
+AlsaAudioOutput::~AlsaAudioOutput() {
+  StopAudio();
+  if (pcm_)
+    snd_pcm_close(pcm_);
+}
+
+void AlsaAudioOutput::StopAudio() {
+  ThreadedAudioOutput::StopAudio();
+  // Throw away what's buffered, and be ready to start again.
+  if (pcm_) {
+    snd_pcm_drop(pcm_);
+    snd_pcm_prepare(pcm_);
+  }
+}
+
+bool AlsaAudioOutput::Open() {
+  const char* device = options_.device ? options_.device : "default";
+  int result = snd_pcm_open(&pcm_, device, SND_PCM_STREAM_PLAYBACK, 0);
+  if (result < 0) {
+    LOG(ERROR) << "Unable to open " << device << ": "
+               << snd_strerror(result);
+    pcm_ = NULL;
+    return false;
+  }
+
+  unsigned int rate = options_.sample_rate;
+  snd_pcm_uframes_t period_frames = options_.period_frames;
+  unsigned int period_count = options_.period_count;
+  snd_pcm_hw_params_t* params;
+  snd_pcm_hw_params_alloca(&params);
+  if ((result = snd_pcm_hw_params_any(pcm_, params)) < 0 ||
+      (result = snd_pcm_hw_params_set_access(
+          pcm_, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+      (result = snd_pcm_hw_params_set_format(
+          pcm_, params, SND_PCM_FORMAT_S16)) < 0 ||
+      (result = snd_pcm_hw_params_set_channels(
+          pcm_, params, options_.channel_count)) < 0 ||
+      (result = snd_pcm_hw_params_set_rate_near(
+          pcm_, params, &rate, NULL)) < 0 ||
+      (result = snd_pcm_hw_params_set_period_size_near(
+          pcm_, params, &period_frames, NULL)) < 0 ||
+      (result = snd_pcm_hw_params_set_periods_near(
+          pcm_, params, &period_count, NULL)) < 0 ||
+      (result = snd_pcm_hw_params(pcm_, params)) < 0) {
+    LOG(ERROR) << "Unable to configure " << device << ": "
+               << snd_strerror(result);
+    snd_pcm_close(pcm_);
+    pcm_ = NULL;
+    return false;
+  }
+  options_.sample_rate = rate;
+  options_.period_frames = period_frames;
+  options_.period_count = period_count;
+  return true;
+}
+
+bool AlsaAudioOutput::WritePeriod(const int16_t* samples) {
+  int remaining = options_.period_frames;
+  while (remaining > 0) {
+    snd_pcm_sframes_t written = snd_pcm_writei(pcm_, samples, remaining);
+    if (written == -EPIPE)
+      AddUnderrun();
+    if (written < 0) {
+      int result = snd_pcm_recover(pcm_, written, 1);
+      if (result < 0) {
+        LOG(ERROR) << "Error writing audio: " << snd_strerror(result);
+        return false;
+      }
+      continue;
+    }
+    samples += written * options_.channel_count;
+    remaining -= written;
+  }
+  return true;
+}
+
+#endif  // HAVE_ALSA
+
+//
+// PulseAudioOutput
+//
+
+#ifdef HAVE_PULSEAUDIO
+
+PulseAudioOutput::PulseAudioOutput(Threading* threading,
+                                   const LinuxAudioOptions& options)
+    : ThreadedAudioOutput(threading, options),
+      stream_(NULL) {
+}
+
+PulseAudioOutput::~PulseAudioOutput() {
+  StopAudio();
+  if (stream_)
+    pa_simple_free(stream_);
+}
+
+void PulseAudioOutput::StopAudio() {
+  ThreadedAudioOutput::StopAudio();
+  if (stream_)
+    pa_simple_flush(stream_, NULL);
+}
+
+bool PulseAudioOutput::Open() {
+  pa_sample_spec spec;
+  spec.format = PA_SAMPLE_S16NE;
+  spec.rate = options_.sample_rate;
+  spec.channels = options_.channel_count;
+
+  // Ask the server to keep the whole buffer filled and to ask for a
+  // period at a time.
+  uint32_t period_bytes =
+      options_.period_frames * options_.channel_count * sizeof(int16_t);
+  pa_buffer_attr attributes;
+  attributes.maxlength = static_cast<uint32_t>(-1);
+  attributes.tlength = period_bytes * options_.period_count;
+  attributes.prebuf = static_cast<uint32_t>(-1);
+  attributes.minreq = period_bytes;
+  attributes.fragsize = static_cast<uint32_t>(-1);
+
+  int error;
+  stream_ = pa_simple_new(options_.device, "tts_service",
+                          PA_STREAM_PLAYBACK, NULL, "Speech",
+                          &spec, NULL, &attributes, &error);
+  if (!stream_) {
+    LOG(ERROR) << "Unable to connect to PulseAudio: " << pa_strerror(error);
+    return false;
+  }
+  return true;
+}
+
+bool PulseAudioOutput::WritePeriod(const int16_t* samples) {
+  int error;
+  if (pa_simple_write(stream_, samples,
+                      options_.period_frames * options_.channel_count *
+                      sizeof(int16_t),
+                      &error) < 0) {
+    LOG(ERROR) << "Error writing audio: " << pa_strerror(error);
+    return false;
+  }
+  return true;
+}
+
+#endif  // HAVE_PULSEAUDIO
+
+}  // namespace tts_service
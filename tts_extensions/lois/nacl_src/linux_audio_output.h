@@ -0,0 +1,203 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// AudioOutputs for running the TtsService on a Linux host instead of in
+// the browser, for example in headless tests and on benchmark machines.
+// Each one has a thread of its own that asks the provider for one period
+// at a time, like a sound card's callback would, and passes it on to:
+//
+//   - nothing, on a virtual clock that runs at or faster than real time,
+//     or as fast as the provider can go;
+//   - a WAV file, on the same virtual clock;
+//   - an ALSA device, if built with HAVE_ALSA;
+//   - a PulseAudio server, if built with HAVE_PULSEAUDIO.
+//
+// The virtual clock and ALSA outputs count underruns, so that glitches
+// can be measured without a browser.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_LINUX_AUDIO_OUTPUT_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_LINUX_AUDIO_OUTPUT_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "audio_output.h"
+#include "threading.h"
+
+using std::vector;
+
+typedef struct _snd_pcm snd_pcm_t;
+typedef struct pa_simple pa_simple;
+
+namespace tts_service {
+
+class AudioSink;
+class WavFileAudioSink;
+
+enum linux_audio_backend {
+  LINUX_AUDIO_NULL = 0,
+  LINUX_AUDIO_WAV_FILE = 1,
+  LINUX_AUDIO_ALSA = 2,
+  LINUX_AUDIO_PULSEAUDIO = 3,
+};
+
+struct LinuxAudioOptions {
+ public:
+  // Default is PulseAudio if it was built in, then ALSA, then
+  // LINUX_AUDIO_NULL.
+  linux_audio_backend backend;
+  // Default is 44100.
+  int sample_rate;
+  // Default is 2.
+  int channel_count;
+  // The frames asked for at once.  Default is 1024.
+  int period_frames;
+  // The periods buffered ahead of what's playing.  Default is 4.
+  int period_count;
+  // For the null and WAV file outputs, how many times faster than real
+  // time the virtual clock runs; 0 runs it as fast as the provider can
+  // fill the periods, and never counts an underrun.  Default is 1.
+  float clock_speed;
+  // The WAV file to write, for LINUX_AUDIO_WAV_FILE.
+  const char* path;
+  // The ALSA device or PulseAudio server.  Default is NULL, for the
+  // default one.
+  const char* device;
+  LinuxAudioOptions();
+};
+
+// Returns a new AudioOutput for |options|, or NULL if its backend isn't
+// built in.
+AudioOutput* CreateLinuxAudioOutput(Threading* threading,
+                                    const LinuxAudioOptions& options);
+
+// The thread that pulls periods from the provider.  Subclasses open the
+// device and write to it.
+class ThreadedAudioOutput : public AudioOutput, public Runnable {
+ public:
+  ThreadedAudioOutput(Threading* threading, const LinuxAudioOptions& options);
+  // Subclasses must call StopAudio in their own destructor, before they
+  // close the device.
+  virtual ~ThreadedAudioOutput();
+
+  // Opens the device the first time it's called.
+  virtual bool Init(AudioProvider* provider);
+  virtual void StartAudio();
+  virtual void StopAudio();
+  // These are the settings the device actually accepted, once Init has
+  // been called.
+  virtual int GetSampleRate();
+  virtual int GetChannelCount();
+  virtual int GetChunkSizeInFrames();
+  virtual int GetTotalBufferSizeInFrames();
+
+  virtual void Run();
+
+  // The frames played since the output was created.
+  int64_t GetPlayedFrames();
+
+  // The number of times the device ran out of audio because a period
+  // wasn't ready in time.
+  int GetUnderrunCount();
+
+ protected:
+  // Opens the device, updating options_ with the settings it accepted.
+  // Returns false on error.
+  virtual bool Open() = 0;
+
+  // Plays one period from |samples|, blocking until the device has room
+  // for it.  Returns false if audio can't continue.
+  virtual bool WritePeriod(const int16_t* samples) = 0;
+
+  void AddUnderrun();
+
+  Threading* threading_;
+  LinuxAudioOptions options_;
+
+ private:
+  AudioProvider* provider_;
+  Thread* thread_;
+  bool opened_;
+  volatile bool running_;
+  volatile int played_periods_;
+  volatile int underrun_count_;
+  vector<int16_t> period_;
+};
+
+// Plays to |sink|, which may be NULL, on a virtual clock: the device is
+// taken to start playing as soon as the first period is written, to play
+// a period every period's worth of time divided by the clock speed, and
+// to have room for options_.period_count periods.  A period that's
+// written after it should have started playing counts as an underrun,
+// and the clock waits for it, like a real device that played silence in
+// the meantime.
+class VirtualClockAudioOutput : public ThreadedAudioOutput {
+ public:
+  VirtualClockAudioOutput(Threading* threading,
+                          const LinuxAudioOptions& options,
+                          AudioSink* sink);
+  virtual ~VirtualClockAudioOutput();
+
+  virtual void StartAudio();
+
+ protected:
+  virtual bool Open();
+  virtual bool WritePeriod(const int16_t* samples);
+
+  AudioSink* sink_;
+
+ private:
+  // Microseconds on the real clock: when the period written next should
+  // start playing, and the length of a period.
+  int64_t next_period_start_;
+  int64_t period_duration_;
+  // Whether a period has been written since StartAudio.
+  bool playing_;
+};
+
+// Writes the audio to a WAV file at options.path on a virtual clock.
+class WavFileAudioOutput : public VirtualClockAudioOutput {
+ public:
+  WavFileAudioOutput(Threading* threading, const LinuxAudioOptions& options);
+  virtual ~WavFileAudioOutput();
+
+ private:
+  WavFileAudioSink* file_sink_;
+};
+
+class AlsaAudioOutput : public ThreadedAudioOutput {
+ public:
+  AlsaAudioOutput(Threading* threading, const LinuxAudioOptions& options);
+  virtual ~AlsaAudioOutput();
+
+  virtual void StopAudio();
+
+ protected:
+  virtual bool Open();
+  virtual bool WritePeriod(const int16_t* samples);
+
+ private:
+  snd_pcm_t* pcm_;
+};
+
+// PulseAudio doesn't report underruns through its simple API, so they're
+// not counted.
+class PulseAudioOutput : public ThreadedAudioOutput {
+ public:
+  PulseAudioOutput(Threading* threading, const LinuxAudioOptions& options);
+  virtual ~PulseAudioOutput();
+
+  virtual void StopAudio();
+
+ protected:
+  virtual bool Open();
+  virtual bool WritePeriod(const int16_t* samples);
+
+ private:
+  pa_simple* stream_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_LINUX_AUDIO_OUTPUT_H_
@@ -78,17 +78,6 @@ tts_result PicoTtsEngine::LoadVoices(const string& filename) {
     voice->sg_lingware = "it-IT_cm0_sg.bin";
     voice->utpp_lingware = "it-IT_utpp.bin";
     voice->quality = TTS_NORMAL_QUALITY;
-
-    // Load properties
-    string rate;
-    IntToString(PICO_DEF_RATE, &rate);
-    properties_["rate"] = rate;
-    string pitch;
-    IntToString(PICO_DEF_PITCH, &pitch);
-    properties_["pitch"] = pitch;
-    string volume;
-    IntToString(PICO_DEF_VOL, &volume);
-    properties_["volume"] = volume;
   }
 
   return TTS_SUCCESS;
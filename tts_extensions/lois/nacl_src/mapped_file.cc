@@ -0,0 +1,98 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <stdio.h>
+
+#ifndef EMBED_FILES
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "log.h"
+#include "mapped_file.h"
+
+namespace tts_service {
+
+MappedFile::MappedFile()
+    : data_(NULL),
+      size_(0),
+      mapped_(false) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+#ifndef EMBED_FILES
+
+bool MappedFile::Open(const char *path) {
+  Close();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > 0x7fffffff) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after the file is closed.
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Unable to map " << path;
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = st.st_size;
+  mapped_ = true;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (mapped_)
+    munmap(const_cast<uint8_t *>(data_), size_);
+  else
+    delete[] data_;
+  data_ = NULL;
+  size_ = 0;
+  mapped_ = false;
+}
+
+#else  // EMBED_FILES
+
+bool MappedFile::Open(const char *path) {
+  Close();
+  FILE* fp = fopen(path, "rb");
+  if (!fp)
+    return false;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size <= 0 || size > 0x7fffffff) {
+    fclose(fp);
+    return false;
+  }
+  uint8_t *data = new uint8_t[size];
+  if (fread(data, 1, size, fp) != static_cast<size_t>(size)) {
+    LOG(ERROR) << "Error reading " << path;
+    delete[] data;
+    fclose(fp);
+    return false;
+  }
+  fclose(fp);
+  data_ = data;
+  size_ = size;
+  return true;
+}
+
+void MappedFile::Close() {
+  delete[] data_;
+  data_ = NULL;
+  size_ = 0;
+}
+
+#endif  // EMBED_FILES
+
+}  // namespace tts_service
@@ -0,0 +1,39 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Read-only access to the whole contents of a file.  The file is
+// memory-mapped, so nothing is copied and pages are only read when
+// they're used.  File mapping isn't available when the lingware is
+// embedded (the Native Client build), so there the file is read into
+// memory instead.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_MAPPED_FILE_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_MAPPED_FILE_H_
+
+#include <stdint.h>
+
+namespace tts_service {
+
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Returns false if the file can't be read.
+  bool Open(const char *path);
+  void Close();
+
+  // The contents, which stay valid until Close.
+  const uint8_t *data() { return data_; }
+  int size() { return size_; }
+
+ private:
+  const uint8_t *data_;
+  int size_;
+  // False if data_ was read into memory rather than mapped.
+  bool mapped_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_MAPPED_FILE_H_
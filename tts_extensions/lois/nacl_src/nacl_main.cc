@@ -18,6 +18,7 @@ enum {
   METHOD_STOP,
   METHOD_STATUS,
   METHOD_STOP_SERVICE,
+  METHOD_SET_SPEED,
   NUM_METHOD_IDENTIFIERS
 };
 
@@ -28,6 +29,7 @@ static const char* const method_names[NUM_METHOD_IDENTIFIERS] = {
   "stop",
   "status",
   "stopService",
+  "setSpeed",
 };
 static const char kMethodArgumentSeperator = ':';
 
@@ -74,6 +76,8 @@ void NaClTtsInstance::HandleMessage(const pp::Var& var_message) {
     plugin_.Status();
   } else if (method_name == method_names[METHOD_STOP_SERVICE]) {
     plugin_.StopService();
+  } else if (method_name == method_names[METHOD_SET_SPEED]) {
+    plugin_.SetSpeed(args);
   }
 }
 
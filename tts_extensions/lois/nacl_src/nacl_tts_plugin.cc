@@ -19,17 +19,40 @@ static const char* RESPONSE_IDLE = "idle";
 static const char* RESPONSE_BUSY = "busy";
 static const char* RESPONSE_ERROR = "error";
 static const char* RESPONSE_END = "end";
+static const char* RESPONSE_WORD = "word";
+static const char* RESPONSE_SENTENCE = "sentence";
 
 using std::string;
 
 namespace tts_service {
 
-// The number of chunks of audio to buffer. The chunk size is hinted by
-// us but ultimately determined by PPAPI based on how often it can reliably
-// call our audio callback. The number of chunks is the amount of data we
-// should have buffered ahead of time so that whenever a chunk is requested,
-// we can fill it immediately without underflow.
-const int kNumChunks = 4;
+// The most chunks of audio to buffer. The chunk size is hinted by us but
+// ultimately determined by PPAPI based on how often it can reliably call
+// our audio callback. The service buffers as few chunks as it can without
+// underflow, going by how fast the engine synthesizes on this machine and
+// whether the callback has found the buffer empty; this is how far it can
+// go on a slow machine.
+const int kMaxChunks = 8;
+
+// Sentences longer than this many bytes are split into clauses before
+// they're synthesized, so that long text starts speaking sooner.
+const int kMaxClauseSize = 200;
+
+// Memory for the voices kept loaded, so that pages that switch between a
+// few voices don't reload the lingware on every utterance.  A Pico voice
+// needs about 1.25 MB when its lingware is embedded, and 2.5 MB otherwise.
+const int kVoicePoolBudget = 8 * 1024 * 1024;
+
+// Memory for the analysis of recently spoken text, so that text spoken
+// again, typically at a different rate, skips straight to generating
+// speech.  The analysis of a sentence takes a few hundred bytes.
+const int kAnalysisCacheSize = 256 * 1024;
+
+// Memory for the audio of short phrases that have been spoken, like the
+// names of roles and states, so that they can be spoken again without
+// synthesizing them.  A second of speech takes 32 KB.
+const int kPhraseCacheSize = 2 * 1024 * 1024;
+const int kMaxPhraseSize = 64;
 
 //
 // UtteranceCallback
@@ -37,20 +60,54 @@ const int kNumChunks = 4;
 
 // This class implements the Runnable interface so that it can notify
 // the plug-in when an utterance completes, passing it the utterance id.
-class UtteranceCallback : public Runnable
+// It's also the MarkerListener for word and sentence progress markers,
+// which always play before the utterance completes.
+class UtteranceCallback : public Runnable, public MarkerListener
 {
  public:
-  UtteranceCallback(NaClTtsPlugin* target, int utterance_id)
-      : target_(target), utterance_id_(utterance_id) {}
+  UtteranceCallback(NaClTtsPlugin* target, int utterance_id,
+                    const string& text)
+      : target_(target),
+        utterance_id_(utterance_id),
+        text_(text),
+        byte_offset_(0),
+        char_index_(0) {}
 
   virtual void Run() {
     target_->OnUtteranceCompleted(utterance_id_);
     delete this;
   }
 
+  virtual void OnMarker(int type, int value) {
+    target_->OnUtteranceProgress(utterance_id_, type, CharIndex(value));
+  }
+
  private:
+  // Converts a byte offset in the UTF-8 text to an index in the UTF-16
+  // string that JavaScript sees.  Markers arrive in increasing order, so
+  // continue counting from the last offset.
+  int CharIndex(int byte_offset) {
+    if (byte_offset > static_cast<int>(text_.size()))
+      byte_offset = text_.size();
+    if (byte_offset < byte_offset_) {
+      byte_offset_ = 0;
+      char_index_ = 0;
+    }
+    for (; byte_offset_ < byte_offset; byte_offset_++) {
+      unsigned char c = text_[byte_offset_];
+      if ((c & 0xC0) != 0x80) {
+        // Lead byte: characters outside the BMP take two UTF-16 units.
+        char_index_ += (c >= 0xF0 ? 2 : 1);
+      }
+    }
+    return char_index_;
+  }
+
   NaClTtsPlugin* target_;
   int utterance_id_;
+  string text_;
+  int byte_offset_;
+  int char_index_;
 };
 
 //
@@ -97,7 +154,7 @@ int NaClAudioOutput::GetChunkSizeInFrames() {
 }
 
 int NaClAudioOutput::GetTotalBufferSizeInFrames() {
-  return GetChunkSizeInFrames() * kNumChunks;
+  return GetChunkSizeInFrames() * kMaxChunks;
 }
 
 // static
@@ -133,7 +190,10 @@ NaClTtsPlugin::NaClTtsPlugin(NaClTtsInstance* instance)
       initialized_(false) {
   audio_output_ = new NaClAudioOutput(instance_);
   threading_ = new Threading();
-  engine_ = new PicoTtsEngine("");
+  PicoTtsEngine* pico_engine = new PicoTtsEngine("");
+  pico_engine->SetVoicePoolBudget(kVoicePoolBudget);
+  pico_engine->SetAnalysisCacheSize(kAnalysisCacheSize);
+  engine_ = pico_engine;
   service_ = new TtsService(engine_, audio_output_, threading_);
 }
 
@@ -155,7 +215,9 @@ void NaClTtsPlugin::StartService() {
     instance_->PostMessage(pp::Var(RESPONSE_ERROR));
     return;
   }
+  service_->SetPhraseCache(kPhraseCacheSize, kMaxPhraseSize);
   if (service_->StartService()) {
+    service_->SetTextChunking(true, kMaxClauseSize);
     instance_->PostMessage(pp::Var(RESPONSE_IDLE));
   } else {
     instance_->PostMessage(pp::Var(RESPONSE_ERROR));
@@ -174,8 +236,9 @@ void NaClTtsPlugin::Speak(const std::vector<std::string>& args) {
 
   UtteranceOptions utterance_options;
 
-  UtteranceCallback* callback = new UtteranceCallback(this, id);
+  UtteranceCallback* callback = new UtteranceCallback(this, id, text);
   utterance_options.completion = callback;
+  utterance_options.progress = callback;
   utterance_options.voice_options = NULL;
 
   // Normalized rate, pitch, and volume - maps to 100 in the PICO
@@ -211,11 +274,45 @@ void NaClTtsPlugin::StopService() {
   service_->StopService();
 }
 
+void NaClTtsPlugin::SetSpeed(const std::vector<std::string>& args) {
+  if (args.size() != 1)
+    return;
+
+  // A client's failed parse can send NaN or infinity, which aren't
+  // speeds; the difference of either with itself isn't 0.
+  double speed = atof(args[0].c_str());
+  if (speed - speed != 0) {
+    LOG(ERROR) << "Invalid speed: " << args[0];
+    return;
+  }
+
+  // Takes effect right away, even in the middle of an utterance.
+  service_->SetSpeed(speed);
+}
+
 void NaClTtsPlugin::OnUtteranceCompleted(int utterance_id) {
   char msg[100];
   snprintf(msg, 100, "%s:%d", RESPONSE_END, utterance_id);
   instance_->PostMessage(pp::Var(msg));
 }
 
+void NaClTtsPlugin::OnUtteranceProgress(int utterance_id, int marker_type,
+                                        int char_index) {
+  const char* response;
+  switch (marker_type) {
+    case TTS_MARKER_WORD:
+      response = RESPONSE_WORD;
+      break;
+    case TTS_MARKER_SENTENCE:
+      response = RESPONSE_SENTENCE;
+      break;
+    default:
+      return;
+  }
+  char msg[100];
+  snprintf(msg, 100, "%s:%d:%d", response, utterance_id, char_index);
+  instance_->PostMessage(pp::Var(msg));
+}
+
 }  // namespace tts_service
 
@@ -66,8 +66,10 @@ class NaClTtsPlugin {
   void Stop();
   void Status();
   void StopService();
+  void SetSpeed(const std::vector<std::string>& args);
 
   void OnUtteranceCompleted(int utterance_id);
+  void OnUtteranceProgress(int utterance_id, int marker_type, int char_index);
 
  private:
   NaClTtsInstance* instance_;
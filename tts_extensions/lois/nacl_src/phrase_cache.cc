@@ -0,0 +1,199 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "disk_phrase_cache.h"
+#include "phrase_cache.h"
+
+namespace tts_service {
+
+namespace {
+
+// The bookkeeping for each entry, besides its key and its audio.
+const int kEntryOverhead = 64;
+
+}  // namespace
+
+PhraseCache::PhraseCache(Threading *threading, int max_size_in_bytes)
+    : mutex_(threading->CreateMutex()),
+      max_size_in_bytes_(max_size_in_bytes),
+      disk_cache_(NULL),
+      size_in_bytes_(0),
+      hit_count_(0),
+      disk_hit_count_(0),
+      miss_count_(0) {
+}
+
+PhraseCache::~PhraseCache() {
+  delete disk_cache_;
+  delete mutex_;
+}
+
+bool PhraseCache::OpenDiskCache(const char *path, int max_size_in_bytes) {
+  DiskPhraseCache *disk_cache = new DiskPhraseCache;
+  if (!disk_cache->Open(path, max_size_in_bytes)) {
+    delete disk_cache;
+    return false;
+  }
+  ScopedLock sl(mutex_);
+  delete disk_cache_;
+  disk_cache_ = disk_cache;
+  return true;
+}
+
+string PhraseCache::MakeKey(const string& text,
+                            int voice_index,
+                            float rate,
+                            float pitch,
+                            float volume) {
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "%d %g %g %g:",
+           voice_index, rate, pitch, volume);
+  string normalized;
+  vector<int> source_offsets;
+  NormalizeText(text, &normalized, &source_offsets);
+  return prefix + normalized;
+}
+
+void PhraseCache::NormalizeText(const string& text,
+                                string *normalized,
+                                vector<int> *source_offsets) {
+  normalized->clear();
+  source_offsets->clear();
+  int space_start = -1;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (isspace(static_cast<unsigned char>(text[i]))) {
+      if (space_start < 0)
+        space_start = i;
+      continue;
+    }
+    if (space_start >= 0 && !normalized->empty()) {
+      *normalized += ' ';
+      source_offsets->push_back(space_start);
+    }
+    space_start = -1;
+    *normalized += text[i];
+    source_offsets->push_back(i);
+  }
+  source_offsets->push_back(text.size());
+}
+
+void PhraseCache::MapMarkersToKey(const string& text, PhraseAudio *audio) {
+  string normalized;
+  vector<int> source_offsets;
+  NormalizeText(text, &normalized, &source_offsets);
+  for (size_t i = 0; i < audio->markers.size(); i++) {
+    // The first character at or after the offset.
+    int *text_offset = &audio->markers[i].text_offset;
+    *text_offset = std::lower_bound(source_offsets.begin(),
+                                    source_offsets.end() - 1,
+                                    *text_offset) -
+        source_offsets.begin();
+  }
+}
+
+void PhraseCache::MapMarkersFromKey(const string& text, PhraseAudio *audio) {
+  string normalized;
+  vector<int> source_offsets;
+  NormalizeText(text, &normalized, &source_offsets);
+  int last = source_offsets.size() - 1;
+  for (size_t i = 0; i < audio->markers.size(); i++) {
+    int *text_offset = &audio->markers[i].text_offset;
+    if (*text_offset < 0)
+      *text_offset = 0;
+    if (*text_offset > last)
+      *text_offset = last;
+    *text_offset = source_offsets[*text_offset];
+  }
+}
+
+bool PhraseCache::Lookup(const string& key, PhraseAudio *audio) {
+  ScopedLock sl(mutex_);
+  map<string, list<Entry>::iterator>::iterator found = index_.find(key);
+  if (found == index_.end()) {
+    if (disk_cache_ && disk_cache_->Lookup(key, audio)) {
+      disk_hit_count_++;
+      InsertInMemory(key, *audio);
+      return true;
+    }
+    miss_count_++;
+    return false;
+  }
+  hit_count_++;
+  entries_.splice(entries_.begin(), entries_, found->second);
+  *audio = found->second->audio;
+  return true;
+}
+
+bool PhraseCache::Contains(const string& key) {
+  ScopedLock sl(mutex_);
+  if (index_.find(key) != index_.end())
+    return true;
+  PhraseAudio audio;
+  if (disk_cache_ && disk_cache_->Lookup(key, &audio)) {
+    InsertInMemory(key, audio);
+    return true;
+  }
+  return false;
+}
+
+void PhraseCache::Insert(const string& key, const PhraseAudio& audio) {
+  ScopedLock sl(mutex_);
+  InsertInMemory(key, audio);
+  if (disk_cache_)
+    disk_cache_->Insert(key, audio);
+}
+
+void PhraseCache::InsertInMemory(const string& key, const PhraseAudio& audio) {
+  int size_in_bytes = key.size() + kEntryOverhead +
+      audio.samples.size() * sizeof(int16_t) +
+      audio.markers.size() * sizeof(PhraseMarker);
+  if (size_in_bytes > max_size_in_bytes_)
+    return;
+
+  map<string, list<Entry>::iterator>::iterator found = index_.find(key);
+  if (found != index_.end())
+    Remove(found->second);
+  while (size_in_bytes_ + size_in_bytes > max_size_in_bytes_)
+    Remove(--entries_.end());
+
+  entries_.push_front(Entry());
+  Entry& entry = entries_.front();
+  entry.key = key;
+  entry.audio = audio;
+  entry.size_in_bytes = size_in_bytes;
+  index_[key] = entries_.begin();
+  size_in_bytes_ += size_in_bytes;
+}
+
+void PhraseCache::Clear() {
+  ScopedLock sl(mutex_);
+  entries_.clear();
+  index_.clear();
+  size_in_bytes_ = 0;
+}
+
+PhraseCacheStats PhraseCache::GetStats() {
+  ScopedLock sl(mutex_);
+  PhraseCacheStats stats;
+  stats.hit_count = hit_count_;
+  stats.disk_hit_count = disk_hit_count_;
+  stats.miss_count = miss_count_;
+  stats.entry_count = entries_.size();
+  stats.size_in_bytes = size_in_bytes_;
+  stats.disk_entry_count = disk_cache_ ? disk_cache_->entry_count() : 0;
+  stats.disk_size_in_bytes = disk_cache_ ? disk_cache_->size_in_bytes() : 0;
+  return stats;
+}
+
+void PhraseCache::Remove(list<Entry>::iterator iter) {
+  size_in_bytes_ -= iter->size_in_bytes;
+  index_.erase(iter->key);
+  entries_.erase(iter);
+}
+
+}  // namespace tts_service
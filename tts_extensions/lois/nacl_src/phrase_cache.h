@@ -0,0 +1,149 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// A cache of the audio synthesized for short phrases.  A screen reader
+// speaks the same few strings, like "link" or "heading level 2", over and
+// over; with the audio cached, they can be played without running the
+// engine at all.
+//
+// Audio is kept in the engine's format, which is much smaller than the
+// audio output's, and the least recently used phrases are discarded when
+// the total size goes over the limit.  Optionally, phrases are also kept
+// in a DiskPhraseCache, and loaded back into memory from there when
+// they're needed again.  All methods are thread-safe.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_PHRASE_CACHE_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_PHRASE_CACHE_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "threading.h"
+#include "tts_receiver.h"
+
+using std::list;
+using std::map;
+using std::string;
+using std::vector;
+
+namespace tts_service {
+
+class DiskPhraseCache;
+
+// A word or sentence marker, which comes before the audio starting at
+// |frame|.
+struct PhraseMarker {
+  int frame;
+  tts_marker_type type;
+  int text_offset;
+};
+
+struct PhraseAudio {
+  PhraseAudio() : sample_rate(0), channel_count(0) { }
+
+  int sample_rate;
+  int channel_count;
+  // Interleaved frames.
+  vector<int16_t> samples;
+  vector<PhraseMarker> markers;
+};
+
+struct PhraseCacheStats {
+  // Lookups found in memory, found on disk, and not found at all.
+  int hit_count;
+  int disk_hit_count;
+  int miss_count;
+  int entry_count;
+  int size_in_bytes;
+  int disk_entry_count;
+  int disk_size_in_bytes;
+};
+
+class PhraseCache {
+ public:
+  PhraseCache(Threading *threading, int max_size_in_bytes);
+  ~PhraseCache();
+
+  // Keeps phrases in the cache file at |path| too, which is created if
+  // needed and grows up to |max_size_in_bytes|.  Returns false if the file
+  // can't be used.
+  bool OpenDiskCache(const char *path, int max_size_in_bytes);
+
+  // Returns the key for |text| spoken with the given voice and prosody.
+  // Leading and trailing whitespace is ignored, and other runs of
+  // whitespace count as a single space; case is kept, since it can change
+  // the pronunciation.
+  static string MakeKey(const string& text,
+                        int voice_index,
+                        float rate,
+                        float pitch,
+                        float volume);
+
+  // Cached markers have text offsets into the text as it's normalized in
+  // the key, so that a phrase spaced differently from when it was cached
+  // still gets the offsets of its own text.  These convert the offsets of
+  // the markers in |audio| from offsets into |text| to offsets into its
+  // key text, before Insert, and back, after Lookup.
+  static void MapMarkersToKey(const string& text, PhraseAudio *audio);
+  static void MapMarkersFromKey(const string& text, PhraseAudio *audio);
+
+  // If |key| is cached, copies its audio to |audio|, marks it as the most
+  // recently used and returns true.  Counts as a hit or a miss.
+  bool Lookup(const string& key, PhraseAudio *audio);
+
+  // Returns true if |key| is cached, without counting a hit or a miss.
+  // If it's only on disk, it's loaded into memory.
+  bool Contains(const string& key);
+
+  // Adds or replaces the audio for |key|, discarding the least recently
+  // used phrases to make room, and adds it to the disk cache.  Audio
+  // bigger than the whole cache isn't kept in memory.
+  void Insert(const string& key, const PhraseAudio& audio);
+
+  // Discards all the audio in memory; the counters and the disk cache are
+  // kept.
+  void Clear();
+
+  PhraseCacheStats GetStats();
+
+  // The most samples a phrase can have and still fit.
+  int max_samples() { return max_size_in_bytes_ / sizeof(int16_t); }
+
+ private:
+  struct Entry {
+    string key;
+    PhraseAudio audio;
+    int size_in_bytes;
+  };
+
+  // Sets |normalized| to |text| as it's normalized in keys, and
+  // |source_offsets| to the offset in |text| of each of its characters,
+  // followed by the size of |text|.
+  static void NormalizeText(const string& text,
+                            string *normalized,
+                            vector<int> *source_offsets);
+
+  // These must be called with the mutex held.
+  void InsertInMemory(const string& key, const PhraseAudio& audio);
+  void Remove(list<Entry>::iterator iter);
+
+  Mutex *mutex_;
+  int max_size_in_bytes_;
+  DiskPhraseCache *disk_cache_;
+
+  // Most recently used first.
+  list<Entry> entries_;
+  map<string, list<Entry>::iterator> index_;
+  int size_in_bytes_;
+  int hit_count_;
+  int disk_hit_count_;
+  int miss_count_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_PHRASE_CACHE_H_
@@ -46,6 +46,14 @@ extern "C" {
 #define CHECK_MAGIC_NUMBER(sys) \
     ((sys)->magic == (((picoos_uint32) (sys)) ^ MAGIC_MASK))
 
+/* limits of the prosody levels, the same as for the markup */
+#define PICO_SPEED_LEVEL_MIN      20
+#define PICO_SPEED_LEVEL_MAX     500
+#define PICO_PITCH_LEVEL_MIN      50
+#define PICO_PITCH_LEVEL_MAX     200
+#define PICO_VOLUME_LEVEL_MIN      0
+#define PICO_VOLUME_LEVEL_MAX    500
+
 
 
 /* *** Auxiliary routines (may also be called from picoextapi.c) **************/
@@ -334,6 +342,42 @@ PICO_FUNC pico_loadResource(
     return status;
 }
 
+/**
+ * pico_loadResourceFromMemory : Loads a resource file image into the Pico system, without copying it
+ * @param    system : pointer to a pico_System struct
+ * @param    *resourceData : start of the resource file image
+ * @param    resourceSize : size in bytes of the resource file image
+ * @param    *outLingware : pointer to receive the loaded lingware resource memory area address
+ * @return  PICO_OK : successful
+ * @return     PICO_ERR_INVALID_HANDLE, PICO_ERR_NULLPTR_ACCESS : errors
+ * @callgraph
+ * @callergraph
+*/
+PICO_FUNC pico_loadResourceFromMemory(
+        pico_System system,
+        const void *resourceData,
+        const pico_Uint32 resourceSize,
+        pico_Resource *outLingware
+        )
+{
+    pico_Status status = PICO_OK;
+
+    if (!is_valid_system_handle(system)) {
+        status = PICO_ERR_INVALID_HANDLE;
+    } else if ((resourceData == NULL) || (outLingware == NULL)) {
+        status = PICO_ERR_NULLPTR_ACCESS;
+    } else {
+        picoos_emReset(system->common->em);
+        status = picorsrc_loadResourceFromMemory(system->rm,
+                (const picoos_uint8 *) resourceData, resourceSize,
+                (picorsrc_Resource *) outLingware);
+        PICODBG_DEBUG(("memory used to load resource from memory"));
+        picoos_showMemUsage(system->common->mm, TRUE, FALSE);
+    }
+
+    return status;
+}
+
 /**
  * pico_unloadResource : unLoads a resource file from the Pico system
  * @param    system : pointer to a pico_System struct
@@ -615,6 +659,121 @@ PICO_FUNC pico_putTextUtf8(
     return status;
 }
 
+/**
+ * pico_setProsody : Sets the speed, pitch and volume levels
+ * @param    engine : pointer to a Pico engine handle
+ * @param    speed, pitch, volume : levels in percent
+ * @return  PICO_OK : successful
+ * @return     PICO_ERR_INVALID_HANDLE, PICO_ERR_INVALID_ARGUMENT : errors
+ * @callgraph
+ * @callergraph
+*/
+PICO_FUNC pico_setProsody(
+        pico_Engine engine,
+        const pico_Int16 speed,
+        const pico_Int16 pitch,
+        const pico_Int16 volume)
+{
+    pico_Status status = PICO_OK;
+
+    if (!picoctrl_isValidEngineHandle((picoctrl_Engine) engine)) {
+        status = PICO_ERR_INVALID_HANDLE;
+    } else if ((speed < PICO_SPEED_LEVEL_MIN) || (speed > PICO_SPEED_LEVEL_MAX)
+            || (pitch < PICO_PITCH_LEVEL_MIN) || (pitch > PICO_PITCH_LEVEL_MAX)
+            || (volume < PICO_VOLUME_LEVEL_MIN) || (volume > PICO_VOLUME_LEVEL_MAX)) {
+        status = PICO_ERR_INVALID_ARGUMENT;
+    } else {
+        picoctrl_engResetExceptionManager((picoctrl_Engine) engine);
+        status = picoctrl_engSetProsody((picoctrl_Engine) engine, speed, pitch, volume);
+    }
+
+    return status;
+}
+
+/**
+ * pico_startItemRecording : Starts recording the items passed from the text analysis to the speech generation
+ * @param    engine : pointer to a Pico engine handle
+ * @param    *buffer : pointer to the buffer for the items
+ * @param    bufferSize : buffer size
+ * @return  PICO_OK : successful
+ * @return     PICO_ERR_INVALID_HANDLE, PICO_ERR_NULLPTR_ACCESS : errors
+ * @callgraph
+ * @callergraph
+*/
+PICO_FUNC pico_startItemRecording(
+        pico_Engine engine,
+        void *buffer,
+        const pico_Uint32 bufferSize)
+{
+    pico_Status status = PICO_OK;
+
+    if (!picoctrl_isValidEngineHandle((picoctrl_Engine) engine)) {
+        status = PICO_ERR_INVALID_HANDLE;
+    } else if (buffer == NULL) {
+        status = PICO_ERR_NULLPTR_ACCESS;
+    } else {
+        status = picoctrl_engStartItemRecording((picoctrl_Engine) engine, (picoos_uint8 *)buffer, bufferSize);
+    }
+
+    return status;
+}
+
+/**
+ * pico_stopItemRecording : Stops recording items
+ * @param    engine : pointer to a Pico engine handle
+ * @param    *bytesRecorded : pointer to a variable to receive the number of bytes recorded
+ * @return  PICO_OK : successful
+ * @return     PICO_EXC_BUF_OVERFLOW : the items didn't fit
+ * @return     PICO_ERR_INVALID_HANDLE, PICO_ERR_NULLPTR_ACCESS, PICO_ERR_OTHER : errors
+ * @callgraph
+ * @callergraph
+*/
+PICO_FUNC pico_stopItemRecording(
+        pico_Engine engine,
+        pico_Uint32 *bytesRecorded)
+{
+    pico_Status status = PICO_OK;
+
+    if (!picoctrl_isValidEngineHandle((picoctrl_Engine) engine)) {
+        status = PICO_ERR_INVALID_HANDLE;
+    } else if (bytesRecorded == NULL) {
+        status = PICO_ERR_NULLPTR_ACCESS;
+    } else {
+        status = picoctrl_engStopItemRecording((picoctrl_Engine) engine, bytesRecorded);
+    }
+
+    return status;
+}
+
+/**
+ * pico_putItems : Puts recorded items in place of text
+ * @param    engine : pointer to a Pico engine handle
+ * @param    *items : pointer to the items
+ * @param    size : size of the items in bytes
+ * @return  PICO_OK : successful
+ * @return     PICO_ERR_INVALID_HANDLE, PICO_ERR_NULLPTR_ACCESS : errors
+ * @callgraph
+ * @callergraph
+*/
+PICO_FUNC pico_putItems(
+        pico_Engine engine,
+        const void *items,
+        const pico_Uint32 size)
+{
+    pico_Status status = PICO_OK;
+
+    if (!picoctrl_isValidEngineHandle((picoctrl_Engine) engine)) {
+        status = PICO_ERR_INVALID_HANDLE;
+    } else if (items == NULL) {
+        status = PICO_ERR_NULLPTR_ACCESS;
+    } else {
+        picoctrl_engResetExceptionManager((picoctrl_Engine) engine);
+        status = picoctrl_engPutItems((picoctrl_Engine) engine, (const picoos_uint8 *)items, size);
+    }
+
+    return status;
+}
+
 /**
  * pico_getData : Gets speech data from the engine.
  * @param    engine : pointer to a Pico engine handle
@@ -637,6 +796,7 @@ PICO_FUNC pico_getData(
 {
     pico_Status status = PICO_OK;
 
+    *outDataType = PICO_DATA_PCM_16BIT;
     if (!picoctrl_isValidEngineHandle((picoctrl_Engine) engine)) {
         status = PICO_STEP_ERROR;
     } else if (buffer == NULL) {
@@ -647,13 +807,52 @@ PICO_FUNC pico_getData(
         status = PICO_STEP_ERROR;
     } else {
         picoctrl_engResetExceptionManager((picoctrl_Engine) engine);
-        status = picoctrl_engFetchOutputItemBytes((picoctrl_Engine) engine, (picoos_char *)buffer, bufferSize, bytesReceived);
+        status = picoctrl_engFetchOutputItemBytes((picoctrl_Engine) engine, (picoos_char *)buffer, bufferSize, bytesReceived, outDataType);
         if ((status != PICO_STEP_IDLE) && (status != PICO_STEP_BUSY)) {
             status = PICO_STEP_ERROR;
         }
     }
 
+    return status;
+}
+
+/**
+ * pico_getDataBulk : Gets as much speech data from the engine as fits
+ * @param    engine : pointer to a Pico engine handle
+ * @param    *buffer : pointer to output buffer
+ * @param    bufferSize : out buffer size
+ * @param    *bytesReceived : pointer to a variable to receive the number of bytes received
+ * @param    *outDataType : pointer to a variable to receive the type of buffer received
+ * @return  PICO_STEP_BUSY, PICO_STEP_IDLE : successful
+ * @return     PICO_STEP_ERROR : errors
+ * @callgraph
+ * @callergraph
+*/
+PICO_FUNC pico_getDataBulk(
+        pico_Engine engine,
+        void *buffer,
+        const pico_Uint32 bufferSize,
+        pico_Uint32 *bytesReceived,
+        pico_Int16 *outDataType
+        )
+{
+    pico_Status status = PICO_OK;
+
     *outDataType = PICO_DATA_PCM_16BIT;
+    if (!picoctrl_isValidEngineHandle((picoctrl_Engine) engine)) {
+        status = PICO_STEP_ERROR;
+    } else if (buffer == NULL) {
+        status = PICO_STEP_ERROR;
+    } else if (bytesReceived == NULL) {
+        status = PICO_STEP_ERROR;
+    } else {
+        picoctrl_engResetExceptionManager((picoctrl_Engine) engine);
+        status = picoctrl_engFetchOutputBytes((picoctrl_Engine) engine, (picoos_char *)buffer, bufferSize, bytesReceived, outDataType);
+        if ((status != PICO_STEP_IDLE) && (status != PICO_STEP_BUSY)) {
+            status = PICO_STEP_ERROR;
+        }
+    }
+
     return status;
 }
 
@@ -282,6 +282,22 @@ PICO_FUNC pico_loadResource(
         pico_Resource *outResource
         );
 
+/**
+   Loads a resource from an image of a resource file in memory, such as
+   a memory-mapped file or data linked into the application. Unlike
+   pico_loadResource, the knowledge bases are used in place rather than
+   copied into the memory area of the system, so the image must remain
+   valid and unchanged until the resource is unloaded. Because resources
+   are read-only, several systems may load the same image at once and
+   share a single copy of its data.
+*/
+PICO_FUNC pico_loadResourceFromMemory(
+        pico_System system,
+        const void *resourceData,
+        const pico_Uint32 resourceSize,
+        pico_Resource *outResource
+        );
+
 /**
    Unloads a resource file from the Pico system. If no engine uses the
    resource file, the resource is removed immediately and its
@@ -392,6 +408,62 @@ PICO_FUNC pico_putTextUtf8(
         pico_Int16 *outBytesPut
         );
 
+/**
+   Sets the speed, pitch and volume of the speech synthesized from text
+   put from then on, in percent of the voice's default, like the
+   'level' of the corresponding text-input commands but without having
+   to wrap the text in them. 'speed' must be within 20..500, 'pitch'
+   within 50..200 and 'volume' within 0..500. Text-input commands in
+   the text still apply on top, and the end of one restores the
+   default level of 100. Call this between texts, when the engine is
+   idle.
+*/
+PICO_FUNC pico_setProsody(
+        pico_Engine engine,
+        const pico_Int16 speed,
+        const pico_Int16 pitch,
+        const pico_Int16 volume
+        );
+
+/**
+   Starts recording the items that the text analysis passes on to the
+   speech generation, that is, the phonemes with their accents and
+   the boundaries, for text put from then on. They are copied to
+   'outBuffer' as they're produced, and don't depend on the speed,
+   pitch or volume set with 'pico_setProsody', so they can be passed
+   to 'pico_putItems' later to synthesize the same text again without
+   analyzing it. The buffer must stay valid until recording stops.
+*/
+PICO_FUNC pico_startItemRecording(
+        pico_Engine engine,
+        void *outBuffer,
+        const pico_Uint32 bufferSize
+        );
+
+/**
+   Stops recording items and returns the number of bytes recorded in
+   'outBytesRecorded'. Returns PICO_EXC_BUF_OVERFLOW if they didn't
+   fit in the buffer, and PICO_ERR_OTHER if recording was stopped
+   early by 'pico_resetEngine'.
+*/
+PICO_FUNC pico_stopItemRecording(
+        pico_Engine engine,
+        pico_Uint32 *outBytesRecorded
+        );
+
+/**
+   Puts items recorded with 'pico_startItemRecording', with the same
+   voice, in place of text: repeatedly calling 'pico_getData' then
+   synthesizes them with the current speed, pitch and volume, without
+   analyzing any text. 'items' must stay valid until 'pico_getData'
+   returns PICO_STEP_IDLE or the engine is reset.
+*/
+PICO_FUNC pico_putItems(
+        pico_Engine engine,
+        const void *items,
+        const pico_Uint32 size
+        );
+
 /**
    Gets speech data from the engine. Every time this function is
    called, the engine performs, within a short time slot, a small
@@ -417,6 +489,24 @@ PICO_FUNC pico_getData(
         pico_Int16 *outDataType
         );
 
+/**
+   Like 'pico_getData', but instead of processing for one short time
+   slot and returning at most 255 bytes, keeps processing until
+   'outBuffer' is nearly full, so that it can be filled with a whole
+   chunk of audio in one call.  It returns early, with whatever speech
+   data it has, when the engine becomes idle or has been analyzing text
+   for a while without producing speech, and before a marker or sentence
+   start, which is returned by itself in the next call.  'bufferSize'
+   must be at least 260 bytes.
+*/
+PICO_FUNC pico_getDataBulk(
+        pico_Engine engine,
+        void *outBuffer,
+        const pico_Uint32 bufferSize,
+        pico_Uint32 *outBytesReceived,
+        pico_Int16 *outDataType
+        );
+
 /**
    Resets the engine and clears all engine-internal buffers, in
    particular text input and signal data output buffers.
@@ -27,6 +27,7 @@
  */
 
 #include "picodefs.h"
+#include "picoapi.h"
 #include "picoos.h"
 #include "picodbg.h"
 #include "picodata.h"
@@ -80,6 +81,14 @@ typedef struct ctrl_subobj {
     picodata_ProcessingUnit procUnit [PICOCTRL_MAX_PROC_UNITS];
     picodata_step_result_t procStatus [PICOCTRL_MAX_PROC_UNITS];
     picodata_CharBuffer procCbOut [PICOCTRL_MAX_PROC_UNITS];
+    /* the output of the front end is the input of PAM, which is where items
+       are recorded, and where recorded items are fed back in place of text */
+    picoos_uint8 pamPU;
+    picoos_bool recording;
+    picoos_uint32 recordingSize;
+    const picoos_uint8 * replayItems;
+    picoos_uint32 replaySize;
+    picoos_uint32 replayPos;
 } ctrl_subobj_t;
 
 /**
@@ -101,6 +110,12 @@ static pico_status_t ctrlInitialize(register picodata_ProcessingUnit this, picoo
     ctrl = (ctrl_subobj_t *) this->subObj;
     ctrl->curPU = 0;
     ctrl->lastItemTypeProduced=0;    /*no item produced by default*/
+    ctrl->replayItems = NULL;
+    ctrl->replaySize = ctrl->replayPos = 0;
+    if (ctrl->recording) {
+        picodata_cbSetRecording(ctrl->procCbOut[ctrl->pamPU - 1], NULL, 0);
+        ctrl->recording = FALSE;
+    }
     status = PICO_OK;
     for (i = 0; i < ctrl->numProcUnits; i++) {
         if (PICO_OK == status) {
@@ -119,6 +134,42 @@ static pico_status_t ctrlInitialize(register picodata_ProcessingUnit this, picoo
 }/*ctrlInitialize*/
 
 
+/**
+ * feeds as many of the items being replayed to PAM as its input buffer takes
+ * @param    ctrl : the control sub-object
+ * @return    TRUE if any items were fed
+ * @callgraph
+ * @callergraph
+ */
+static picoos_bool ctrlFeedItems(register ctrl_subobj_t * ctrl) {
+    picodata_CharBuffer cb = ctrl->procCbOut[ctrl->pamPU - 1];
+    picoos_uint32 remaining;
+    picoos_uint16 blen;
+    pico_status_t status;
+    picoos_bool fed = FALSE;
+
+    while (ctrl->replayPos < ctrl->replaySize) {
+        remaining = ctrl->replaySize - ctrl->replayPos;
+        if (remaining > PICODATA_MAX_ITEMSIZE) {
+            remaining = PICODATA_MAX_ITEMSIZE;
+        }
+        status = picodata_cbPutItem(cb, ctrl->replayItems + ctrl->replayPos,
+                (picoos_uint16) remaining, &blen);
+        if (PICO_EXC_BUF_OVERFLOW == status) {
+            /* PAM's input is full; feed the rest later */
+            break;
+        } else if (PICO_OK != status) {
+            /* not a valid item: drop the rest */
+            PICODBG_WARN(("invalid item in replayed items at %i", ctrl->replayPos));
+            ctrl->replayPos = ctrl->replaySize;
+            break;
+        }
+        ctrl->replayPos += blen;
+        fed = TRUE;
+    }
+    return fed;
+}/*ctrlFeedItems*/
+
 /**
  * performs one processing step
  * @param    this : pointer to Control PU
@@ -147,6 +198,14 @@ static picodata_step_result_t ctrlStep(register picodata_ProcessingUnit this,
     *bytesOutput = 0;
     ctrl->lastItemTypeProduced=0; /*no item produced by default*/
 
+    /* replayed items skip the front end, which stays idle */
+    if ((ctrl->replayPos < ctrl->replaySize) && ctrlFeedItems(ctrl)) {
+        ctrl->procStatus[ctrl->pamPU] = PICODATA_PU_BUSY;
+        if (ctrl->curPU < ctrl->pamPU) {
+            ctrl->curPU = ctrl->pamPU;
+        }
+    }
+
     /* --------------------- */
     /* do step of current pu */
     /* --------------------- */
@@ -205,6 +264,10 @@ static picodata_step_result_t ctrlStep(register picodata_ProcessingUnit this,
             }
             PICODBG_DEBUG(("going to pu %d with status %d",
                            ctrl->curPU, ctrl->procStatus[ctrl->curPU]));
+            if (ctrl->replayPos < ctrl->replaySize) {
+                /* not idle while there are items left to replay */
+                return PICODATA_PU_BUSY;
+            }
             /*update last scheduled PU*/
             return ctrl->procStatus[ctrl->curPU];
             break;
@@ -251,6 +314,35 @@ static pico_status_t ctrlTerminate(register picodata_ProcessingUnit this) {
     return status;
 }/*ctrlTerminate*/
 
+/**
+ * passes the prosody levels on to the sub-PUs that use them
+ * @param    this : pointer to Control PU
+ * @param    speed, pitch, volume : levels in percent
+ * @return    PICO_OK : processing done
+ * @return    PICO_ERR_OTHER : other error
+ * @callgraph
+ * @callergraph
+ */
+static pico_status_t ctrlSetProsody(register picodata_ProcessingUnit this,
+        picoos_uint16 speed, picoos_uint16 pitch, picoos_uint16 volume) {
+    pico_status_t status = PICO_OK;
+    picoos_int16 i;
+    register ctrl_subobj_t * ctrl;
+    if (NULL == this || NULL == this->subObj) {
+        return PICO_ERR_OTHER;
+    }
+    ctrl = (ctrl_subobj_t *) this->subObj;
+    for (i = 0; i < ctrl->numProcUnits; i++) {
+        if (NULL != ctrl->procUnit[i]->setProsody) {
+            status = ctrl->procUnit[i]->setProsody(ctrl->procUnit[i], speed, pitch, volume);
+            if (PICO_OK != status) {
+                return status;
+            }
+        }
+    }
+    return status;
+}/*ctrlSetProsody*/
+
 /**
  * deallocates Control PU's subobject
  * @param    this : pointer to Control PU
@@ -332,6 +424,9 @@ static pico_status_t ctrlAddPU(register picodata_ProcessingUnit this,
         }
     }
     ctrl->procStatus[newPU] = PICODATA_PU_IDLE;
+    if (PICODATA_PUTYPE_PAM == puType) {
+        ctrl->pamPU = newPU;
+    }
     /*...............*/
     switch (puType) {
     case PICODATA_PUTYPE_TOK:
@@ -431,6 +526,7 @@ picodata_ProcessingUnit picoctrl_newControl(picoos_MemoryManager mm,
     this->initialize = ctrlInitialize;
     this->step = ctrlStep;
     this->terminate = ctrlTerminate;
+    this->setProsody = ctrlSetProsody;
     this->subDeallocate = ctrlSubObjDeallocate;
 
     this->subObj = picoos_allocate(mm, sizeof(ctrl_subobj_t));
@@ -447,6 +543,11 @@ picodata_ProcessingUnit picoctrl_newControl(picoos_MemoryManager mm,
         ctrl->procCbOut[i] = NULL;
     }
     ctrl->numProcUnits = 0;
+    ctrl->pamPU = 0;
+    ctrl->recording = FALSE;
+    ctrl->recordingSize = 0;
+    ctrl->replayItems = NULL;
+    ctrl->replaySize = ctrl->replayPos = 0;
 
     if (
             (PICO_OK == ctrlAddPU(this,PICODATA_PUTYPE_TOK, FALSE, /*last*/FALSE)) &&
@@ -709,6 +810,105 @@ picoos_Common picoctrl_engGetCommon(picoctrl_Engine this) {
     }
 }/*picoctrl_engGetCommon*/
 
+/**
+ * sets the speed, pitch and volume of the speech synthesized from the text
+ * fed from now on, like absolute markup levels but without parsing any markup
+ * @param    this : handle of the engine
+ * @param    speed, pitch, volume : levels in percent, 100 being the default
+ * @return    PICO_OK : levels set
+ * @return    PICO_ERR_OTHER : if error
+ * @callgraph
+ * @callergraph
+ */
+pico_status_t picoctrl_engSetProsody(picoctrl_Engine this,
+        picoos_uint16 speed, picoos_uint16 pitch, picoos_uint16 volume) {
+    if (NULL == this) {
+        return PICO_ERR_OTHER;
+    }
+    return this->control->setProsody(this->control, speed, pitch, volume);
+}/*picoctrl_engSetProsody*/
+
+/**
+ * starts recording the items that the front end passes to PAM into 'buffer'
+ * @param    this : handle of the engine
+ * @param    buffer : the destination buffer for the items
+ * @param    bufferSize : size of the destination buffer
+ * @return    PICO_OK : recording started
+ * @return    PICO_ERR_OTHER : if error
+ * @callgraph
+ * @callergraph
+ */
+pico_status_t picoctrl_engStartItemRecording(picoctrl_Engine this,
+        picoos_uint8 * buffer, picoos_uint32 bufferSize) {
+    ctrl_subobj_t * ctrl;
+    if (NULL == this) {
+        return PICO_ERR_OTHER;
+    }
+    ctrl = (ctrl_subobj_t *) this->control->subObj;
+    picodata_cbSetRecording(ctrl->procCbOut[ctrl->pamPU - 1], buffer, bufferSize);
+    ctrl->recording = TRUE;
+    ctrl->recordingSize = bufferSize;
+    return PICO_OK;
+}/*picoctrl_engStartItemRecording*/
+
+/**
+ * stops recording items
+ * @param    this : handle of the engine
+ * @param    *bytesRecorded : the number of bytes of items recorded
+ * @return    PICO_OK : all items were recorded
+ * @return    PICO_EXC_BUF_OVERFLOW : the items didn't fit in the buffer
+ * @return    PICO_ERR_OTHER : not recording, e.g. because of a reset
+ * @callgraph
+ * @callergraph
+ */
+pico_status_t picoctrl_engStopItemRecording(picoctrl_Engine this,
+        picoos_uint32 * bytesRecorded) {
+    ctrl_subobj_t * ctrl;
+    picodata_CharBuffer cb;
+    picoos_uint32 size;
+    *bytesRecorded = 0;
+    if (NULL == this) {
+        return PICO_ERR_OTHER;
+    }
+    ctrl = (ctrl_subobj_t *) this->control->subObj;
+    if (!ctrl->recording) {
+        return PICO_ERR_OTHER;
+    }
+    cb = ctrl->procCbOut[ctrl->pamPU - 1];
+    size = picodata_cbGetRecordedLength(cb);
+    picodata_cbSetRecording(cb, NULL, 0);
+    ctrl->recording = FALSE;
+    if (size > ctrl->recordingSize) {
+        return PICO_EXC_BUF_OVERFLOW;
+    }
+    *bytesRecorded = size;
+    return PICO_OK;
+}/*picoctrl_engStopItemRecording*/
+
+/**
+ * makes the engine synthesize recorded items, which are fed to PAM as if
+ * the front end had produced them, instead of text
+ * @param    this : handle of the engine
+ * @param    items : the items; must stay valid until the engine is idle
+ * @param    size : size of the items in bytes
+ * @return    PICO_OK : items will be synthesized
+ * @return    PICO_ERR_OTHER : if error
+ * @callgraph
+ * @callergraph
+ */
+pico_status_t picoctrl_engPutItems(picoctrl_Engine this,
+        const picoos_uint8 * items, picoos_uint32 size) {
+    ctrl_subobj_t * ctrl;
+    if (NULL == this) {
+        return PICO_ERR_OTHER;
+    }
+    ctrl = (ctrl_subobj_t *) this->control->subObj;
+    ctrl->replayItems = items;
+    ctrl->replaySize = size;
+    ctrl->replayPos = 0;
+    return PICO_OK;
+}/*picoctrl_engPutItems*/
+
 /**
  * feed raw 'text' into 'engine'. text may contain '\\0'.
  * @param    this : handle of the engine
@@ -735,12 +935,57 @@ pico_status_t picoctrl_engFeedText(picoctrl_Engine this,
     return PICO_OK;
 }/*picoctrl_engFeedText*/
 
+/**
+ * gets the next output item of the engine that isn't speech data
+ * @param    this : handle of the engine
+ * @param    buffer : the destination buffer for the item content
+ * @param    bufferSize : max size of the destination buffer
+ * @param    *bytesReceived : the number of content bytes returned
+ * @param    *dataType : PICO_DATA_MARKER for the name of an SSML mark,
+ *             PICO_DATA_SENTENCE_START for the start of a sentence;
+ *             other items are dropped and PICO_DATA_PCM_16BIT is returned
+ *             with no data
+ * @return    PICO_OK, PICO_EOF or a buffer exception, like
+ *             picodata_cbGetSpeechData
+ * @callgraph
+ * @callergraph
+ */
+static pico_status_t ctrlGetNonSpeechItem(picoctrl_Engine this,
+        picoos_char *buffer,
+        picoos_int16 bufferSize,
+        picoos_uint16 *bytesReceived,
+        picoos_int16 *dataType) {
+    picoos_uint8 item[PICODATA_MAX_ITEMSIZE];
+    picoos_uint16 blen, i;
+    pico_status_t rv;
+
+    *bytesReceived = 0;
+    *dataType = PICO_DATA_PCM_16BIT;
+    rv = picodata_cbGetItem(this->cbOut, item, PICODATA_MAX_ITEMSIZE, &blen);
+    if (PICO_OK != rv) {
+        return rv;
+    }
+    if ((PICODATA_ITEM_CMD == item[PICODATA_ITEMIND_TYPE])
+            && (PICODATA_ITEMINFO1_CMD_MARKER == item[PICODATA_ITEMIND_INFO1])) {
+        *dataType = PICO_DATA_MARKER;
+        for (i = PICODATA_ITEM_HEADSIZE; (i < blen)
+                && (*bytesReceived < bufferSize); i++) {
+            buffer[(*bytesReceived)++] = item[i];
+        }
+    } else if ((PICODATA_ITEM_BOUND == item[PICODATA_ITEMIND_TYPE])
+            && (PICODATA_ITEMINFO1_BOUND_SBEG == item[PICODATA_ITEMIND_INFO1])) {
+        *dataType = PICO_DATA_SENTENCE_START;
+    }
+    return PICO_OK;
+}/*ctrlGetNonSpeechItem*/
+
 /**
  * gets engine output bytes
  * @param    this : handle of the engine
  * @param    buffer : the destination buffer
  * @param    bufferSize : max size of the destinatioon buffer
  * @param    *bytesReceived : the number of bytes effectively returned
+ * @param    *dataType : the type of data returned (PICO_DATA_*)
  * @return    PICO_OK : feeding succeded
  * @return    PICO_ERR_OTHER : if error
  * @callgraph
@@ -750,7 +995,8 @@ picodata_step_result_t picoctrl_engFetchOutputItemBytes(
         picoctrl_Engine this,
         picoos_char *buffer,
         picoos_int16 bufferSize,
-        picoos_int16 *bytesReceived) {
+        picoos_int16 *bytesReceived,
+        picoos_int16 *dataType) {
     picoos_uint16 ui;
     picodata_step_result_t stepResult;
     pico_status_t rv;
@@ -762,8 +1008,16 @@ picodata_step_result_t picoctrl_engFetchOutputItemBytes(
     stepResult = this->control->step(this->control,/* mode */0,&ui);
     if (PICODATA_PU_ERROR != stepResult) {
         PICODBG_TRACE(("filling output buffer"));
-        rv = picodata_cbGetSpeechData(this->cbOut, (picoos_uint8 *)buffer,
-                                      bufferSize, &ui);
+        *dataType = PICO_DATA_PCM_16BIT;
+        if (PICODATA_ITEM_FRAME == picodata_cbGetFrontItemType(this->cbOut)) {
+            rv = picodata_cbGetSpeechData(this->cbOut, (picoos_uint8 *)buffer,
+                                          bufferSize, &ui);
+        } else {
+            /* markers and sentence starts are passed on, anything else
+               is dropped like picodata_cbGetSpeechData does */
+            rv = ctrlGetNonSpeechItem(this, buffer, bufferSize, &ui,
+                                      dataType);
+        }
 
         if (ui > 255) {   /* because picoapi uses signed int16 */
             return (picodata_step_result_t)PICO_STEP_ERROR;
@@ -791,6 +1045,105 @@ picodata_step_result_t picoctrl_engFetchOutputItemBytes(
     }
 }/*picoctrl_engFetchOutputItemBytes*/
 
+/* the number of steps in a row without output after which
+   picoctrl_engFetchOutputBytes returns what it has, so that speech isn't
+   held back while the front end analyzes the next sentence */
+#define PICOCTRL_MAX_STEPS_WITHOUT_OUTPUT 100
+
+/**
+ * gets engine output bytes in bulk: unlike
+ * picoctrl_engFetchOutputItemBytes, which does one step and returns at most
+ * one item, steps the engine until the buffer can't take another frame of
+ * speech data, and returns all the speech data gathered in the meantime
+ * @param    this : handle of the engine
+ * @param    buffer : the destination buffer
+ * @param    bufferSize : max size of the destination buffer, which must
+ *             be at least PICODATA_MAX_ITEMSIZE
+ * @param    *bytesReceived : the number of bytes effectively returned
+ * @param    *dataType : the type of data returned (PICO_DATA_*); markers
+ *             and sentence starts are returned on their own, after any
+ *             speech data before them
+ * @return    PICO_STEP_BUSY or PICO_STEP_IDLE, like
+ *             picoctrl_engFetchOutputItemBytes
+ * @return    PICO_STEP_ERROR : if error
+ * @callgraph
+ * @callergraph
+ */
+picodata_step_result_t picoctrl_engFetchOutputBytes(
+        picoctrl_Engine this,
+        picoos_char *buffer,
+        picoos_uint32 bufferSize,
+        picoos_uint32 *bytesReceived,
+        picoos_int16 *dataType) {
+    picoos_uint16 ui, blenmax;
+    picoos_uint32 received = 0;
+    picoos_uint32 stepsWithoutOutput = 0;
+    picodata_step_result_t stepResult;
+    pico_status_t rv;
+
+    if ((NULL == this) || (bufferSize < PICODATA_MAX_ITEMSIZE)) {
+        return (picodata_step_result_t)PICO_STEP_ERROR;
+    }
+    *bytesReceived = 0;
+    *dataType = PICO_DATA_PCM_16BIT;
+    while (TRUE) {
+        PICODBG_DEBUG(("doing one step"));
+        stepResult = this->control->step(this->control,/* mode */0,&ui);
+        if (PICODATA_PU_ERROR == stepResult) {
+            return (picodata_step_result_t)PICO_STEP_ERROR;
+        }
+
+        /* move what the step output to the caller's buffer */
+        stepsWithoutOutput++;
+        while (picodata_cbGetLength(this->cbOut) > 0) {
+            if (PICODATA_ITEM_FRAME ==
+                    picodata_cbGetFrontItemType(this->cbOut)) {
+                blenmax = (bufferSize - received > PICODATA_MAX_ITEMSIZE) ?
+                        PICODATA_MAX_ITEMSIZE :
+                        (picoos_uint16)(bufferSize - received);
+                rv = picodata_cbGetSpeechData(this->cbOut,
+                        (picoos_uint8 *)buffer + received, blenmax, &ui);
+                if (PICO_EXC_BUF_OVERFLOW == rv) {
+                    /* full; the frame is left for the next call */
+                    *bytesReceived = received;
+                    return (picodata_step_result_t)PICO_STEP_BUSY;
+                } else if (PICO_OK != rv) {
+                    PICODBG_ERROR(("problem getting speech data"));
+                    return (picodata_step_result_t)PICO_STEP_ERROR;
+                }
+                received += ui;
+                stepsWithoutOutput = 0;
+            } else if (received > 0) {
+                /* return the speech data before the item first */
+                *bytesReceived = received;
+                return (picodata_step_result_t)PICO_STEP_BUSY;
+            } else {
+                rv = ctrlGetNonSpeechItem(this, buffer, PICODATA_MAX_ITEMSIZE,
+                                          &ui, dataType);
+                if (PICO_OK != rv) {
+                    PICODBG_ERROR(("problem getting output item"));
+                    return (picodata_step_result_t)PICO_STEP_ERROR;
+                }
+                if (PICO_DATA_PCM_16BIT != *dataType) {
+                    *bytesReceived = ui;
+                    return (picodata_step_result_t)PICO_STEP_BUSY;
+                }
+            }
+        }
+
+        if (PICODATA_PU_IDLE == stepResult) {
+            PICODBG_DEBUG(("IDLE"));
+            *bytesReceived = received;
+            return (picodata_step_result_t)PICO_STEP_IDLE;
+        }
+        if ((bufferSize - received < PICODATA_MAX_ITEMSIZE) ||
+                (stepsWithoutOutput >= PICOCTRL_MAX_STEPS_WITHOUT_OUTPUT)) {
+            *bytesReceived = received;
+            return (picodata_step_result_t)PICO_STEP_BUSY;
+        }
+    }
+}/*picoctrl_engFetchOutputBytes*/
+
 /**
  * returns the last scheduled PU
  * @param    this : handle of the engine
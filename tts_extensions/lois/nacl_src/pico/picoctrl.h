@@ -68,6 +68,26 @@ pico_status_t picoctrl_engFeedText(
         picoos_int16  textSize,
         picoos_int16 * bytesPut);
 
+pico_status_t picoctrl_engSetProsody(
+        picoctrl_Engine engine,
+        picoos_uint16 speed,
+        picoos_uint16 pitch,
+        picoos_uint16 volume);
+
+pico_status_t picoctrl_engStartItemRecording(
+        picoctrl_Engine engine,
+        picoos_uint8 * buffer,
+        picoos_uint32 bufferSize);
+
+pico_status_t picoctrl_engStopItemRecording(
+        picoctrl_Engine engine,
+        picoos_uint32 * bytesRecorded);
+
+pico_status_t picoctrl_engPutItems(
+        picoctrl_Engine engine,
+        const picoos_uint8 * items,
+        picoos_uint32 size);
+
 pico_status_t picoctrl_engReset(
         picoctrl_Engine engine,
         picoos_int32 resetMode);
@@ -78,7 +98,16 @@ picodata_step_result_t picoctrl_engFetchOutputItemBytes(
         picoctrl_Engine engine,
         picoos_char * buffer,
         picoos_int16 bufferSize,
-        picoos_int16  * bytesReceived
+        picoos_int16  * bytesReceived,
+        picoos_int16  * dataType
+);
+
+picodata_step_result_t picoctrl_engFetchOutputBytes(
+        picoctrl_Engine engine,
+        picoos_char * buffer,
+        picoos_uint32 bufferSize,
+        picoos_uint32 * bytesReceived,
+        picoos_int16 * dataType
 );
 
 void picoctrl_engResetExceptionManager(
@@ -75,6 +75,11 @@ typedef struct picodata_char_buffer
     picodata_cbSubResetMethod subReset;
     picodata_cbSubDeallocateMethod subDeallocate;
     void * subObj;
+
+    /* copy of all items put, while recording */
+    picoos_uint8 * recBuf;
+    picoos_uint32 recSize;
+    picoos_uint32 recLen; /* larger than recSize if the items didn't fit */
 } char_buffer_t;
 
 
@@ -125,6 +130,10 @@ picodata_CharBuffer picodata_newCharBuffer(picoos_MemoryManager mm,
     this->subDeallocate = NULL;
     this->subObj = NULL;
 
+    this->recBuf = NULL;
+    this->recSize = 0;
+    this->recLen = 0;
+
     picodata_cbReset(this);
     return this;
 }
@@ -338,8 +347,42 @@ pico_status_t picodata_cbPutItem(register picodata_CharBuffer this,
         const picoos_uint8 *buf, const picoos_uint16 blenmax,
         picoos_uint16 *blen)
 {
+    pico_status_t status;
+
+    status = this->putItem(this,buf,blenmax,blen);
+    if ((PICO_OK == status) && (NULL != this->recBuf)) {
+        /* once an item didn't fit, the recording is incomplete: stop copying */
+        if ((this->recLen <= this->recSize) && (*blen <= this->recSize - this->recLen)) {
+            picoos_mem_copy(buf, this->recBuf + this->recLen, *blen);
+        }
+        this->recLen += *blen;
+    }
+    return status;
+}
+
+/*----------------------------------------------------------
+ *  Name    : picodata_cbSetRecording
+ *  Function: starts copying every item put into 'this' to 'buf' of size
+ *              'size', replacing any previous recording; a NULL 'buf'
+ *              stops recording.
+ * ---------------------------------------------------------*/
+void picodata_cbSetRecording(register picodata_CharBuffer this,
+        picoos_uint8 *buf, picoos_uint32 size)
+{
+    this->recBuf = buf;
+    this->recSize = size;
+    this->recLen = 0;
+}
 
-        return this->putItem(this,buf,blenmax,blen);
+/*----------------------------------------------------------
+ *  Name    : picodata_cbGetRecordedLength
+ *  Function: returns the number of bytes of items put since recording
+ *              started, which is more than the size of the recording
+ *              buffer if they didn't all fit.
+ * ---------------------------------------------------------*/
+picoos_uint32 picodata_cbGetRecordedLength(register picodata_CharBuffer this)
+{
+    return this->recLen;
 }
 
 /* unsafe, just for measuring purposes */
@@ -347,6 +390,11 @@ picoos_uint8 picodata_cbGetFrontItemType(register picodata_CharBuffer this)
 {
     return  this->buf[this->front];
 }
+
+picoos_uint16 picodata_cbGetLength(register picodata_CharBuffer this)
+{
+    return this->len;
+}
 /* ***************************************************************
  *                   items: support function                     *
  *****************************************************************/
@@ -623,6 +671,7 @@ picodata_ProcessingUnit picodata_newProcessingUnit(
     this->initialize = puSimpleInitialize;
     this->terminate = puSimpleTerminate;
     this->step = puSimpleStep;
+    this->setProsody = NULL;
     this->subDeallocate = NULL;
     this->subObj = NULL;
     return this;
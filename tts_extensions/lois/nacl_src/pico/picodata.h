@@ -328,6 +328,18 @@ pico_status_t picodata_cbPutItem(register picodata_CharBuffer this,
 /* unsafe, just for measuring purposes */
 picoos_uint8 picodata_cbGetFrontItemType(register picodata_CharBuffer this);
 
+/* returns the number of bytes in a CharBuffer; 0 if it is empty */
+picoos_uint16 picodata_cbGetLength(register picodata_CharBuffer this);
+
+/* copies every item put into 'this' from now on to 'buf' of 'size' bytes,
+   so that the item stream can be replayed later; a NULL 'buf' stops */
+void picodata_cbSetRecording(register picodata_CharBuffer this,
+        picoos_uint8 *buf, picoos_uint32 size);
+
+/* returns the number of bytes of items put since recording started; more
+   than the recording buffer's size if they didn't all fit */
+picoos_uint32 picodata_cbGetRecordedLength(register picodata_CharBuffer this);
+
 /* ***************************************************************
  *                   items: support function                     *
  *****************************************************************/
@@ -502,6 +514,9 @@ typedef pico_status_t (* picodata_puInitializeMethod) (register picodata_Process
 typedef pico_status_t (* picodata_puTerminateMethod) (register picodata_ProcessingUnit this);
 typedef picodata_step_result_t (* picodata_puStepMethod) (register picodata_ProcessingUnit this, picoos_int16 mode, picoos_uint16 * numBytesOutput);
 typedef pico_status_t (* picodata_puSubDeallocateMethod) (register picodata_ProcessingUnit this, picoos_MemoryManager mm);
+/* sets the absolute speed, pitch and volume levels in percent, as with the
+   'level' of the corresponding markup, without going through the item stream */
+typedef pico_status_t (* picodata_puSetProsodyMethod) (register picodata_ProcessingUnit this, picoos_uint16 speed, picoos_uint16 pitch, picoos_uint16 volume);
 
 typedef struct picodata_processing_unit
 {
@@ -509,6 +524,7 @@ typedef struct picodata_processing_unit
     picodata_puInitializeMethod initialize;
     picodata_puStepMethod       step;
     picodata_puTerminateMethod  terminate;
+    picodata_puSetProsodyMethod setProsody; /* NULL unless the PU uses prosody levels */
     picorsrc_Voice              voice;
 
     /* protected */
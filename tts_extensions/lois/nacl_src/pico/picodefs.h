@@ -171,6 +171,12 @@ typedef signed int pico_Status;
 /* 16 bit PCM samples, native endianness of platform */
 #define PICO_DATA_PCM_16BIT             (pico_Int16)  1
 
+/* name of an SSML <mark> reached in the output, not '\0'-terminated */
+#define PICO_DATA_MARKER                (pico_Int16)  2
+
+/* start of a sentence in the output; no data */
+#define PICO_DATA_SENTENCE_START        (pico_Int16)  3
+
 #ifdef __cplusplus
 }
 #endif
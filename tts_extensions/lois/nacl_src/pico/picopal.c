@@ -91,6 +91,13 @@ extern "C" {
 #include <windows.h>
 #endif
 
+#ifndef EMBED_FILES
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #if defined(PRAGMA_MESSAGE)
 #pragma message("PICO_PLATFORM       : " PICO_PLATFORM_STRING)
 #endif
@@ -294,8 +301,9 @@ picopal_char picopal_eol(void)
 }
 
 
-#if 0  // dmazzoni
-
+/* When the lingware is embedded in the executable, pico_embedded_files.c
+   implements file access instead. */
+#ifndef EMBED_FILES
 
 
 /* 'fopen' opens the file with name 'filename'. Depending on
@@ -408,8 +416,37 @@ picopal_objsize_t picopal_fread_bytes (picopal_File f, void * ptr, picopal_objsi
 
 picopal_objsize_t picopal_fwrite_bytes (picopal_File f, void * ptr, picopal_objsize_t objsize, picopal_uint32 nobj){    return (picopal_objsize_t) fwrite(ptr, objsize, nobj, (FILE *)f);}
 
+picopal_uint8 picopal_get_file_image (picopal_char filename[], const picopal_uint8 ** data, picopal_uint32 * size)
+{
+    struct stat st;
+    void * image;
+    int fd;
+
+    fd = open((char *)filename, O_RDONLY);
+    if (fd < 0) {
+        return FALSE;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return FALSE;
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return FALSE;
+    }
+    *data = (const picopal_uint8 *) image;
+    *size = (picopal_uint32) st.st_size;
+    return TRUE;
+}
+
+void picopal_release_file_image (const picopal_uint8 * data, picopal_uint32 size)
+{
+    munmap((void *) data, size);
+}
+
 
-#endif  // dmazzoni
+#endif  /* EMBED_FILES */
 
 
 /* *************************************************/
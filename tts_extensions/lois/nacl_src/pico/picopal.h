@@ -229,6 +229,17 @@ extern picopal_objsize_t picopal_fwrite_bytes (picopal_File f, void * ptr, picop
 
 extern pico_status_t picopal_fflush (picopal_File f);
 
+extern picopal_uint8 picopal_get_file_image (picopal_char fileName[], const picopal_uint8 ** data, picopal_uint32 * size);
+/* 'get_file_image' returns TRUE and sets 'data' and 'size' to the whole
+   contents of the file with name 'filename' if the platform can provide
+   them without reading the file, e.g. because the file is linked into the
+   application or can be memory-mapped. The contents are read-only and
+   remain valid until released with 'release_file_image'. Otherwise FALSE
+   is given back, and the file must be read with 'fopen'.
+*/
+
+extern void picopal_release_file_image (const picopal_uint8 * data, picopal_uint32 size);
+
 /*
 extern pico_status_t picopal_fput_char (picopal_File f, picopal_char ch);
 */
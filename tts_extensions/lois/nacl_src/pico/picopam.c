@@ -388,6 +388,8 @@ typedef struct pam_subobj
  ------------------------------------------------------------------*/
 static pico_status_t pam_initialize(register picodata_ProcessingUnit this, picoos_int32 resetMode);
 static pico_status_t pam_terminate(register picodata_ProcessingUnit this);
+static pico_status_t pam_setProsody(register picodata_ProcessingUnit this,
+        picoos_uint16 speed, picoos_uint16 pitch, picoos_uint16 volume);
 static pico_status_t pam_allocate(picoos_MemoryManager mm, pam_subobj_t *pam);
 static void pam_deallocate(picoos_MemoryManager mm, pam_subobj_t *pam);
 static pico_status_t pam_subobj_deallocate(register picodata_ProcessingUnit this,
@@ -727,6 +729,31 @@ static pico_status_t pam_terminate(register picodata_ProcessingUnit this)
     return PICO_OK;
 }/*pam_terminate*/
 
+/**
+ * sets the pitch and duration modifiers like absolute PITCH and SPEED commands
+ * @param    this : handle to a pam PU struct
+ * @param    speed, pitch : levels in percent
+ * @param    volume : unused, applied by sig
+ * @return PICO_OK
+ * @callgraph
+ * @callergraph
+ */
+static pico_status_t pam_setProsody(register picodata_ProcessingUnit this,
+        picoos_uint16 speed, picoos_uint16 pitch, picoos_uint16 volume)
+{
+
+    pam_subobj_t *pam;
+
+    if (NULL == this || NULL == this->subObj) {
+        return PICO_ERR_OTHER;
+    }
+    pam = (pam_subobj_t *) this->subObj;
+    pam->pMod = (picoos_single) pitch / (picoos_single) 100.0f;
+    pam->dMod = 1.0f / ((picoos_single) speed / (picoos_single) 100.0f);
+
+    return PICO_OK;
+}/*pam_setProsody*/
+
 /**
  * deallocaton of a pam PU
  * @param    this : handle to a pam PU struct
@@ -798,6 +825,7 @@ picodata_ProcessingUnit picopam_newPamUnit(picoos_MemoryManager mm,
 
     this->step = pam_step;
     this->terminate = pam_terminate;
+    this->setProsody = pam_setProsody;
     this->subDeallocate = pam_subobj_deallocate;
     this->subObj = picoos_allocate(mm, sizeof(pam_subobj_t));
     if (this->subObj == NULL) {
@@ -533,6 +533,48 @@ static pico_status_t picorsrc_getKbList(picorsrc_ResourceManager this,
 /* load resource file. the type of resource file etc. are in the header,
  * then follows the directory, then the knowledge bases themselves (as byte streams) */
 
+/* note the resource unique name and type from 'header' and create the kb
+ * list of the 'len' bytes of content at res->start */
+static pico_status_t initResource(picorsrc_ResourceManager this,
+        picorsrc_Resource res, picoos_FileHeader header, picoos_uint32 len)
+{
+    pico_status_t status = PICO_OK;
+
+    /* note resource unique name */
+    if (picoos_strlcpy(res->name,header->field[PICOOS_HEADER_NAME].value,PICORSRC_MAX_RSRC_NAME_SIZ) < PICORSRC_MAX_RSRC_NAME_SIZ) {
+        PICODBG_DEBUG(("assigned name %s to resource",res->name));
+        status = PICO_OK;
+    } else {
+        status = PICO_ERR_INDEX_OUT_OF_RANGE;
+        PICODBG_ERROR(("failed assigning name %s to resource",
+                       res->name));
+        picoos_emRaiseException(this->common->em,
+                                PICO_ERR_INDEX_OUT_OF_RANGE, NULL,
+                                (picoos_char *)"resource %s",res->name);
+    }
+
+    /* get resource type */
+    if (PICO_OK == status) {
+        if (!picoos_strcmp(header->field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_TEXTANA)) {
+            res->type = PICORSRC_TYPE_TEXTANA;
+        } else if (!picoos_strcmp(header->field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_SIGGEN)) {
+            res->type = PICORSRC_TYPE_SIGGEN;
+        } else if (!picoos_strcmp(header->field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_SIGGEN)) {
+            res->type = PICORSRC_TYPE_USER_LEX;
+        } else if (!picoos_strcmp(header->field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_SIGGEN)) {
+            res->type = PICORSRC_TYPE_USER_PREPROC;
+        } else {
+            res->type = PICORSRC_TYPE_OTHER;
+        }
+    }
+
+    if (PICO_OK == status) {
+        /* create kb list from resource */
+        status = picorsrc_getKbList(this, res->start, len, &res->kbList);
+    }
+    return status;
+}
+
 pico_status_t picorsrc_loadResource(picorsrc_ResourceManager this,
         picoos_char * fileName, picorsrc_Resource * resource)
 {
@@ -617,39 +659,147 @@ pico_status_t picorsrc_loadResource(picorsrc_ResourceManager this,
              has an effect in test configurations only */
             picoos_protectMem(this->common->mm, res->start, len, /*enable*/TRUE);
         }
-        /* note resource unique name */
         if (PICO_OK == status) {
-            if (picoos_strlcpy(res->name,header.field[PICOOS_HEADER_NAME].value,PICORSRC_MAX_RSRC_NAME_SIZ) < PICORSRC_MAX_RSRC_NAME_SIZ) {
-                PICODBG_DEBUG(("assigned name %s to resource",res->name));
-                status = PICO_OK;
-            } else {
-                status = PICO_ERR_INDEX_OUT_OF_RANGE;
-                PICODBG_ERROR(("failed assigning name %s to resource",
-                               res->name));
-                picoos_emRaiseException(this->common->em,
-                                        PICO_ERR_INDEX_OUT_OF_RANGE, NULL,
-                                        (picoos_char *)"resource %s",res->name);
-            }
+            status = initResource(this, res, &header, len);
+        }
+    }
+
+    if (status == PICO_OK) {
+        /* add resource to rm */
+        res->next = this->resources;
+        this->resources = res;
+        this->numResources++;
+        *resource = res;
+        PICODBG_DEBUG(("done loading resource %s from %s", res->name, fileName));
+    } else {
+        picorsrc_disposeResource(this->common->mm, &res);
+        PICODBG_ERROR(("failed to load resource"));
+    }
+
+    if (status < 0) {
+        return status;
+    } else {
+        return PICO_OK;
+    }
+}
+
+/* same as readHeader, but for a resource file image in memory; on success
+ * '*pos' is the offset of the first byte after the header */
+static pico_status_t readMemHeader(picorsrc_ResourceManager this,
+        picoos_FileHeader header, const picoos_uint8 * data,
+        picoos_uint32 size, picoos_uint32 * pos)
+{
+    picoos_char str[32];
+    picoos_uint8 strlen;
+    picoos_uint16 hdrlen1;
+    picoos_uint32 start, i;
+
+    /* the svox header may be preceded by a foreign header (see
+     * picoos_readPicoHeader); it contains NULLC, so compare bytes */
+    picoos_getSVOXHeaderString(str,&strlen,32);
+    for (start = 0; start <= PICO_MAX_FOREIGN_HEADER_LEN; start++) {
+        if (start + strlen > size) {
+            start = PICO_MAX_FOREIGN_HEADER_LEN + 1;
+            break;
+        }
+        for (i = 0; i < strlen && data[start + i] == (picoos_uint8) str[i]; i++) {
+        }
+        if (i == strlen) {
+            break;
         }
+    }
+    if (start > PICO_MAX_FOREIGN_HEADER_LEN) {
+        return picoos_emRaiseException(this->common->em,PICO_EXC_UNEXPECTED_FILE_TYPE,NULL,(picoos_char *)"problem reading file header");
+    }
+    *pos = start + strlen;
+
+    /* read header length (excluding length itself) */
+    if (*pos + 2 > size) {
+        return PICO_ERR_OTHER;
+    }
+    picoos_read_mem_pi_uint16((picoos_uint8 *) data, pos, &hdrlen1);
+    PICODBG_DEBUG(("got header size %d",hdrlen1));
+    if (hdrlen1 > PICOOS_MAX_HEADER_STRING_LEN-1 || *pos + hdrlen1 > size) {
+        return PICO_ERR_OTHER;
+    }
+    picoos_mem_copy(data + *pos, this->tmpHeader, hdrlen1);
+    this->tmpHeader[hdrlen1] = NULLC;
+    *pos += hdrlen1;
+    PICODBG_DEBUG(("got header <%s>",this->tmpHeader));
+
+    return picoos_hdrParseHeader(header, this->tmpHeader);
+}
+
+pico_status_t picorsrc_loadResourceFromMemory(picorsrc_ResourceManager this,
+        const picoos_uint8 * data, picoos_uint32 size,
+        picorsrc_Resource * resource)
+{
+    picorsrc_Resource res;
+    picoos_uint32 pos, len, maxlen;
+    picoos_file_header_t header;
+    picoos_uint8 rem;
+    pico_status_t status = PICO_OK;
+
+    if (resource == NULL || data == NULL) {
+        return PICO_ERR_NULLPTR_ACCESS;
+    } else {
+        *resource = NULL;
+    }
+
+    res = picorsrc_newResource(this->common->mm);
+
+    if (NULL == res) {
+        return picoos_emRaiseException(this->common->em,PICO_EXC_OUT_OF_MEM,NULL,NULL);
+    }
+
+    if (PICO_MAX_NUM_RESOURCES <= this->numResources) {
+        picoos_deallocate(this->common->mm, (void *) &res);
+        return picoos_emRaiseException(this->common->em,PICO_EXC_MAX_NUM_EXCEED,NULL,(picoos_char *)"no more than %i resources",PICO_MAX_NUM_RESOURCES);
+    }
+
+    status = readMemHeader(this, &header, data, size, &pos);
+
+    if (PICO_OK == status && isResourceLoaded(this, header.field[PICOOS_HEADER_NAME].value)) {
+        /* lingware is allready loaded, do nothing */
+        PICODBG_WARN((">>> lingware '%s' allready loaded",header.field[PICOOS_HEADER_NAME].value));
+        picoos_emRaiseWarning(this->common->em,PICO_WARN_RESOURCE_DOUBLE_LOAD,NULL,(picoos_char *)"%s",header.field[PICOOS_HEADER_NAME].value);
+        status = PICO_WARN_RESOURCE_DOUBLE_LOAD;
+    }
 
-        /* get resource type */
+    if (PICO_OK == status) {
+        /* get data length */
+        status = (pos + 4 <= size) ? PICO_OK : PICO_ERR_OTHER;
+        if (PICO_OK == status) {
+            picoos_read_mem_pi_uint32((picoos_uint8 *) data, &pos, &len);
+            PICODBG_DEBUG(("found net resource len of %i",len));
+            status = (len <= size - pos) ? PICO_OK : PICO_ERR_OTHER;
+        }
         if (PICO_OK == status) {
-            if (!picoos_strcmp(header.field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_TEXTANA)) {
-                res->type = PICORSRC_TYPE_TEXTANA;
-            } else if (!picoos_strcmp(header.field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_SIGGEN)) {
-                res->type = PICORSRC_TYPE_SIGGEN;
-            } else if (!picoos_strcmp(header.field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_SIGGEN)) {
-                res->type = PICORSRC_TYPE_USER_LEX;
-            } else if (!picoos_strcmp(header.field[PICOOS_HEADER_CONTENT_TYPE].value, PICORSRC_FIELD_VALUE_SIGGEN)) {
-                res->type = PICORSRC_TYPE_USER_PREPROC;
+            rem = (picoos_uint32) ((picoos_objsize_t) (data + pos) % PICORSRC_SHARED_ALIGN_SIZE);
+            if (rem == 0) {
+                /* use the caller's copy; raw_mem stays NULL so that it's
+                 * never deallocated */
+                res->start = (picoos_uint8 *) data + pos;
             } else {
-                res->type = PICORSRC_TYPE_OTHER;
+                /* misaligned: fall back to a private copy */
+                PICODBG_WARN(("resource data misaligned, copying it"));
+                maxlen = len + PICOOS_ALIGN_SIZE;
+                res->raw_mem = picoos_allocProtMem(this->common->mm, maxlen);
+                status = (NULL == res->raw_mem) ? PICO_EXC_OUT_OF_MEM : PICO_OK;
+                if (PICO_OK == status) {
+                    rem = (picoos_uint32) ((picoos_objsize_t) res->raw_mem % PICOOS_ALIGN_SIZE);
+                    if (rem > 0) {
+                        res->start = res->raw_mem + (PICOOS_ALIGN_SIZE - rem);
+                    } else {
+                        res->start = res->raw_mem;
+                    }
+                    picoos_mem_copy(data + pos, res->start, len);
+                    picoos_protectMem(this->common->mm, res->start, len, /*enable*/TRUE);
+                }
             }
         }
-
         if (PICO_OK == status) {
-            /* create kb list from resource */
-            status = picorsrc_getKbList(this, res->start, len, &res->kbList);
+            status = initResource(this, res, &header, len);
         }
     }
 
@@ -659,7 +809,7 @@ pico_status_t picorsrc_loadResource(picorsrc_ResourceManager this,
         this->resources = res;
         this->numResources++;
         *resource = res;
-        PICODBG_DEBUG(("done loading resource %s from %s", res->name, fileName));
+        PICODBG_DEBUG(("done loading resource %s from memory", res->name));
     } else {
         picorsrc_disposeResource(this->common->mm, &res);
         PICODBG_ERROR(("failed to load resource"));
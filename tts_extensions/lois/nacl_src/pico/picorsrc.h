@@ -116,6 +116,20 @@ picoos_int16 picoctrl_isValidResourceHandle(picorsrc_Resource resource);
 pico_status_t picorsrc_loadResource(picorsrc_ResourceManager this,
         picoos_char * fileName, picorsrc_Resource * resource);
 
+/* alignment required of the content of a resource passed to
+ * picorsrc_loadResourceFromMemory for it to be used in place; knowledge
+ * bases are read at most 32 bits at a time */
+#define PICORSRC_SHARED_ALIGN_SIZE 4
+
+/* load a resource from an image of a resource file in memory. the image is
+ * used in place, without copying it into the pico heap, unless its content
+ * isn't aligned to PICORSRC_SHARED_ALIGN_SIZE; the caller must keep it
+ * unchanged until the resource is unloaded. one image may be shared by any
+ * number of resource managers, even in different threads */
+pico_status_t picorsrc_loadResourceFromMemory(picorsrc_ResourceManager this,
+        const picoos_uint8 * data, picoos_uint32 size,
+        picorsrc_Resource * resource);
+
 /* unload resource file. (warn if resource file is busy) */
 pico_status_t picorsrc_unloadResource(picorsrc_ResourceManager this, picorsrc_Resource * rsrc);
 
@@ -205,6 +205,30 @@ static pico_status_t sigTerminate(register picodata_ProcessingUnit this)
     return PICO_OK;
 }/*sigTerminate*/
 
+/**
+ * sets the pitch and volume modifiers like absolute PITCH and VOLUME commands
+ * @param    this : sig PU object
+ * @param    speed : unused, applied by pam
+ * @param    pitch, volume : levels in percent
+ * @return  PICO_OK : modifiers set
+ * @return  PICO_ERR_OTHER : no sub object
+ * @callgraph
+ * @callergraph
+ */
+static pico_status_t sigSetProsody(register picodata_ProcessingUnit this,
+        picoos_uint16 speed, picoos_uint16 pitch, picoos_uint16 volume)
+{
+    sig_subobj_t *sig_subObj;
+    if (NULL == this || NULL == this->subObj) {
+        return PICO_ERR_OTHER;
+    }
+    sig_subObj = (sig_subobj_t *) this->subObj;
+    sig_subObj->pMod = (picoos_single) pitch / (picoos_single) 100.0f;
+    sig_subObj->vMod = (picoos_single) volume / (picoos_single) 100.0f;
+
+    return PICO_OK;
+}/*sigSetProsody*/
+
 /**
  * deallocates the PU (processing unit) sub object
  * @param    this : sig PU object
@@ -271,6 +295,7 @@ picodata_ProcessingUnit picosig_newSigUnit(picoos_MemoryManager mm,
     /*Init function pointers*/
     this->step = sigStep;
     this->terminate = sigTerminate;
+    this->setProsody = sigSetProsody;
     this->subDeallocate = sigSubObjDeallocate;
     /*sub obj allocation*/
     this->subObj = picoos_allocate(mm, sizeof(sig_subobj_t));
@@ -320,7 +345,6 @@ static pico_status_t getPhsFromPdf(register picodata_ProcessingUnit this,
 {
     sig_subobj_t *sig_subObj;
     picokpdf_PdfPHS pdf;
-    static int nFrame = 0;
 
     picoos_uint32 nIndexValue;
     picoos_uint8 *nCurrIndexOffset, *nContent;
@@ -342,7 +366,7 @@ static pico_status_t getPhsFromPdf(register picodata_ProcessingUnit this,
     nContent += nIndexValue;
     *numComponents = (picoos_int16) *nContent++;
     if (*numComponents>PICODSP_PHASEORDER) {
-        PICODBG_DEBUG(("WARNING : Frame %d -- Phase vector[%d] Components = %d --> too big\n",  nFrame, phsIndex, *numComponents));
+        PICODBG_DEBUG(("WARNING : Phase vector[%d] Components = %d --> too big\n", phsIndex, *numComponents));
         *numComponents = PICODSP_PHASEORDER;
     }
     for (nI=0; nI<*numComponents; nI++) {
@@ -351,7 +375,6 @@ static pico_status_t getPhsFromPdf(register picodata_ProcessingUnit this,
     for (nI=*numComponents; nI<PICODSP_PHASEORDER; nI++) {
         phsVect[nI] = 0;
     }
-    nFrame++;
     return PICO_OK;
 }/*getPhsFromPdf*/
 
@@ -3,7 +3,10 @@
 //
 // Author: dmazzoni@google.com (Dominic Mazzoni)
 //
-// Embedded-file implementation of Pico's file operations.
+// Embedded-file implementation of Pico's file operations, used when
+// EMBED_FILES is defined; otherwise picopal.c reads real files.
+
+#ifdef EMBED_FILES
 
 #include <stdlib.h>
 #include <string.h>
@@ -155,3 +158,23 @@ picopal_objsize_t picopal_fwrite_bytes (picopal_File f,
   return -1;
 }
 
+picopal_uint8 picopal_get_file_image (picopal_char filename[],
+                                      const picopal_uint8 ** data,
+                                      picopal_uint32 * size)
+{
+  const struct FileToc *toc = get_embedded_file(filename);
+  if (!toc) {
+    return FALSE;
+  }
+  *data = (const picopal_uint8 *)toc->data;
+  *size = (picopal_uint32)toc->size;
+  return TRUE;
+}
+
+void picopal_release_file_image (const picopal_uint8 * data,
+                                 picopal_uint32 size)
+{
+  // Embedded files are part of the executable and never released.
+}
+
+#endif  // EMBED_FILES
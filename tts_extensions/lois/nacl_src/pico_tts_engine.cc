@@ -6,10 +6,14 @@
 // Pico specific implementation of the TtsEngine interface defined in
 // tts_engine.h.
 
+#include <ctype.h>
 #include <cstdio>
-#include <math.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "log.h"
+#include "pico/picopal.h"
 #include "pico_tts_engine.h"
 
 #define FAILERR(X) \
@@ -26,35 +30,52 @@ const char* PROP_PITCH = "pitch";
 const char* PROP_VOLUME = "volume";
 
 const int PICO_MEM_SIZE = 2500000;
+// Memory for a system whose lingware is used in place rather than copied
+// into it: the working memory of the engine, with some headroom.
+const int PICO_SHARED_LINGWARE_MEM_SIZE = 1250000;
+
+// The largest analysis kept in the analysis cache.  An analysis takes
+// about a byte per character of text, so this is plenty for a long
+// paragraph.
+const int kMaxAnalysisSize = 16384;
+
+// Prefix of the names of the SSML marks added by AddWordMarkers; the rest
+// of the name is the byte offset of the word.
+const char WORD_MARKER_PREFIX = 'w';
 const pico_Char * PICO_VOICE_NAME =
     reinterpret_cast<const pico_Char *>("PicoVoice");
 
-// Unloads the Pico engine and any loaded Pico resources, but does not
-// shut down.
+// Unloads all the voices in the pool and frees their memory.
 void PicoTtsEngine::CleanResources(void) {
-  if (engine_) {
-    pico_disposeEngine(system_, &engine_);
-    pico_releaseVoiceDefinition(system_, PICO_VOICE_NAME);
-    engine_ = NULL;
-  }
-  if (ta_resource_) {
-    pico_unloadResource(system_, &ta_resource_);
-    ta_resource_ = NULL;
+  for (size_t i = 0; i < voice_pool_.size(); i++) {
+    UnloadVoice(voice_pool_[i]);
+    free(voice_pool_[i]->mem_area);
+    delete voice_pool_[i];
   }
-  if (sg_resource_) {
-    pico_unloadResource(system_, &sg_resource_);
-    sg_resource_ = NULL;
+  voice_pool_.clear();
+
+  // No voice uses the lingware images any more.
+  map<string, PicoLingwareImage>::iterator iter;
+  for (iter = lingware_images_.begin(); iter != lingware_images_.end();
+       ++iter) {
+    if (iter->second.data)
+      picopal_release_file_image(iter->second.data, iter->second.size);
   }
+  lingware_images_.clear();
 
+  current_slot_ = NULL;
+  system_ = NULL;
+  engine_ = NULL;
   current_voice_index_ = -1;
+
+  // The voices may be different when they're loaded again.
+  TrimAnalyses(0);
 }
 
-// Initializes the engine for the specified voice.
-tts_result PicoTtsEngine::InitVoice(int voice_index) {
-  if (voice_index < 0 || voice_index >= GetVoiceCount()) {
-    LOG(INFO) << "Voice index out of range: " << voice_index;
-    return TTS_FAILURE;
-  }
+// Initializes a Pico system in the memory of |slot| and creates an engine
+// for the specified voice.  On failure the slot may be partially loaded;
+// DeleteSlot cleans it up.
+tts_result PicoTtsEngine::LoadVoice(int voice_index, PicoVoiceSlot *slot) {
   const PicoTtsVoice * voice = &voices_[voice_index];
 
   pico_Char ta_resource_name[PICO_MAX_RESOURCE_NAME_SIZE];
@@ -62,43 +83,140 @@ tts_result PicoTtsEngine::InitVoice(int voice_index) {
 
   string tafile = base_path_ + voice->ta_lingware;
   string sgfile = base_path_ + voice->sg_lingware;
-  const pico_Char *ta_filename =
-      reinterpret_cast<const pico_Char *>(tafile.c_str());
-  const pico_Char *sg_filename =
-      reinterpret_cast<const pico_Char *>(sgfile.c_str());
-
-  FAILERR(pico_loadResource(system_, ta_filename, &ta_resource_));
-  FAILERR(pico_loadResource(system_, sg_filename, &sg_resource_));
-  FAILERR(pico_getResourceName(system_, ta_resource_,
+
+  slot->voice_index = voice_index;
+  FAILERR(pico_initialize(slot->mem_area, slot->mem_size, &slot->system));
+  FAILERR(LoadLingware(slot->system, tafile, &slot->ta_resource));
+  FAILERR(LoadLingware(slot->system, sgfile, &slot->sg_resource));
+  FAILERR(pico_getResourceName(slot->system, slot->ta_resource,
       reinterpret_cast<char *>(ta_resource_name)));
-  FAILERR(pico_getResourceName(system_, sg_resource_,
+  FAILERR(pico_getResourceName(slot->system, slot->sg_resource,
       reinterpret_cast<char *>(sg_resource_name)));
-  FAILERR(pico_createVoiceDefinition(system_, PICO_VOICE_NAME));
+  FAILERR(pico_createVoiceDefinition(slot->system, PICO_VOICE_NAME));
   FAILERR(pico_addResourceToVoiceDefinition(
-      system_, PICO_VOICE_NAME, ta_resource_name));
+      slot->system, PICO_VOICE_NAME, ta_resource_name));
   FAILERR(pico_addResourceToVoiceDefinition(
-      system_, PICO_VOICE_NAME, sg_resource_name));
-  pico_newEngine(system_, PICO_VOICE_NAME, &engine_);
-  current_voice_index_ = voice_index;
+      slot->system, PICO_VOICE_NAME, sg_resource_name));
+  FAILERR(pico_newEngine(slot->system, PICO_VOICE_NAME, &slot->engine));
+
+  return TTS_SUCCESS;
+}
 
+// Loads a lingware file into |system|.  If the platform can provide the
+// file in memory, such as when it's embedded in the executable, Pico uses
+// that single copy for every voice instead of copying the file into the
+// memory area of each system.
+tts_result PicoTtsEngine::LoadLingware(pico_System system,
+                                       const string& filename,
+                                       pico_Resource *resource) {
+  const PicoLingwareImage& image = GetLingwareImage(filename);
+  if (image.data) {
+    FAILERR(pico_loadResourceFromMemory(
+        system, image.data, image.size, resource));
+  } else {
+    FAILERR(pico_loadResource(
+        system, reinterpret_cast<const pico_Char *>(filename.c_str()),
+        resource));
+  }
   return TTS_SUCCESS;
 }
 
+// Returns the contents of a lingware file if the platform provides it in
+// memory, or an image with NULL data if the file must be read.
+const PicoLingwareImage& PicoTtsEngine::GetLingwareImage(
+    const string& filename) {
+  map<string, PicoLingwareImage>::iterator iter =
+      lingware_images_.find(filename);
+  if (iter == lingware_images_.end()) {
+    PicoLingwareImage image;
+    if (!picopal_get_file_image(
+            reinterpret_cast<picopal_char *>(
+                const_cast<char *>(filename.c_str())),
+            &image.data, &image.size)) {
+      image.data = NULL;
+      image.size = 0;
+    }
+    iter = lingware_images_.insert(make_pair(filename, image)).first;
+  }
+  return iter->second;
+}
+
+// Returns the size of the memory area needed by the system of a voice.
+int PicoTtsEngine::GetVoiceMemorySize(int voice_index) {
+  const PicoTtsVoice * voice = &voices_[voice_index];
+  if (GetLingwareImage(base_path_ + voice->ta_lingware).data &&
+      GetLingwareImage(base_path_ + voice->sg_lingware).data) {
+    return PICO_SHARED_LINGWARE_MEM_SIZE;
+  }
+  return PICO_MEM_SIZE;
+}
+
+// Unloads the engine, resources and system of |slot|.
+void PicoTtsEngine::UnloadVoice(PicoVoiceSlot *slot) {
+  if (!slot->system)
+    return;
+  if (slot->engine) {
+    pico_disposeEngine(slot->system, &slot->engine);
+    slot->engine = NULL;
+  }
+  pico_releaseVoiceDefinition(slot->system, PICO_VOICE_NAME);
+  if (slot->ta_resource) {
+    pico_unloadResource(slot->system, &slot->ta_resource);
+    slot->ta_resource = NULL;
+  }
+  if (slot->sg_resource) {
+    pico_unloadResource(slot->system, &slot->sg_resource);
+    slot->sg_resource = NULL;
+  }
+  pico_terminate(&slot->system);
+  slot->system = NULL;
+}
+
+// Unloads |slot|, removes it from the pool and frees its memory.
+void PicoTtsEngine::DeleteSlot(PicoVoiceSlot *slot) {
+  if (slot == current_slot_) {
+    current_slot_ = NULL;
+    system_ = NULL;
+    engine_ = NULL;
+    current_voice_index_ = -1;
+  }
+  UnloadVoice(slot);
+  for (size_t i = 0; i < voice_pool_.size(); i++) {
+    if (voice_pool_[i] == slot) {
+      voice_pool_.erase(voice_pool_.begin() + i);
+      break;
+    }
+  }
+  free(slot->mem_area);
+  delete slot;
+}
+
+// Returns the least recently used voice other than the current one, or
+// NULL if the current voice is the only one loaded.
+PicoVoiceSlot *PicoTtsEngine::LeastRecentlyUsedSlot() {
+  PicoVoiceSlot *lru = NULL;
+  for (size_t i = 0; i < voice_pool_.size(); i++) {
+    PicoVoiceSlot *slot = voice_pool_[i];
+    if (slot != current_slot_ && (!lru || slot->last_used < lru->last_used))
+      lru = slot;
+  }
+  return lru;
+}
+
+int PicoTtsEngine::GetVoicePoolSize() {
+  int size = 0;
+  for (size_t i = 0; i < voice_pool_.size(); i++)
+    size += voice_pool_[i]->mem_size;
+  return size;
+}
+
 // Initialize TTS engine.
 tts_result PicoTtsEngine::Init() {
   LOG(INFO) << "Start.";
   LoadVoices(base_path_ + "tts_support.xml");
-  mem_area_ = malloc(PICO_MEM_SIZE);
-  if (!mem_area_) {
-    LOG(ERROR) << "Failed to allocate memory for Pico system";
-    return TTS_FAILURE;
-  }
-  memset(mem_area_, 0, PICO_MEM_SIZE);
 
-  FAILERR(pico_initialize(mem_area_, PICO_MEM_SIZE, &system_));
   // Set the first language in the data file as the default.
-
-  FAILERR(InitVoice(0));
+  FAILERR(SetVoice(0));
 
   LOG(INFO) << "Init done.";
   return TTS_SUCCESS;
@@ -107,20 +225,14 @@ tts_result PicoTtsEngine::Init() {
 // Shuts down the TTS engine, cleans up resources.
 tts_result PicoTtsEngine::Shutdown() {
   CleanResources();
-  if (system_) {
-    pico_terminate(&system_);
-    system_ = NULL;
-  }
-  if (mem_area_) {
-    free(mem_area_);
-    mem_area_ = NULL;
-  }
   return TTS_SUCCESS;
 }
 
 tts_result PicoTtsEngine::Stop() {
-  // TODO(fergus): use PICO_RESET_SOFT here instead?
-  pico_resetEngine(engine_, PICO_RESET_FULL);
+  // A soft reset only flushes the data in the processing units, which is
+  // all that's needed to abandon an utterance.  PICO_RESET_FULL is for
+  // recovering from engine errors (see RepairEngine).
+  pico_resetEngine(engine_, PICO_RESET_SOFT);
   return TTS_SUCCESS;
 }
 
@@ -137,11 +249,110 @@ const TtsVoice * PicoTtsEngine::GetVoiceInfo(int voice_index) {
 }
 
 tts_result PicoTtsEngine::SetVoice(int voice_index) {
-  if (current_voice_index_ != voice_index) {
-    CleanResources();
-    return InitVoice(voice_index);
-  } else {
+  if (current_voice_index_ == voice_index)
     return TTS_SUCCESS;
+  if (voice_index < 0 || voice_index >= GetVoiceCount()) {
+    LOG(INFO) << "Voice index out of range: " << voice_index;
+    return TTS_FAILURE;
+  }
+
+  PicoVoiceSlot *slot = NULL;
+  for (size_t i = 0; i < voice_pool_.size(); i++) {
+    if (voice_pool_[i]->voice_index == voice_index) {
+      slot = voice_pool_[i];
+      break;
+    }
+  }
+
+  if (!slot) {
+    // Unload the least recently used voices until the new one fits in the
+    // budget, and the current voice too if that's not enough.
+    int mem_size = GetVoiceMemorySize(voice_index);
+    while (!voice_pool_.empty() &&
+           GetVoicePoolSize() + mem_size > voice_pool_budget_) {
+      PicoVoiceSlot *lru = LeastRecentlyUsedSlot();
+      DeleteSlot(lru ? lru : current_slot_);
+    }
+
+    void *mem_area = malloc(mem_size);
+    if (!mem_area) {
+      LOG(ERROR) << "Failed to allocate memory for Pico system";
+      return TTS_FAILURE;
+    }
+    memset(mem_area, 0, mem_size);
+    slot = new PicoVoiceSlot();
+    slot->mem_area = mem_area;
+    slot->mem_size = mem_size;
+    voice_pool_.push_back(slot);
+    if (LoadVoice(voice_index, slot) != TTS_SUCCESS) {
+      LOG(ERROR) << "Failed to load voice " << voice_index;
+      DeleteSlot(slot);
+      return TTS_FAILURE;
+    }
+  }
+
+  slot->last_used = ++voice_use_count_;
+  current_slot_ = slot;
+  system_ = slot->system;
+  engine_ = slot->engine;
+  current_voice_index_ = voice_index;
+  return TTS_SUCCESS;
+}
+
+void PicoTtsEngine::SetVoicePoolBudget(int bytes) {
+  voice_pool_budget_ = bytes;
+
+  // Unload the voices that no longer fit, keeping the current one.
+  PicoVoiceSlot *lru;
+  while (GetVoicePoolSize() > voice_pool_budget_ &&
+         (lru = LeastRecentlyUsedSlot()) != NULL) {
+    DeleteSlot(lru);
+  }
+}
+
+void PicoTtsEngine::SetAnalysisCacheSize(int bytes) {
+  analysis_cache_budget_ = bytes > 0 ? bytes : 0;
+  TrimAnalyses(analysis_cache_budget_);
+}
+
+// Returns the analysis with |key|, marked as the most recently used, or
+// NULL if there's none.
+const vector<uint8_t> *PicoTtsEngine::FindAnalysis(const string& key) {
+  map<string, list<PicoAnalysis>::iterator>::iterator iter =
+      analysis_index_.find(key);
+  if (iter == analysis_index_.end())
+    return NULL;
+  analyses_.splice(analyses_.begin(), analyses_, iter->second);
+  return &iter->second->items;
+}
+
+// Keeps |size| bytes of |items| as the analysis with |key|, discarding the
+// least recently used analyses to make room.  The key, which holds the
+// text, counts towards the budget too.
+void PicoTtsEngine::AddAnalysis(const string& key,
+                                const uint8_t *items,
+                                int size) {
+  int entry_size = key.size() + size;
+  if (size == 0 || entry_size > analysis_cache_budget_ ||
+      analysis_index_.count(key) > 0) {
+    return;
+  }
+  TrimAnalyses(analysis_cache_budget_ - entry_size);
+  analyses_.push_front(PicoAnalysis());
+  analyses_.front().key = key;
+  analyses_.front().items.assign(items, items + size);
+  analysis_index_[key] = analyses_.begin();
+  analysis_cache_size_ += entry_size;
+}
+
+// Discards the least recently used analyses until they take at most
+// |bytes|.
+void PicoTtsEngine::TrimAnalyses(int bytes) {
+  while (analysis_cache_size_ > bytes && !analyses_.empty()) {
+    PicoAnalysis& oldest = analyses_.back();
+    analysis_cache_size_ -= oldest.key.size() + oldest.items.size();
+    analysis_index_.erase(oldest.key);
+    analyses_.pop_back();
   }
 }
 
@@ -149,67 +360,75 @@ void PicoTtsEngine::SetReceiver(TtsDataReceiver* receiver) {
   receiver_ = receiver;
 }
 
-// Sets the property for the engine.
-tts_result PicoTtsEngine::SetProperty(const char *property,
-                                      const char *value) {
-  if (properties_.count(property) > 0) {
-    properties_[property] = value;
-    return TTS_SUCCESS;
-  } else {
-    return TTS_PROPERTY_UNSUPPORTED;
-  }
+tts_result PicoTtsEngine::SetProgressMarkers(bool enabled) {
+  progress_markers_ = enabled;
+  return TTS_SUCCESS;
+}
+
+// Returns the level of |property|, or NULL if it isn't supported.
+int *PicoTtsEngine::GetPropertyLevel(const char *property) {
+  if (strcmp(property, PROP_RATE) == 0)
+    return &rate_level_;
+  if (strcmp(property, PROP_PITCH) == 0)
+    return &pitch_level_;
+  if (strcmp(property, PROP_VOLUME) == 0)
+    return &volume_level_;
+  return NULL;
 }
 
-// Converts the float to an int, DISCARDING THE FRACTIONAL PART, and then
-// sets the property to the string for that integer value (in decimal).
+// Sets the property for the engine, DISCARDING THE FRACTIONAL PART of the
+// value.
 tts_result PicoTtsEngine::SetProperty(const char *property,
-                                      float pico_value) {
-  string str;
-  IntToString(static_cast<int>(pico_value), &str);
-  SetProperty(property, str.c_str());
+                                      const char *value) {
+  int *level = GetPropertyLevel(property);
+  if (level == NULL)
+    return TTS_PROPERTY_UNSUPPORTED;
+  *level = atoi(value);
   return TTS_SUCCESS;
 }
 
-// Checks that parameter value is in the range [0.0, 1.0],
-// and if so, scales it to the range [min, max] and then calls SetProperty().
-tts_result PicoTtsEngine::SetParameter(const char *property, int min, int max,
+// Checks that parameter value is in the range [0.0, 1.0], and if so,
+// scales it to the range [min, max] and sets |level| to it, DISCARDING THE
+// FRACTIONAL PART.
+tts_result PicoTtsEngine::SetParameter(int *level, int min, int max,
                                        float value) {
   if (!(value >= 0 && value <= 1)) {  // True for Nan, Inf, -Inf.
     return TTS_VALUE_INVALID;
   }
-  float pico_value = min + value * (max - min);
-  return SetProperty(property, pico_value);
+  *level = static_cast<int>(min + value * (max - min));
+  return TTS_SUCCESS;
 }
 
 tts_result PicoTtsEngine::SetRate(float rate) {
-  return SetParameter(PROP_RATE, PICO_MIN_RATE, PICO_MAX_RATE, rate);
+  return SetParameter(&rate_level_, PICO_MIN_RATE, PICO_MAX_RATE, rate);
 }
 
 tts_result PicoTtsEngine::SetPitch(float pitch) {
-  return SetParameter(PROP_PITCH, PICO_MIN_PITCH, PICO_MAX_PITCH, pitch);
+  return SetParameter(&pitch_level_, PICO_MIN_PITCH, PICO_MAX_PITCH, pitch);
 }
 
 tts_result PicoTtsEngine::SetVolume(float volume) {
-  return SetParameter(PROP_VOLUME, PICO_MIN_VOL, PICO_MAX_VOL, volume);
+  return SetParameter(&volume_level_, PICO_MIN_VOL, PICO_MAX_VOL, volume);
 }
 
 tts_result PicoTtsEngine::RestoreDefaults() {
-  SetProperty(PROP_RATE, PICO_DEF_RATE);
-  SetProperty(PROP_PITCH, PICO_DEF_PITCH);
-  SetProperty(PROP_VOLUME, PICO_DEF_VOL);
+  rate_level_ = PICO_DEF_RATE;
+  pitch_level_ = PICO_DEF_PITCH;
+  volume_level_ = PICO_DEF_VOL;
   return TTS_SUCCESS;
 }
 
+// The value is valid until the next call.
 tts_result PicoTtsEngine::GetProperty(const char *property,
     const char **value) {
-  map<string, string>::const_iterator iter = properties_.find(property);
-  if (iter != properties_.end()) {
-    if (value != NULL) {
-      (*value) = iter->second.c_str();
-    }
-    return TTS_SUCCESS;
+  int *level = GetPropertyLevel(property);
+  if (level == NULL)
+    return TTS_PROPERTY_UNSUPPORTED;
+  if (value != NULL) {
+    IntToString(*level, &property_value_);
+    (*value) = property_value_.c_str();
   }
-  return TTS_PROPERTY_UNSUPPORTED;
+  return TTS_SUCCESS;
 }
 
 int PicoTtsEngine::GetSampleRate() {
@@ -224,37 +443,90 @@ tts_result PicoTtsEngine::SynthesizeText(const char* text,
     *out_total_samples = 0;
   }
 
-  string synth_text = "";
-  AddPropertyMarkup(text, &synth_text);
+  if (ApplyProsody() != TTS_SUCCESS)
+    return TTS_FAILURE;
+
+  // The text is passed to the engine as is, unless it needs word markers.
+  string marked_text;
+  const char *synth_text = text;
+  sentence_start_pending_ = false;
+  if (progress_markers_) {
+    AddWordMarkers(text, &marked_text);
+    synth_text = marked_text.c_str();
+  }
+
+  // If the text was analyzed recently, synthesize from the result, which
+  // doesn't depend on the prosody.  Otherwise record the analysis.
+  string analysis_key;
+  const vector<uint8_t> *analysis = NULL;
+  bool recording = false;
+  if (analysis_cache_budget_ > 0) {
+    std::ostringstream key;
+    key << current_voice_index_ << ':' << synth_text;
+    analysis_key = key.str();
+    analysis = FindAnalysis(analysis_key);
+    if (analysis == NULL) {
+      recorded_items_.resize(std::min(analysis_cache_budget_,
+                                      kMaxAnalysisSize));
+      recording = (PICO_OK == pico_startItemRecording(
+          engine_, &recorded_items_[0], recorded_items_.size()));
+    }
+  }
 
-  int text_pos = 0;
-  const pico_Char* text_ptr =
-      reinterpret_cast<const pico_Char*>(synth_text.c_str());
-  int text_buffer_len = synth_text.size() + 1;
-  while (text_pos < text_buffer_len) {
-    pico_Int16 text_bytes_consumed = 0;
-    if (PICO_OK != pico_putTextUtf8(
-            engine_, text_ptr, text_buffer_len - text_pos,
-            &text_bytes_consumed)) {
+  tts_result result = TTS_SUCCESS;
+  bool halted = false;
+  if (analysis != NULL) {
+    if (PICO_OK != pico_putItems(engine_, &(*analysis)[0], analysis->size())) {
       RepairEngine();
       return TTS_FAILURE;
     }
+    result = GetAudioFromTts(
+        audio_buffer, audio_buffer_size, out_total_samples, &halted);
+  } else {
+    int text_pos = 0;
+    const pico_Char* text_ptr = reinterpret_cast<const pico_Char*>(synth_text);
+    int text_buffer_len = strlen(synth_text) + 1;
+    while (text_pos < text_buffer_len) {
+      pico_Int16 text_bytes_consumed = 0;
+      if (PICO_OK != pico_putTextUtf8(
+              engine_, text_ptr, text_buffer_len - text_pos,
+              &text_bytes_consumed)) {
+        RepairEngine();
+        return TTS_FAILURE;
+      }
+
+      int out_samples;
+      result = GetAudioFromTts(
+          audio_buffer, audio_buffer_size, &out_samples, &halted);
+      if (out_total_samples != NULL) {
+        *out_total_samples += out_samples;
+      }
 
-    int out_samples;
-    tts_result result = GetAudioFromTts(
-        audio_buffer, audio_buffer_size, &out_samples);
-    if (out_total_samples != NULL) {
-      *out_total_samples += out_samples;
+      if (result != TTS_SUCCESS || halted) {
+        // If halted, the receiver doesn't want any more audio, so don't
+        // make the engine analyze the rest of the text.  The caller calls
+        // Stop to discard what's left in the engine.
+        break;
+      }
+
+      text_pos += text_bytes_consumed;
+      text_ptr += text_bytes_consumed;
     }
+  }
 
-    if (result != TTS_SUCCESS) {
-      RepairEngine();
-      receiver_->Done();
-      return result;
+  if (recording) {
+    // Only keep the analysis of the whole text.
+    pico_Uint32 recorded_size = 0;
+    if (PICO_OK == pico_stopItemRecording(engine_, &recorded_size) &&
+        result == TTS_SUCCESS && !halted) {
+      AddAnalysis(analysis_key, &recorded_items_[0], recorded_size);
     }
+  }
 
-    text_pos += text_bytes_consumed;
-    text_ptr += text_bytes_consumed;
+  if (result != TTS_SUCCESS) {
+    RepairEngine();
+    receiver_->Done();
+    return result;
   }
 
   // Tell the destination receiver that we're done.
@@ -271,49 +543,90 @@ tts_result PicoTtsEngine::SynthesizeText(const char* text,
 void PicoTtsEngine::RepairEngine() {
   pico_disposeEngine(system_, &engine_);
   pico_newEngine(system_, PICO_VOICE_NAME, &engine_);
+  current_slot_->engine = engine_;
 }
 
-// This method adds the SSML tags for the supported properties if their
-// values are different from the default values.
-void PicoTtsEngine::AddPropertyMarkup(const char *text, string *synth_text) {
-  int rate_level_ = floor(atof(properties_[PROP_RATE].c_str()));
-  int pitch_level_ = floor(atof(properties_[PROP_PITCH].c_str()));
-  int volume_level_ = floor(atof(properties_[PROP_VOLUME].c_str()));
+// Passes the speed, pitch and volume to the engine, which applies them to
+// the text put from then on.  Values outside the engine's range are
+// clamped.
+tts_result PicoTtsEngine::ApplyProsody() {
+  int rate_level = rate_level_;
+  int pitch_level = pitch_level_;
+  int volume_level = volume_level_;
 
-  if (rate_level_ < PICO_MIN_RATE || rate_level_ > PICO_MAX_RATE) {
+  if (rate_level < PICO_MIN_RATE || rate_level > PICO_MAX_RATE) {
     LOG(WARNING) << "Rate is outside the allowed range.";
+    rate_level = std::max(PICO_MIN_RATE, std::min(rate_level, PICO_MAX_RATE));
   }
-  if (pitch_level_ < PICO_MIN_PITCH || pitch_level_ > PICO_MAX_PITCH) {
+  if (pitch_level < PICO_MIN_PITCH || pitch_level > PICO_MAX_PITCH) {
     LOG(WARNING) << "Pitch is outside the allowed range.";
+    pitch_level = std::max(PICO_MIN_PITCH,
+                           std::min(pitch_level, PICO_MAX_PITCH));
   }
-  if (volume_level_ < PICO_MIN_VOL || volume_level_ > PICO_MAX_VOL) {
+  if (volume_level < PICO_MIN_VOL || volume_level > PICO_MAX_VOL) {
     LOG(WARNING) << "Volume is outside the allowed range.";
+    volume_level = std::max(PICO_MIN_VOL, std::min(volume_level, PICO_MAX_VOL));
   }
 
-  *synth_text = "";
+  FAILERR(pico_setProsody(engine_, rate_level, pitch_level, volume_level));
+  return TTS_SUCCESS;
+}
 
-  // Append opening tags
-  if (rate_level_ != PICO_DEF_RATE) {
-    *synth_text += "<speed level='" + properties_[PROP_RATE] + "'>";
-  }
-  if (pitch_level_ != PICO_DEF_PITCH) {
-    *synth_text += "<pitch level='" + properties_[PROP_PITCH] + "'>";
-  }
-  if (volume_level_ != PICO_DEF_VOL) {
-    *synth_text += "<volume level='" + properties_[PROP_VOLUME] + "'>";
+// This method adds an SSML mark before every word of the text that isn't
+// inside a tag, named after the byte offset of the word in the text.
+// Pico passes the marks through its whole pipeline and returns them
+// from pico_getData right before the audio of the word.  Tokens without
+// any letters or digits, such as a lone dash, aren't marked.
+void PicoTtsEngine::AddWordMarkers(const char *text, string *marked_text) {
+  *marked_text = "";
+  bool in_tag = false;
+  bool in_word = false;
+  for (const char *p = text; *p; p++) {
+    unsigned char c = *p;
+    if (in_tag) {
+      in_tag = (c != '>');
+    } else if (c == '<') {
+      in_tag = true;
+      in_word = false;
+    } else if (isspace(c)) {
+      in_word = false;
+    } else if (!in_word) {
+      in_word = true;
+      for (const char *q = p;
+           *q && *q != '<' && !isspace(static_cast<unsigned char>(*q));
+           q++) {
+        if (isalnum(static_cast<unsigned char>(*q)) || (*q & 0x80)) {
+          char mark[32];
+          snprintf(mark, sizeof(mark), "<mark name='%c%d'/>",
+                   WORD_MARKER_PREFIX, static_cast<int>(p - text));
+          *marked_text += mark;
+          break;
+        }
+      }
+    }
+    *marked_text += c;
   }
-  // Append text
-  *synth_text += text;
-  // Append closing tags in the reverse order
-  if (volume_level_ != PICO_DEF_VOL) {
-    *synth_text += "</volume>";
+}
+
+// Handles a mark returned by pico_getData: if it's one of ours, tells
+// the receiver that a word, and possibly a sentence, starts.
+tts_callback_status PicoTtsEngine::ReceiveWordMarker(const char *name,
+                                                     int name_size) {
+  if (name_size < 2 || name[0] != WORD_MARKER_PREFIX) {
+    return TTS_CALLBACK_CONTINUE;
   }
-  if (pitch_level_ != PICO_DEF_PITCH) {
-    *synth_text += "</pitch>";
+  int text_offset = atoi(string(name + 1, name_size - 1).c_str());
+
+  tts_callback_status callback_status = TTS_CALLBACK_CONTINUE;
+  if (sentence_start_pending_) {
+    sentence_start_pending_ = false;
+    callback_status =
+        receiver_->ReceiveMarker(TTS_MARKER_SENTENCE, text_offset);
   }
-  if (rate_level_ != PICO_DEF_RATE) {
-    *synth_text += "</speed>";
+  if (callback_status == TTS_CALLBACK_CONTINUE) {
+    callback_status = receiver_->ReceiveMarker(TTS_MARKER_WORD, text_offset);
   }
+  return callback_status;
 }
 
 // max_iterations_without_apparent_progress is a hack to prevent infinite loops.
@@ -325,24 +638,39 @@ int PicoTtsEngine::max_iterations_without_apparent_progress = 10000;
 
 tts_result PicoTtsEngine::GetAudioFromTts(int16_t* audio_buffer,
                                           int audio_buffer_size,
-                                          int* out_total_samples) {
+                                          int* out_total_samples,
+                                          bool* out_halted) {
   int total_samples_output = 0;
   int status;
   tts_callback_status callback_status = TTS_CALLBACK_CONTINUE;
   pico_Int16 data_type = PICO_DATA_PCM_16BIT;
   uint32_t sample_rate = voices_[current_voice_index_].sample_rate;
   int iterations_without_apparent_progress = 0;
+  bool unsupported_data = false;
   while (1) {
-    pico_Int16 bytes_received = 0;
+    pico_Uint32 bytes_received = 0;
     data_type = 0;
     int8_t* buffer_ptr = reinterpret_cast<int8_t *>(audio_buffer);
-    pico_Int16 buffer_size_bytes = audio_buffer_size * sizeof(int16_t);
+    pico_Uint32 buffer_size_bytes = audio_buffer_size * sizeof(int16_t);
 
-    status = pico_getData(engine_, buffer_ptr, buffer_size_bytes,
+    // Fill the whole buffer per call where possible, so the receiver gets
+    // a few large blocks of audio rather than one per engine step.
+    status = pico_getDataBulk(engine_, buffer_ptr, buffer_size_bytes,
         &bytes_received, &data_type);
 
-    if (status != PICO_STEP_ERROR && bytes_received > 0) {
+    if (status != PICO_STEP_ERROR && data_type == PICO_DATA_SENTENCE_START) {
+      sentence_start_pending_ = true;
+    } else if (status != PICO_STEP_ERROR && data_type == PICO_DATA_MARKER) {
+      if (receiver_) {
+        callback_status = ReceiveWordMarker(
+            reinterpret_cast<const char *>(buffer_ptr), bytes_received);
+        if (callback_status != TTS_CALLBACK_CONTINUE) {
+          break;
+        }
+      }
+    } else if (status != PICO_STEP_ERROR && bytes_received > 0) {
       if (data_type != PICO_DATA_PCM_16BIT) {
+        unsupported_data = true;
         break;
       }
 
@@ -377,10 +705,13 @@ tts_result PicoTtsEngine::GetAudioFromTts(int16_t* audio_buffer,
   if (out_total_samples != NULL) {
     *out_total_samples = total_samples_output;
   }
+  if (out_halted != NULL) {
+    *out_halted = (callback_status == TTS_CALLBACK_HALT);
+  }
 
   if (status == PICO_STEP_ERROR ||
       callback_status == TTS_CALLBACK_ERROR ||
-      data_type != PICO_DATA_PCM_16BIT ||
+      unsupported_data ||
       iterations_without_apparent_progress >
       max_iterations_without_apparent_progress) {
     return TTS_FAILURE;
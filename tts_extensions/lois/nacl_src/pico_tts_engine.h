@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <list>
 #include <map>
 #include <string>
 #include <vector>
@@ -27,6 +28,7 @@ using tts_service::TtsEngine;
 using tts_service::TtsDataReceiver;
 using tts_service::tts_result;
 
+using std::list;
 using std::map;
 using std::endl;
 using std::ostream;
@@ -71,6 +73,34 @@ struct PicoTtsVoice : public TtsVoice {
   }
 };
 
+// The contents of a lingware file, used in place by every voice that
+// loads it.
+struct PicoLingwareImage {
+  const unsigned char *data;
+  unsigned int size;
+};
+
+// A voice kept loaded in the voice pool.  Pico allows only one engine per
+// system, so every resident voice has its own system and memory arena.
+struct PicoVoiceSlot {
+  int voice_index;
+  void *mem_area;
+  int mem_size;
+  pico_System system;
+  pico_Engine engine;
+  pico_Resource ta_resource;
+  pico_Resource sg_resource;
+  // The engine's voice use count when this voice was last selected.
+  unsigned int last_used;
+};
+
+// The result of the text analysis of a recently synthesized text: the
+// items that Pico's front end passed on to the speech generation.
+struct PicoAnalysis {
+  string key;
+  vector<uint8_t> items;
+};
+
 // Thread-safe.  Unfortunately Pico is not 64-bit clean.
 class PicoTtsEngine : public TtsEngine {
  public:
@@ -79,12 +109,20 @@ class PicoTtsEngine : public TtsEngine {
 
   explicit PicoTtsEngine(const string& base_path)
       : base_path_(base_path),
-        mem_area_(NULL),
+        current_voice_index_(-1),
+        rate_level_(PICO_DEF_RATE),
+        pitch_level_(PICO_DEF_PITCH),
+        volume_level_(PICO_DEF_VOL),
+        current_slot_(NULL),
+        voice_pool_budget_(0),
+        voice_use_count_(0),
         system_(NULL),
         engine_(NULL),
-        ta_resource_(NULL),
-        sg_resource_(NULL),
-        receiver_(NULL) {
+        receiver_(NULL),
+        progress_markers_(false),
+        sentence_start_pending_(false),
+        analysis_cache_budget_(0),
+        analysis_cache_size_(0) {
   }
 
   ~PicoTtsEngine() {
@@ -97,8 +135,23 @@ class PicoTtsEngine : public TtsEngine {
   int GetVoiceCount();
   const TtsVoice * GetVoiceInfo(int voice_index);
   tts_result SetVoice(int voice_index);
+  // Sets how much memory may be used by the voices kept loaded, so that
+  // switching back to one of them doesn't reload its lingware.  A voice
+  // takes PICO_MEM_SIZE bytes, or less if its lingware is used in place,
+  // and the current voice is always loaded; when the budget is used up,
+  // the least recently used voices are unloaded to make room.  The
+  // default keeps only the current voice.
+  void SetVoicePoolBudget(int bytes);
+  // Sets how much memory may be used to keep the analysis of recently
+  // synthesized texts, so that synthesizing one of them again with the
+  // same voice, even at a different rate, pitch or volume, skips the text
+  // analysis and goes straight to generating speech.  The least recently
+  // used analyses are discarded when the budget is used up.  By default
+  // nothing is kept.
+  void SetAnalysisCacheSize(int bytes);
   int GetVoiceIndex(TtsVoice *voice_options);
   void SetReceiver(TtsDataReceiver* receiver);
+  tts_result SetProgressMarkers(bool enabled);
   tts_result SetProperty(const char *property, const char *value);
   tts_result SetRate(float rate);
   tts_result SetPitch(float pitch);
@@ -114,29 +167,69 @@ class PicoTtsEngine : public TtsEngine {
  private:
   tts_result LoadVoices(const string& filename);
   void CleanResources();
-  tts_result InitVoice(int voice_index);
+  tts_result LoadVoice(int voice_index, PicoVoiceSlot *slot);
+  tts_result LoadLingware(pico_System system,
+                          const string& filename,
+                          pico_Resource *resource);
+  const PicoLingwareImage& GetLingwareImage(const string& filename);
+  int GetVoiceMemorySize(int voice_index);
+  void UnloadVoice(PicoVoiceSlot *slot);
+  void DeleteSlot(PicoVoiceSlot *slot);
+  PicoVoiceSlot *LeastRecentlyUsedSlot();
+  int GetVoicePoolSize();
   tts_result GetAudioFromTts(int16_t* audio_buffer,
                              int audio_buffer_size,
-                             int* out_total_samples);
-  tts_result SetProperty(const char *property, float value);
-  tts_result SetParameter(const char *property, int min, int max, float value);
-  void AddPropertyMarkup(const char *text, string *synth_text);
+                             int* out_total_samples,
+                             bool* out_halted);
+  int *GetPropertyLevel(const char *property);
+  tts_result SetParameter(int *level, int min, int max, float value);
+  tts_result ApplyProsody();
+  void AddWordMarkers(const char *text, string *marked_text);
+  tts_callback_status ReceiveWordMarker(const char *name, int name_size);
   void RepairEngine();
+  const vector<uint8_t> *FindAnalysis(const string& key);
+  void AddAnalysis(const string& key, const uint8_t *items, int size);
+  void TrimAnalyses(int bytes);
 
   string base_path_;
 
   vector<PicoTtsVoice> voices_;
   int current_voice_index_;
 
-  map<string, string> properties_;
+  // The speed, pitch and volume, in the engine's units, which are passed
+  // to it directly rather than as markup around the text.
+  int rate_level_;
+  int pitch_level_;
+  int volume_level_;
+  // The value last returned by GetProperty.
+  string property_value_;
+
+  // Lingware files that the platform provides in memory, by file name.
+  map<string, PicoLingwareImage> lingware_images_;
 
-  void *          mem_area_;
+  vector<PicoVoiceSlot*> voice_pool_;
+  PicoVoiceSlot * current_slot_;
+  int             voice_pool_budget_;
+  unsigned int    voice_use_count_;
+
+  // The system and engine of |current_slot_|.
   pico_System     system_;
   pico_Engine     engine_;
-  pico_Resource   ta_resource_;
-  pico_Resource   sg_resource_;
 
   TtsDataReceiver *receiver_;
+
+  bool progress_markers_;
+  // True after Pico reported the start of a sentence, until the marker
+  // of its first word arrives.
+  bool sentence_start_pending_;
+
+  // Most recently used first.
+  list<PicoAnalysis> analyses_;
+  map<string, list<PicoAnalysis>::iterator> analysis_index_;
+  int analysis_cache_budget_;
+  int analysis_cache_size_;
+  // Where the analysis of the text being synthesized is recorded.
+  vector<uint8_t> recorded_items_;
 };
 
 }  // namespace tts_service
@@ -0,0 +1,216 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "polyphase_resampler.h"
+
+namespace tts_service {
+
+namespace {
+
+// The input frames each output frame is computed from; a multiple of 8
+// for SSE2.
+const int kTapCount = 32;
+
+// The most filter phases, which is the destination rate divided by the
+// greatest common divisor of the rates (441 for 16 kHz to 44.1 kHz).
+const int kMaxPhaseCount = 1024;
+
+// The cutoff, as a fraction of the lower of the two Nyquist frequencies,
+// and the Kaiser window's beta, for about 60 dB of attenuation.
+const double kCutoff = 0.9;
+const double kKaiserBeta = 6.0;
+
+// The coefficients' fractional bits.
+const int kTapBits = 14;
+
+int GreatestCommonDivisor(int a, int b) {
+  while (b != 0) {
+    int remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+  return a;
+}
+
+// The zeroth-order modified Bessel function of the first kind.
+double BesselI0(double x) {
+  double sum = 1;
+  double term = 1;
+  for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// Returns the dot product of kTapCount samples of |input| and |taps|,
+// with kTapBits fractional bits.  Even when every sample is at full scale,
+// the sum can't overflow as long as the absolute values of the taps add
+// up to less than 4, and they add up to less than 1.5.
+int DotProduct(const int16_t* input, const int16_t* taps) {
+#if defined(__SSE2__)
+  __m128i sum4 = _mm_setzero_si128();
+  for (int i = 0; i < kTapCount; i += 8) {
+    __m128i input8 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(input + i));
+    __m128i taps8 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(taps + i));
+    sum4 = _mm_add_epi32(sum4, _mm_madd_epi16(input8, taps8));
+  }
+  sum4 = _mm_add_epi32(sum4,
+                       _mm_shuffle_epi32(sum4, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum4 = _mm_add_epi32(sum4,
+                       _mm_shuffle_epi32(sum4, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum4);
+#else
+  int sum = 0;
+  for (int i = 0; i < kTapCount; i++)
+    sum += input[i] * taps[i];
+  return sum;
+#endif
+}
+
+}  // namespace
+
+PolyphaseResampler::PolyphaseResampler(int source_rate, int dest_rate)
+    : source_rate_(source_rate),
+      dest_rate_(dest_rate),
+      position_(0) {
+  int divisor = GreatestCommonDivisor(source_rate, dest_rate);
+  phase_count_ = dest_rate / divisor;
+  step_ = source_rate / divisor;
+  MakeFilter();
+  taps_ = &own_taps_[0];
+  Reset();
+}
+
+PolyphaseResampler::PolyphaseResampler(
+    const PolyphaseResampler *filter_source)
+    : source_rate_(filter_source->source_rate_),
+      dest_rate_(filter_source->dest_rate_),
+      phase_count_(filter_source->phase_count_),
+      step_(filter_source->step_),
+      taps_(filter_source->taps_),
+      position_(0) {
+  Reset();
+}
+
+PolyphaseResampler::~PolyphaseResampler() {
+}
+
+bool PolyphaseResampler::IsSupported(int source_rate, int dest_rate) {
+  if (source_rate <= 0 || dest_rate <= 0)
+    return false;
+  return dest_rate / GreatestCommonDivisor(source_rate, dest_rate) <=
+      kMaxPhaseCount;
+}
+
+void PolyphaseResampler::MakeFilter() {
+  // Output frame n lies between input frames kTapCount / 2 - 1 and
+  // kTapCount / 2 of the frames its filter covers, phase / phase_count_ of
+  // the way from one to the other, where phase is n * step_ modulo
+  // phase_count_.
+  double cutoff = kCutoff;
+  if (dest_rate_ < source_rate_)
+    cutoff = kCutoff * dest_rate_ / source_rate_;
+  double half_length = kTapCount / 2;
+  double window_scale = 1 / BesselI0(kKaiserBeta);
+  own_taps_.resize(phase_count_ * kTapCount);
+  for (int phase = 0; phase < phase_count_; phase++) {
+    double coefficients[kTapCount];
+    double sum = 0;
+    for (int i = 0; i < kTapCount; i++) {
+      double t = i - (half_length - 1) - phase * 1.0 / phase_count_;
+      double x = M_PI * cutoff * t;
+      double sinc = (x == 0) ? 1 : sin(x) / x;
+      double r = t / half_length;
+      double window = (r * r < 1) ?
+          BesselI0(kKaiserBeta * sqrt(1 - r * r)) * window_scale : 0;
+      coefficients[i] = cutoff * sinc * window;
+      sum += coefficients[i];
+    }
+
+    // Normalize each phase to a gain of exactly 1, with the rounding error
+    // going to the biggest tap, so that there's no ripple at low
+    // frequencies.
+    int16_t* taps = &own_taps_[phase * kTapCount];
+    int total = 0;
+    int biggest = 0;
+    for (int i = 0; i < kTapCount; i++) {
+      taps[i] = static_cast<int16_t>(
+          floor(coefficients[i] / sum * (1 << kTapBits) + 0.5));
+      total += taps[i];
+      if (taps[i] > taps[biggest])
+        biggest = i;
+    }
+    taps[biggest] += (1 << kTapBits) - total;
+  }
+}
+
+void PolyphaseResampler::AddInput(const int16_t* data, int frame_count) {
+  // Drop the frames no longer needed first, so that input_ only ever holds
+  // about one call's worth.
+  int consumed = position_ / phase_count_;
+  if (consumed > 0) {
+    if (consumed > static_cast<int>(input_.size()))
+      consumed = input_.size();
+    input_.erase(input_.begin(), input_.begin() + consumed);
+    position_ -= consumed * phase_count_;
+  }
+  input_.insert(input_.end(), data, data + frame_count);
+}
+
+void PolyphaseResampler::Finish() {
+  input_.insert(input_.end(), kTapCount / 2, 0);
+}
+
+int PolyphaseResampler::GetAvailableFrames() {
+  // Output frames are available as long as their filter starts at or
+  // before input frame input_.size() - kTapCount.
+  int last = (static_cast<int>(input_.size()) - kTapCount + 1) *
+      phase_count_ - 1;
+  if (last < position_)
+    return 0;
+  return (last - position_) / step_ + 1;
+}
+
+void PolyphaseResampler::Read(int16_t* output,
+                              int channel_count,
+                              int frame_count) {
+  const int16_t* input = &input_[0];
+  const int16_t* taps = taps_;
+  int frame = position_ / phase_count_;
+  int phase = position_ % phase_count_;
+  for (int i = 0; i < frame_count; i++) {
+    int value = DotProduct(input + frame, taps + phase * kTapCount);
+    value = (value + (1 << (kTapBits - 1))) >> kTapBits;
+    if (value > 32767)
+      value = 32767;
+    if (value < -32768)
+      value = -32768;
+    for (int c = 0; c < channel_count; c++)
+      *output++ = static_cast<int16_t>(value);
+
+    phase += step_;
+    while (phase >= phase_count_) {
+      phase -= phase_count_;
+      frame++;
+    }
+  }
+  position_ = frame * phase_count_ + phase;
+}
+
+void PolyphaseResampler::Reset() {
+  // Start with silence before the first frame, so that the first output
+  // frame is centered on it.
+  input_.assign(kTapCount / 2 - 1, 0);
+  position_ = 0;
+}
+
+}  // namespace tts_service
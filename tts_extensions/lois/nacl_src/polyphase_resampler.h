@@ -0,0 +1,89 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// A resampler for mono 16-bit audio between two rates with a simple ratio,
+// like the engine's 16 kHz and the audio output's 44.1 kHz (160:441).
+//
+// Each output frame is a dot product of a fixed number of input frames
+// with one of a table of precomputed filter phases, in 16-bit fixed point,
+// so there's no conversion to floating point; the result is rounded,
+// clipped and copied to every output channel in the same pass, straight
+// into the caller's buffer.  This is both faster and simpler to use than
+// the general-purpose Resampler, which TtsService still falls back on for
+// ratios that would need too big a table.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_POLYPHASE_RESAMPLER_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_POLYPHASE_RESAMPLER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+using std::vector;
+
+namespace tts_service {
+
+class PolyphaseResampler {
+ public:
+  PolyphaseResampler(int source_rate, int dest_rate);
+
+  // Shares the filter of |filter_source|, which must outlive this object,
+  // instead of computing a new one.
+  explicit PolyphaseResampler(const PolyphaseResampler *filter_source);
+
+  ~PolyphaseResampler();
+
+  // Returns true if the ratio between the rates is simple enough.
+  static bool IsSupported(int source_rate, int dest_rate);
+
+  // Adds |frame_count| frames of mono input.  Positions are kept in
+  // fractions of a frame, so add long input a block at a time, reading
+  // the output in between.
+  void AddInput(const int16_t* data, int frame_count);
+
+  // Adds silence after the input, so that the output for the end of the
+  // input, which the filter holds back, can be read.
+  void Finish();
+
+  // Returns the number of output frames that can be read.
+  int GetAvailableFrames();
+
+  // Writes |frame_count| output frames, which must be available, to
+  // |output|, copying each sample to all |channel_count| channels.
+  void Read(int16_t* output, int channel_count, int frame_count);
+
+  // Discards the input, to start over.
+  void Reset();
+
+  int source_rate() { return source_rate_; }
+
+  int dest_rate() { return dest_rate_; }
+
+ private:
+  // Fills in own_taps_.
+  void MakeFilter();
+
+  int source_rate_;
+  int dest_rate_;
+
+  // The rates divided by their greatest common divisor: each output frame
+  // is step_ / phase_count_ input frames after the one before.
+  int phase_count_;
+  int step_;
+
+  // phase_count_ sets of kTapCount coefficients, with 14 fractional bits,
+  // in own_taps_ or another resampler's.
+  const int16_t* taps_;
+  vector<int16_t> own_taps_;
+
+  // The input not used up yet, after silence to center the filter on the
+  // first frame.
+  vector<int16_t> input_;
+  // Where the filter for the next output frame starts in input_, in units
+  // of 1 / phase_count_ frames; the remainder is the phase.
+  int position_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_POLYPHASE_RESAMPLER_H_
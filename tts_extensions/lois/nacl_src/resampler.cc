@@ -17,10 +17,34 @@ Resampler::Resampler(TtsDataReceiver *destination,
     : destination_(destination),
       source_rate_(source_rate),
       dest_rate_(dest_rate),
-      buffer_size_(buffer_size) {
-  const int high_quality = 0;
+      buffer_size_(buffer_size),
+      high_quality_(false) {
+  Init(NULL);
+}
+
+Resampler::Resampler(TtsDataReceiver *destination,
+                     int source_rate,
+                     int dest_rate,
+                     int buffer_size,
+                     bool high_quality,
+                     const Resampler *filter_source)
+    : destination_(destination),
+      source_rate_(source_rate),
+      dest_rate_(dest_rate),
+      buffer_size_(buffer_size),
+      high_quality_(high_quality) {
+  Init(filter_source);
+}
+
+void Resampler::Init(const Resampler *filter_source) {
   factor_ = dest_rate_ * 1.0 / source_rate_;
-  resample_handle_ = resample_open(high_quality, factor_, factor_);
+  if (filter_source) {
+    resample_handle_ = resample_open_shared(filter_source->resample_handle_,
+                                            factor_, factor_);
+  } else {
+    resample_handle_ = resample_open(high_quality_ ? 1 : 0,
+                                     factor_, factor_);
+  }
   in_floats_ = new float[buffer_size_];
   out_floats_ = new float[buffer_size_];
   out_int16s_ = new int16_t[buffer_size_];
@@ -33,6 +57,10 @@ Resampler::~Resampler() {
   delete[] out_int16s_;
 }
 
+void Resampler::Reset() {
+  resample_reset(resample_handle_);
+}
+
 tts_callback_status Resampler::Receive(int rate,
                                        int num_channels,
                                        const int16_t* data,
@@ -93,6 +121,11 @@ tts_callback_status Resampler::ProcessBuffer(const int16_t* data,
   return TTS_CALLBACK_CONTINUE;
 }
 
+tts_callback_status Resampler::ReceiveMarker(tts_marker_type type,
+                                             int text_offset) {
+  return destination_->ReceiveMarker(type, text_offset);
+}
+
 tts_callback_status Resampler::Done() {
   int input_index = 0;
   // For final audio padding:
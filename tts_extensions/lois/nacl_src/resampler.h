@@ -26,25 +26,56 @@ class Resampler : public TtsDataReceiver {
             int dest_rate,
             int buffer_size);
 
+  // Like the above, but with a choice of quality, and if |filter_source|
+  // isn't NULL, its filter, which only depends on the quality, is used
+  // instead of computing a new one.  |filter_source| must then have the
+  // same quality and outlive this object.
+  Resampler(TtsDataReceiver *destination,
+            int source_rate,
+            int dest_rate,
+            int buffer_size,
+            bool high_quality,
+            const Resampler *filter_source);
+
   virtual ~Resampler();
 
+  // Discards any audio held back, so that this can be used for a new
+  // stream.
+  void Reset();
+
+  void SetDestination(TtsDataReceiver *destination) {
+    destination_ = destination;
+  }
+
   virtual tts_callback_status Receive(int rate,
                                       int num_channels,
                                       const int16_t* data,
                                       int num_samples);
 
+  // Markers are passed through right away; any audio still held back by
+  // the resampling filter (a few samples) ends up after the marker.
+  virtual tts_callback_status ReceiveMarker(tts_marker_type type,
+                                            int text_offset);
+
   virtual tts_callback_status Done();
 
   int source_rate() { return source_rate_; }
 
   int dest_rate() { return dest_rate_; }
 
+  int buffer_size() { return buffer_size_; }
+
+  bool high_quality() { return high_quality_; }
+
  private:
+  void Init(const Resampler *filter_source);
+
   TtsDataReceiver* destination_;
   int source_rate_;
   int dest_rate_;
   double factor_;
   int buffer_size_;
+  bool high_quality_;
   void* resample_handle_;
   float* in_floats_;
   float* out_floats_;
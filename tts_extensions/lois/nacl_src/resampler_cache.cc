@@ -0,0 +1,96 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include "polyphase_resampler.h"
+#include "resampler.h"
+#include "resampler_cache.h"
+
+namespace tts_service {
+
+ResamplerCache::ResamplerCache(Threading *threading)
+    : mutex_(threading->CreateMutex()) {
+}
+
+ResamplerCache::~ResamplerCache() {
+  // Newest first, so that filters are deleted after everything sharing
+  // them.
+  for (int i = resamplers_.size() - 1; i >= 0; i--)
+    delete resamplers_[i];
+  for (int i = polyphase_resamplers_.size() - 1; i >= 0; i--)
+    delete polyphase_resamplers_[i];
+  delete mutex_;
+}
+
+Resampler *ResamplerCache::GetResampler(TtsDataReceiver *destination,
+                                        int source_rate,
+                                        int dest_rate,
+                                        int buffer_size,
+                                        bool high_quality) {
+  ScopedLock sl(mutex_);
+  for (size_t i = 0; i < free_resamplers_.size(); i++) {
+    Resampler *resampler = free_resamplers_[i];
+    if (resampler->source_rate() == source_rate &&
+        resampler->dest_rate() == dest_rate &&
+        resampler->buffer_size() == buffer_size &&
+        resampler->high_quality() == high_quality) {
+      free_resamplers_.erase(free_resamplers_.begin() + i);
+      resampler->Reset();
+      resampler->SetDestination(destination);
+      return resampler;
+    }
+  }
+
+  // The filter only depends on the quality.
+  const Resampler *filter_source = NULL;
+  for (size_t i = 0; i < resamplers_.size() && !filter_source; i++) {
+    if (resamplers_[i]->high_quality() == high_quality)
+      filter_source = resamplers_[i];
+  }
+  Resampler *resampler = new Resampler(destination,
+                                       source_rate,
+                                       dest_rate,
+                                       buffer_size,
+                                       high_quality,
+                                       filter_source);
+  resamplers_.push_back(resampler);
+  return resampler;
+}
+
+void ResamplerCache::ReleaseResampler(Resampler *resampler) {
+  ScopedLock sl(mutex_);
+  resampler->SetDestination(NULL);
+  free_resamplers_.push_back(resampler);
+}
+
+PolyphaseResampler *ResamplerCache::GetPolyphaseResampler(int source_rate,
+                                                          int dest_rate) {
+  ScopedLock sl(mutex_);
+  for (size_t i = 0; i < free_polyphase_resamplers_.size(); i++) {
+    PolyphaseResampler *resampler = free_polyphase_resamplers_[i];
+    if (resampler->source_rate() == source_rate &&
+        resampler->dest_rate() == dest_rate) {
+      free_polyphase_resamplers_.erase(free_polyphase_resamplers_.begin() + i);
+      resampler->Reset();
+      return resampler;
+    }
+  }
+
+  PolyphaseResampler *resampler = NULL;
+  for (size_t i = 0; i < polyphase_resamplers_.size() && !resampler; i++) {
+    if (polyphase_resamplers_[i]->source_rate() == source_rate &&
+        polyphase_resamplers_[i]->dest_rate() == dest_rate) {
+      resampler = new PolyphaseResampler(polyphase_resamplers_[i]);
+    }
+  }
+  if (!resampler)
+    resampler = new PolyphaseResampler(source_rate, dest_rate);
+  polyphase_resamplers_.push_back(resampler);
+  return resampler;
+}
+
+void ResamplerCache::ReleasePolyphaseResampler(PolyphaseResampler *resampler) {
+  ScopedLock sl(mutex_);
+  free_polyphase_resamplers_.push_back(resampler);
+}
+
+}  // namespace tts_service
@@ -0,0 +1,64 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Keeps resamplers around once they're no longer in use, so that the next
+// utterance or earcon at the same rates gets one that's ready to go
+// instead of setting up a new one, which means computing its filter and
+// allocating its buffers.  Resamplers that are in use at the same time
+// still need separate instances, but those share their filter with the
+// first one of the same kind, read-only, so the filter for each kind is
+// only ever computed once.  All methods are thread-safe.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_RESAMPLER_CACHE_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_RESAMPLER_CACHE_H_
+
+#include <vector>
+
+#include "threading.h"
+#include "tts_receiver.h"
+
+using std::vector;
+
+namespace tts_service {
+
+class PolyphaseResampler;
+class Resampler;
+
+class ResamplerCache {
+ public:
+  explicit ResamplerCache(Threading *threading);
+
+  // Deletes all the resamplers, which must no longer be in use.
+  ~ResamplerCache();
+
+  // Returns a Resampler with the given settings that passes its output to
+  // |destination|, with no audio left from its previous use.  Give it
+  // back with ReleaseResampler instead of deleting it.
+  Resampler *GetResampler(TtsDataReceiver *destination,
+                          int source_rate,
+                          int dest_rate,
+                          int buffer_size,
+                          bool high_quality);
+  void ReleaseResampler(Resampler *resampler);
+
+  // The same for a PolyphaseResampler, which must be supported for the
+  // rates.
+  PolyphaseResampler *GetPolyphaseResampler(int source_rate, int dest_rate);
+  void ReleasePolyphaseResampler(PolyphaseResampler *resampler);
+
+ private:
+  Mutex *mutex_;
+
+  // All the resamplers, in the order they were created, so that the ones
+  // whose filter is shared come before the ones sharing it.
+  vector<Resampler*> resamplers_;
+  vector<PolyphaseResampler*> polyphase_resamplers_;
+
+  // The ones not in use.
+  vector<Resampler*> free_resamplers_;
+  vector<PolyphaseResampler*> free_polyphase_resamplers_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_RESAMPLER_CACHE_H_
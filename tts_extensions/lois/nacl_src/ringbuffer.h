@@ -3,18 +3,23 @@
 //
 // Author: dmazzoni@google.com (Dominic Mazzoni)
 //
-// Templatized, thread-safe RingBuffer.  Acts like a FIFO, but using a
+// Templatized, lock-free RingBuffer.  Acts like a FIFO, but using a
 // fixed-size buffer that wraps around and optimized for operations that
 // read or write many elements at a time.  Commonly used to buffer audio
 // samples that need to be passed from one thread to another.
 //
+// Exactly one thread may write and exactly one thread may read
+// (single-producer/single-consumer).  Neither side ever takes a lock, so
+// it's safe to read from a real-time audio callback.
+//
 // Supports a flag "finished" so the writing thread can notify the reading
 // thread that there's no more data.
 //
 // Each element in the RingBuffer is an audio frame consisting of consecutive
 // samples: for example, in 2-channel audio, each audio frame is two audio
 // samples. Each Read or Write operating must operate on an integer number of
-// frames: it's not allowed to read a partial frame.
+// frames: it's not allowed to read a partial frame.  T must be a POD type
+// because frames are moved with memcpy.
 //
 // The implementation is all contained within this .h file because
 // it's templatized.
@@ -22,17 +27,38 @@
 #ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_RINGBUFFER_H_
 #define SPEECH_CLIENT_SYNTHESIS_SERVICE_RINGBUFFER_H_
 
+#include <string.h>
+
+#include "atomic_ops.h"
 #include "threading.h"
 
 namespace tts_service {
 
+// Interface for objects that want to be told when the reader of a
+// RingBuffer passes a marker added with RingBuffer::AddMarker.  The
+// meaning of |type| and |value| is up to the code adding the markers.
+class MarkerListener {
+ public:
+  virtual ~MarkerListener() { }
+
+  // Called on the reader thread; must return quickly and not block.
+  virtual void OnMarker(int type, int value) = 0;
+};
+
 template<typename T> class RingBuffer {
  public:
-  // Construct a RingBuffer using a given Threading object (used for
-  // locking - may not be NULL) of a given capacity (cannot be increased
+  // A contiguous region of the ring buffer's storage.
+  struct Span {
+    T* data;
+    int frame_count;
+  };
+
+  // Construct a RingBuffer of a given capacity (cannot be increased
   // later). Each element in the RingBuffer is an audio frame consisting
-  // of |channel_count| consecutive samples.
-  RingBuffer(Threading* theading, int frame_capacity, int channel_count);
+  // of |channel_count| consecutive samples.  Up to |marker_capacity|
+  // callbacks and markers can be pending at once.
+  RingBuffer(int frame_capacity, int channel_count,
+             int marker_capacity = 256);
 
   // Destructor.
   ~RingBuffer();
@@ -45,14 +71,15 @@ template<typename T> class RingBuffer {
 
   int GetChannelCount() { return channel_count_; }
 
+  // Discard everything that hasn't been read yet and mark the buffer as
+  // unfinished.  May be called from any thread; the reader drops the
+  // discarded frames at the start of its next ReadAvail or Read call.
+  void Reset();
+
   //
   // Methods for the writer thread
   //
 
-  // Reset to the initial state: the ring buffer is empty and marked as
-  // unfinished.
-  void Reset();
-
   // Get the number of frames that are available to be written.
   // This will be a number between 0 and frame_capacity, inclusive.
   int WriteAvail();
@@ -62,6 +89,18 @@ template<typename T> class RingBuffer {
   // blocking, returns false and writes nothing.
   bool Write(const T* data, int frame_count);
 
+  // Reserve up to |frame_count| frames at the end of the ring buffer so
+  // that they can be filled in place.  Because the storage wraps around,
+  // the reserved frames are returned as two spans; the second one is
+  // empty unless the reservation wraps.  Returns the number of frames
+  // reserved, which is less than |frame_count| if there isn't enough room.
+  // Nothing is visible to the reader until CommitWrite is called.
+  int BeginWrite(int frame_count, Span spans[2]);
+
+  // Make the first |frame_count| frames reserved by the last call to
+  // BeginWrite available to the reader.
+  void CommitWrite(int frame_count);
+
   // Mark the buffer as finished.  Future write operations will fail.
   // Read operations will succeed until the buffer is empty, but
   // IsFinished() will return true immediately.
@@ -69,206 +108,331 @@ template<typename T> class RingBuffer {
 
   // Adds a callback after the current position in the ring buffer.
   // When that position is read, the callback will be executed.
-  void AddCallback(Runnable* calback);
+  // Returns false if too many callbacks and markers are pending.
+  bool AddCallback(Runnable* callback);
+
+  // Adds a marker after the current position in the ring buffer.  When
+  // that position is read, listener->OnMarker(type, value) is called.
+  // Returns false if too many callbacks and markers are pending.
+  //
+  // Callbacks are never dropped: if the frames they follow are discarded
+  // by Reset, they're run when the reader skips over those frames.
+  // Markers in discarded frames are dropped, since what they mark will
+  // never be heard.
+  bool AddMarker(MarkerListener* listener, int type, int value);
 
   //
   // Methods for the reader thread
   //
 
-  // Get the number of items of type T that are available to be read.
-  // This will be a number between 0 and capacity, inclusive.
+  // Get the number of frames that are available to be read.
+  // This will be a number between 0 and frame_capacity, inclusive.
   int ReadAvail();
 
-  // Read |frame_count| elements from the front of the ring buffer.
-  // Returns true on success.  If all |frame_count| elements cannot be
+  // Read |frame_count| frames from the front of the ring buffer.
+  // Returns true on success.  If all |frame_count| frames cannot be
   // read without blocking, returns false and reads nothing.
   bool Read(T* data, int frame_count);
 
+  // Get up to |frame_count| frames from the front of the ring buffer
+  // without copying them, as two spans like BeginWrite.  Returns the
+  // number of frames available.  The frames stay in the buffer until
+  // CommitRead is called.
+  int BeginRead(int frame_count, Span spans[2]);
+
+  // Remove the first |frame_count| frames returned by the last call to
+  // BeginRead from the buffer and deliver any callbacks and markers that
+  // are now due.
+  void CommitRead(int frame_count);
+
   // Returns true if the buffer has been marked as finished by a call to
   // MarkFinished, whether the buffer is empty or not.
   bool IsFinished();
 
  private:
-  struct ScheduledCallback {
-    // The callback to execute.
+  // A scheduled callback or marker: at most one of |callback| and
+  // |listener| is set.
+  struct Marker {
+    // The absolute frame position at which it's delivered.
+    unsigned int position;
     Runnable* callback;
-    // The number of items to be read before it's executed.
-    int offset;
-    // Pointer to the next callback in the linked list.
-    ScheduledCallback* next;
+    MarkerListener* listener;
+    int type;
+    int value;
   };
 
-  Mutex* mutex_;
+  bool PushMarker(Runnable* callback, MarkerListener* listener,
+                  int type, int value);
+  void GetSpans(unsigned int position, int frame_count, Span spans[2]);
+  void ApplyPendingReset();
+  void DiscardMarkers(unsigned int position);
+  void RunDueMarkers();
+
   T* buffer_;
-  ScheduledCallback* callback_head_;
-  bool finished_;
-  const int capacity_;
+
+  // A fixed-size queue of markers, in order of position.  marker_write_
+  // is only modified by the writer and marker_read_ only by the reader.
+  Marker* markers_;
+  unsigned int marker_mask_;
+  volatile unsigned int marker_read_;
+  volatile unsigned int marker_write_;
+
+  volatile bool finished_;
   const int frame_capacity_;
   const int channel_count_;
-  volatile int read_pos_;
-  volatile int write_pos_;
+  unsigned int frame_mask_;
+
+  // Absolute frame positions; they only ever increase (modulo 2^32).
+  // write_pos_ is only modified by the writer and read_pos_ only by the
+  // reader.
+  volatile unsigned int read_pos_;
+  volatile unsigned int write_pos_;
+
+  // Reset() publishes the write position to discard up to in reset_pos_
+  // and then bumps reset_count_; the reader compares reset_count_ against
+  // the last value it applied.
+  volatile unsigned int reset_pos_;
+  volatile unsigned int reset_count_;
+  unsigned int applied_reset_count_;
 };
 
 //
 // Implementation notes:
 //
-// We use a simple mutex to protect all of the fields.
+// The storage is rounded up to a power of two number of frames so that
+// positions can be mapped into the buffer with a mask, and every transfer
+// touches at most two spans: one up to the end of the storage and one
+// from the beginning.  Only |frame_capacity| frames are ever in use.
+//
+// read_pos_ and write_pos_ count frames from the start and wrap around
+// at 2^32, so write_pos_ - read_pos_ is always the number of readable
+// frames and there's no ambiguity between an empty and a full buffer.
+// Each side publishes its position with a release store only after it has
+// finished copying, and reads the other side's position with an acquire
+// load before copying.
 //
-// A special value of -1 is used for read_pos_ to indicate that the buffer
-// is empty, otherwise there would be no way to distinguish between an empty
-// buffer and a full buffer when read_pos_ == write_pos_.
+// Markers are always added at the current write position, so the marker
+// queue, another single-producer/single-consumer ring, is sorted by
+// position and the reader only has to compare the position of the oldest
+// marker to know that nothing is due.  No memory is allocated after
+// construction.
 //
 
 template<typename T> RingBuffer<T>::RingBuffer(
-    Threading* threading, int frame_capacity, int channel_count)
-    : callback_head_(NULL),
-      capacity_(frame_capacity * channel_count),
+    int frame_capacity, int channel_count, int marker_capacity)
+    : marker_read_(0),
+      marker_write_(0),
+      finished_(false),
       frame_capacity_(frame_capacity),
-      channel_count_(channel_count) {
-  mutex_ = threading->CreateMutex();
-  buffer_ = new T[capacity_];
-  Reset();
+      channel_count_(channel_count),
+      read_pos_(0),
+      write_pos_(0),
+      reset_pos_(0),
+      reset_count_(0),
+      applied_reset_count_(0) {
+  unsigned int storage_frames = 1;
+  while (storage_frames < static_cast<unsigned int>(frame_capacity_))
+    storage_frames <<= 1;
+  frame_mask_ = storage_frames - 1;
+  buffer_ = new T[storage_frames * channel_count_];
+
+  unsigned int marker_slots = 1;
+  while (marker_slots < static_cast<unsigned int>(marker_capacity))
+    marker_slots <<= 1;
+  marker_mask_ = marker_slots - 1;
+  markers_ = new Marker[marker_slots];
 }
 
 template<typename T> RingBuffer<T>::~RingBuffer() {
-  delete mutex_;
   delete[] buffer_;
+  delete[] markers_;
 }
 
 template<typename T> void RingBuffer<T>::Reset() {
-  ScopedLock sl(mutex_);
-  finished_ = false;
-  read_pos_ = -1;
-  write_pos_ = 0;
-};
-
-template<typename T> int RingBuffer<T>::WriteAvail() {
-  int avail = capacity_;
-  {
-    ScopedLock sl(mutex_);
-    if (read_pos_ != -1) {
-      avail = read_pos_ - write_pos_;
+  ReleaseStore(&finished_, false);
+  // Two threads can reset at once, so only ever move reset_pos_ forward:
+  // a reset that read an older write position must not undo a newer one.
+  unsigned int position = AcquireLoad(&write_pos_);
+  for (;;) {
+    unsigned int reset_pos = AcquireLoad(&reset_pos_);
+    if (static_cast<int>(position - reset_pos) <= 0 ||
+        AtomicCompareAndSwap(&reset_pos_, reset_pos, position)) {
+      break;
     }
   }
-  if (avail < 0) {
-    avail += capacity_;
-  }
+  AtomicIncrement(&reset_count_, 1U);
+}
 
-  return avail / channel_count_;
+template<typename T> int RingBuffer<T>::WriteAvail() {
+  unsigned int used = write_pos_ - AcquireLoad(&read_pos_);
+  return frame_capacity_ - static_cast<int>(used);
 }
 
-template<typename T> bool RingBuffer<T>::Write(const T* data, int len) {
-  ScopedLock sl(mutex_);
-  if (finished_) {
-    return false;
-  }
-  len *= channel_count_;
-  int avail = capacity_;
-  if (read_pos_ != -1) {
-    avail = read_pos_ - write_pos_;
-  }
-  if (avail < 0) {
-    avail += capacity_;
+// Splits the |frame_count| frames starting at absolute |position| into
+// the part before and the part after the end of the storage.
+template<typename T> void RingBuffer<T>::GetSpans(unsigned int position,
+                                                  int frame_count,
+                                                  Span spans[2]) {
+  int start = position & frame_mask_;
+  int first = static_cast<int>(frame_mask_ + 1) - start;
+  if (first > frame_count)
+    first = frame_count;
+  spans[0].data = &buffer_[start * channel_count_];
+  spans[0].frame_count = first;
+  spans[1].data = buffer_;
+  spans[1].frame_count = frame_count - first;
+}
+
+template<typename T> int RingBuffer<T>::BeginWrite(int frame_count,
+                                                   Span spans[2]) {
+  if (AcquireLoad(&finished_)) {
+    frame_count = 0;
+  } else if (frame_count > WriteAvail()) {
+    frame_count = WriteAvail();
   }
-  if (len > avail) {
+  GetSpans(write_pos_, frame_count, spans);
+  return frame_count;
+}
+
+template<typename T> void RingBuffer<T>::CommitWrite(int frame_count) {
+  ReleaseStore(&write_pos_, write_pos_ + frame_count);
+}
+
+template<typename T> bool RingBuffer<T>::Write(const T* data,
+                                               int frame_count) {
+  Span spans[2];
+  if (BeginWrite(frame_count, spans) < frame_count) {
     return false;
   }
 
-  if (read_pos_ == -1) {
-    read_pos_ = write_pos_;
-  }
-  for (int i = 0; i < len; i++) {
-    buffer_[write_pos_] = data[i];
-    write_pos_ = (write_pos_ + 1) % capacity_;
+  for (int i = 0; i < 2; i++) {
+    memcpy(spans[i].data, data, spans[i].frame_count * channel_count_ *
+           sizeof(T));
+    data += spans[i].frame_count * channel_count_;
   }
-
+  CommitWrite(frame_count);
   return true;
 }
 
 template<typename T> void RingBuffer<T>::MarkFinished() {
-  ScopedLock sl(mutex_);
-  finished_ = true;
+  ReleaseStore(&finished_, true);
 }
 
-template<typename T> void RingBuffer<T>::AddCallback(Runnable* callback) {
-  ScheduledCallback* node = new ScheduledCallback;
-  node->callback = callback;
-  node->offset = ReadAvail();
-  node->next = callback_head_;
+template<typename T> bool RingBuffer<T>::AddCallback(Runnable* callback) {
+  return PushMarker(callback, NULL, 0, 0);
+}
 
-  ScopedLock sl(mutex_);
-  callback_head_ = node;
- }
+template<typename T> bool RingBuffer<T>::AddMarker(MarkerListener* listener,
+                                                   int type,
+                                                   int value) {
+  return PushMarker(NULL, listener, type, value);
+}
 
-template<typename T> int RingBuffer<T>::ReadAvail() {
-  int avail;
-  {
-    ScopedLock sl(mutex_);
-    if (read_pos_ == -1) {
-      return 0;
-    }
-    avail = write_pos_ - read_pos_;
-  }
-  if (avail <= 0) {
-    avail += capacity_;
+template<typename T> bool RingBuffer<T>::PushMarker(Runnable* callback,
+                                                    MarkerListener* listener,
+                                                    int type,
+                                                    int value) {
+  unsigned int marker_write = marker_write_;
+  if (marker_write - AcquireLoad(&marker_read_) > marker_mask_) {
+    return false;
   }
-  return avail / channel_count_;
+
+  Marker* marker = &markers_[marker_write & marker_mask_];
+  marker->position = write_pos_;
+  marker->callback = callback;
+  marker->listener = listener;
+  marker->type = type;
+  marker->value = value;
+  ReleaseStore(&marker_write_, marker_write + 1);
+  return true;
 }
 
-template<typename T> bool RingBuffer<T>::Read(T* data, int len) {
-  ScopedLock sl(mutex_);
-  int avail;
-  len *= channel_count_;
-  if (read_pos_ == -1) {
-    avail = 0;
-  } else {
-    avail = write_pos_ - read_pos_;
-    if (avail <= 0) {
-      avail += capacity_;
-    }
+template<typename T> void RingBuffer<T>::ApplyPendingReset() {
+  unsigned int reset_count = AcquireLoad(&reset_count_);
+  if (reset_count == applied_reset_count_)
+    return;
+  applied_reset_count_ = reset_count;
+  unsigned int reset_pos = AcquireLoad(&reset_pos_);
+  if (static_cast<int>(reset_pos - read_pos_) > 0) {
+    DiscardMarkers(reset_pos);
+    ReleaseStore(&read_pos_, reset_pos);
   }
-  if (len > avail) {
+  RunDueMarkers();
+}
+
+template<typename T> int RingBuffer<T>::ReadAvail() {
+  ApplyPendingReset();
+  return static_cast<int>(AcquireLoad(&write_pos_) - read_pos_);
+}
+
+template<typename T> int RingBuffer<T>::BeginRead(int frame_count,
+                                                  Span spans[2]) {
+  int avail = ReadAvail();
+  if (frame_count > avail)
+    frame_count = avail;
+  GetSpans(read_pos_, frame_count, spans);
+  return frame_count;
+}
+
+template<typename T> void RingBuffer<T>::CommitRead(int frame_count) {
+  ReleaseStore(&read_pos_, read_pos_ + frame_count);
+  RunDueMarkers();
+}
+
+template<typename T> bool RingBuffer<T>::Read(T* data, int frame_count) {
+  Span spans[2];
+  if (BeginRead(frame_count, spans) < frame_count) {
     return false;
   }
 
-  for (int i = 0; i < len; i++) {
-    data[i] = buffer_[read_pos_];
-    read_pos_ = (read_pos_ + 1) % capacity_;
+  for (int i = 0; i < 2; i++) {
+    memcpy(data, spans[i].data, spans[i].frame_count * channel_count_ *
+           sizeof(T));
+    data += spans[i].frame_count * channel_count_;
   }
+  CommitRead(frame_count);
+  return true;
+}
 
-  if (read_pos_ == write_pos_) {
-    read_pos_ = -1;
+// Runs, in the order they were added, the callbacks positioned before
+// |position| and drops the markers.
+template<typename T> void RingBuffer<T>::DiscardMarkers(
+    unsigned int position) {
+  unsigned int marker_read = marker_read_;
+  unsigned int marker_write = AcquireLoad(&marker_write_);
+  while (marker_read != marker_write) {
+    Marker* marker = &markers_[marker_read & marker_mask_];
+    if (static_cast<int>(marker->position - position) >= 0)
+      break;
+    if (marker->callback)
+      marker->callback->Run();
+    marker_read++;
+    ReleaseStore(&marker_read_, marker_read);
   }
+}
 
-  ScheduledCallback* node = callback_head_;
-  ScheduledCallback* prev = NULL;
-  while (node) {
-    node->offset -= len;
-    if (node->offset <= 0) {
-      node->callback->Run();
-      if (prev)
-        prev->next = NULL;
-      else if (callback_head_ == node)
-        callback_head_ = NULL;
-      ScheduledCallback* to_delete = node;
-      node = node->next;
-      prev = NULL;
-      delete to_delete;
-    } else {
-      prev = node;
-      node = node->next;
-    }
+// Delivers, in the order they were added, all callbacks and markers whose
+// position has been read.
+template<typename T> void RingBuffer<T>::RunDueMarkers() {
+  unsigned int marker_read = marker_read_;
+  unsigned int marker_write = AcquireLoad(&marker_write_);
+  while (marker_read != marker_write) {
+    Marker* marker = &markers_[marker_read & marker_mask_];
+    if (static_cast<int>(marker->position - read_pos_) > 0)
+      break;
+    if (marker->callback)
+      marker->callback->Run();
+    else if (marker->listener)
+      marker->listener->OnMarker(marker->type, marker->value);
+    marker_read++;
+    ReleaseStore(&marker_read_, marker_read);
   }
-
-  return true;
 }
 
 template<typename T> bool RingBuffer<T>::IsFinished() {
-  ScopedLock sl(mutex_);
-  return finished_;
+  return AcquireLoad(&finished_);
 }
 
 }  // namespace tts_service
 
 #endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_RINGBUFFER_H_
-
@@ -0,0 +1,152 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Runs the whole TtsService on a Linux host, without a browser, and
+// measures its latency and underruns.  Built for the host like
+// batch_benchmark, reading the lingware from a directory:
+//
+//   make service_benchmark
+//   ./service_benchmark data/ [output] [sample_rate] [channels]
+//       [period_frames] [period_count]
+//
+// The output is one of:
+//
+//   null         no audio, on a virtual clock at real time (the default)
+//   null:<speed> the same, with the clock running <speed> times faster
+//   wav:<path>   written to a WAV file, on a virtual clock at real time
+//   alsa[:<device>]
+//   pulse[:<server>]
+//
+// Each sentence is spoken in turn, waiting for it to finish, and its time
+// to first sample printed, with the underruns of the audio output and of
+// the service, and the service's buffer window after it; then the totals
+// and the audio played.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "linux_audio_output.h"
+#include "pico_tts_engine.h"
+#include "threading.h"
+#include "tts_service.h"
+
+using std::string;
+
+using namespace tts_service;
+
+namespace {
+
+const char* kSentences[] = {
+  "Bookmark this page.",
+  "Open link in new tab.",
+  "The download is complete.",
+  "You have three unread messages.",
+  "Press enter to activate, or escape to cancel.",
+  "This page is asking you to confirm that you want to leave.",
+  "Settings have been saved.",
+  "Search the web, or type a web address.",
+};
+const int kSentenceCount = sizeof(kSentences) / sizeof(kSentences[0]);
+
+// Sets the backend in |options| from |output|, as described above.
+bool ParseOutput(const char* output, LinuxAudioOptions* options) {
+  const char* colon = strchr(output, ':');
+  const char* argument = colon ? colon + 1 : NULL;
+  string name = colon ? string(output, colon - output) : string(output);
+  if (name == "null") {
+    options->backend = LINUX_AUDIO_NULL;
+    if (argument)
+      options->clock_speed = atof(argument);
+  } else if (name == "wav" && argument) {
+    options->backend = LINUX_AUDIO_WAV_FILE;
+    options->path = argument;
+  } else if (name == "alsa") {
+    options->backend = LINUX_AUDIO_ALSA;
+    options->device = argument;
+  } else if (name == "pulse") {
+    options->backend = LINUX_AUDIO_PULSEAUDIO;
+    options->device = argument;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  LinuxAudioOptions options;
+  options.backend = LINUX_AUDIO_NULL;
+  if (argc < 2 || (argc > 2 && !ParseOutput(argv[2], &options))) {
+    fprintf(stderr,
+            "Usage: %s <data directory> [null[:<speed>]|wav:<path>|"
+            "alsa[:<device>]|pulse[:<server>]]\n"
+            "    [sample_rate] [channels] [period_frames] [period_count]\n",
+            argv[0]);
+    return 1;
+  }
+  string base_path = argv[1];
+  if (base_path[base_path.size() - 1] != '/')
+    base_path += '/';
+  if (argc > 3)
+    options.sample_rate = atoi(argv[3]);
+  if (argc > 4)
+    options.channel_count = atoi(argv[4]);
+  if (argc > 5)
+    options.period_frames = atoi(argv[5]);
+  if (argc > 6)
+    options.period_count = atoi(argv[6]);
+
+  Threading threading;
+  AudioOutput* output = CreateLinuxAudioOutput(&threading, options);
+  if (!output)
+    return 1;
+  ThreadedAudioOutput* threaded_output =
+      static_cast<ThreadedAudioOutput*>(output);
+  PicoTtsEngine engine(base_path);
+  TtsService* service = new TtsService(&engine, output, &threading);
+  if (!service->StartService()) {
+    fprintf(stderr, "Unable to start the service.\n");
+    return 1;
+  }
+  printf("%d Hz, %d channels, %d periods of %d frames\n",
+         output->GetSampleRate(),
+         output->GetChannelCount(),
+         output->GetTotalBufferSizeInFrames() /
+             output->GetChunkSizeInFrames(),
+         output->GetChunkSizeInFrames());
+
+  int64_t start_time = threading.GetTimeMilliseconds();
+  printf("utterance  first sample (ms)  underruns  speech underruns  "
+         "window (ms)\n");
+  for (int i = 0; i < kSentenceCount; i++) {
+    int underruns = threaded_output->GetUnderrunCount();
+    int speech_underruns = service->GetUnderrunCount();
+    service->Speak(kSentences[i]);
+    service->WaitUntilFinished();
+    printf("%-10d %-18d %-10d %-16d %d\n",
+           i,
+           service->GetLastTimeToFirstSample(),
+           threaded_output->GetUnderrunCount() - underruns,
+           service->GetUnderrunCount() - speech_underruns,
+           service->GetBufferWindowFrames() * 1000 /
+               output->GetSampleRate());
+  }
+  int64_t elapsed = threading.GetTimeMilliseconds() - start_time;
+
+  service->StopService();
+  printf("max first sample %d ms, %d underruns, %d speech underruns, "
+         "%.2f s of audio in %.2f s\n",
+         service->GetMaxTimeToFirstSample(),
+         threaded_output->GetUnderrunCount(),
+         service->GetUnderrunCount(),
+         static_cast<double>(threaded_output->GetPlayedFrames()) /
+             output->GetSampleRate(),
+         elapsed / 1000.0);
+  delete service;
+  delete output;
+  return 0;
+}
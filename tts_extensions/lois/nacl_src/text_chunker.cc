@@ -0,0 +1,225 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <ctype.h>
+#include <string.h>
+
+#include "text_chunker.h"
+
+namespace tts_service {
+
+namespace {
+
+struct OpenElement {
+  string name;
+  string start_tag;
+};
+
+// Elements that only change the voice or the prosody of the text they
+// contain, so that closing them and opening them again between two
+// pieces of text doesn't change how it's spoken.  While any other element
+// is open the text isn't split.
+const char* kSplittableElements[] = {
+  "speak", "p", "s", "voice", "prosody", "emphasis", "lang",
+  "speed", "pitch", "volume", NULL
+};
+
+bool IsSplittableElement(const string& name) {
+  for (int i = 0; kSplittableElements[i] != NULL; i++) {
+    if (name == kSplittableElements[i])
+      return true;
+  }
+  return false;
+}
+
+bool CanSplit(const vector<OpenElement>& open_elements) {
+  for (size_t i = 0; i < open_elements.size(); i++) {
+    if (!IsSplittableElement(open_elements[i].name))
+      return false;
+  }
+  return true;
+}
+
+bool IsClosingQuote(char c) {
+  return c == '"' || c == '\'' || c == ')' || c == ']';
+}
+
+// Returns the index of the first character after the closing quotes and
+// whitespace that follow the punctuation at |pos|, or -1 if the
+// punctuation isn't followed by whitespace.
+int SkipPastPunctuation(const string& text, int pos) {
+  int size = text.size();
+  pos++;
+  while (pos < size && IsClosingQuote(text[pos]))
+    pos++;
+  if (pos < size && !isspace(static_cast<unsigned char>(text[pos])))
+    return -1;
+  while (pos < size && isspace(static_cast<unsigned char>(text[pos])))
+    pos++;
+  return pos;
+}
+
+// Abbreviations that are usually followed by more of the same sentence.
+// Short capitalized words in general aren't, as in "Yes. The file was
+// saved." or "I saw Bob. He left."
+const char* kAbbreviations[] = {
+  "Mr", "Mrs", "Ms", "Dr", "Prof", "Rev", "Hon", "St", "Mt", "Jr", "Sr",
+  "Lt", "Sgt", "Capt", "Col", "Gen", "vs", "etc", "cf", "approx", NULL
+};
+
+bool IsKnownAbbreviation(const string& text, int start, int size) {
+  for (int i = 0; kAbbreviations[i] != NULL; i++) {
+    if (static_cast<int>(strlen(kAbbreviations[i])) == size &&
+        text.compare(start, size, kAbbreviations[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if the period at |pos| probably ends an abbreviation or an
+// initial rather than a sentence: "Mr. Smith", "J. Doe", "e.g. this".
+bool IsAbbreviation(const string& text, int pos, int next) {
+  int start = pos;
+  while (start > 0 &&
+         (isalpha(static_cast<unsigned char>(text[start - 1])) ||
+          text[start - 1] == '.')) {
+    start--;
+  }
+  int word_size = pos - start;
+  if (word_size == 0)
+    return false;
+  if (word_size == 1 || memchr(&text[start], '.', word_size) != NULL)
+    return true;
+  if (IsKnownAbbreviation(text, start, word_size))
+    return true;
+  // A sentence doesn't continue in lower case: "etc. and so on".
+  return next < static_cast<int>(text.size()) &&
+         islower(static_cast<unsigned char>(text[next]));
+}
+
+// Updates |open_elements| for the tag text[start..end], inclusive.
+void ParseTag(const string& text, int start, int end,
+              vector<OpenElement>* open_elements) {
+  if (text[start + 1] == '?' || text[start + 1] == '!' ||
+      text[end - 1] == '/') {
+    // Processing instruction, comment or empty element.
+    return;
+  }
+
+  bool closing = (text[start + 1] == '/');
+  int name_start = start + (closing ? 2 : 1);
+  int name_end = name_start;
+  while (name_end < end &&
+         !isspace(static_cast<unsigned char>(text[name_end])) &&
+         text[name_end] != '/') {
+    name_end++;
+  }
+  string name = text.substr(name_start, name_end - name_start);
+
+  if (!closing) {
+    OpenElement element;
+    element.name = name;
+    element.start_tag = text.substr(start, end - start + 1);
+    open_elements->push_back(element);
+    return;
+  }
+
+  for (int i = open_elements->size() - 1; i >= 0; i--) {
+    if ((*open_elements)[i].name == name) {
+      open_elements->erase(open_elements->begin() + i,
+                           open_elements->end());
+      return;
+    }
+  }
+}
+
+void AddChunk(const string& prefix,
+              const string& text,
+              int start,
+              int end,
+              bool starts_sentence,
+              const vector<OpenElement>& open_elements,
+              vector<TextChunk>* chunks) {
+  TextChunk chunk;
+  chunk.text = prefix + text.substr(start, end - start);
+  for (int i = open_elements.size() - 1; i >= 0; i--)
+    chunk.text += "</" + open_elements[i].name + ">";
+  chunk.prefix_size = prefix.size();
+  chunk.source_offset = start;
+  chunk.starts_sentence = starts_sentence;
+  chunks->push_back(chunk);
+}
+
+}  // namespace
+
+void SplitTextIntoChunks(const string& text,
+                         int max_clause_size,
+                         vector<TextChunk>* chunks) {
+  chunks->clear();
+
+  vector<OpenElement> open_elements;
+  string prefix;
+  int chunk_start = 0;
+  bool starts_sentence = true;
+  int size = text.size();
+  int pos = 0;
+  while (pos < size) {
+    char c = text[pos];
+    if (c == '<') {
+      size_t tag_end = text.find('>', pos);
+      if (tag_end == string::npos)
+        break;  // Not valid markup; leave the rest in one piece.
+      ParseTag(text, pos, tag_end, &open_elements);
+      pos = tag_end + 1;
+      continue;
+    }
+
+    int next = -1;
+    bool clause = false;
+    if (c == '.' || c == '!' || c == '?') {
+      next = SkipPastPunctuation(text, pos);
+      if (next != -1 && c == '.' && IsAbbreviation(text, pos, next))
+        next = -1;
+    } else if (c == ',' || c == ';' || c == ':') {
+      if (max_clause_size > 0 && pos - chunk_start >= max_clause_size) {
+        next = SkipPastPunctuation(text, pos);
+        clause = true;
+      }
+    } else if (c == '\n') {
+      // A blank line ends a paragraph, even without punctuation.
+      int end = pos + 1;
+      while (end < size && text[end] != '\n' &&
+             isspace(static_cast<unsigned char>(text[end]))) {
+        end++;
+      }
+      if (end < size && text[end] == '\n') {
+        next = end;
+        while (next < size && isspace(static_cast<unsigned char>(text[next])))
+          next++;
+      }
+    }
+
+    if (next == -1 || next >= size || !CanSplit(open_elements)) {
+      pos++;
+      continue;
+    }
+
+    AddChunk(prefix, text, chunk_start, next, starts_sentence,
+             open_elements, chunks);
+    prefix.clear();
+    for (size_t i = 0; i < open_elements.size(); i++)
+      prefix += open_elements[i].start_tag;
+    chunk_start = next;
+    starts_sentence = !clause;
+    pos = next;
+  }
+
+  if (chunk_start < size || chunks->empty()) {
+    // The last piece already has all of its closing tags.
+    vector<OpenElement> none;
+    AddChunk(prefix, text, chunk_start, size, starts_sentence, none, chunks);
+  }
+}
+
+}  // namespace tts_service
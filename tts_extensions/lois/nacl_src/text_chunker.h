@@ -0,0 +1,46 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Splits the text of an utterance into pieces that can be passed to a
+// TTS engine one at a time, so that the engine can start producing audio
+// for the first sentence before it has analyzed the rest of the text.
+//
+// Text is split after the end of each sentence, and sentences longer than
+// a given size are also split after clause punctuation.  The text may
+// contain SSML: it's never split inside a tag, and elements that are open
+// at a split point are closed at the end of the piece and reopened at the
+// start of the next one, so that every piece is well-formed.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_TEXT_CHUNKER_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_TEXT_CHUNKER_H_
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace tts_service {
+
+struct TextChunk {
+  // The text to pass to the engine.
+  string text;
+  // The number of bytes at the start of |text| that reopen elements
+  // closed at the end of the previous chunk.
+  int prefix_size;
+  // The byte offset in the original text of text[prefix_size].
+  int source_offset;
+  // False if the chunk continues a sentence that was split at a clause.
+  bool starts_sentence;
+};
+
+// Split |text| into |chunks|.  Sentences longer than |max_clause_size|
+// bytes are split at commas, semicolons and colons too; if
+// |max_clause_size| is 0, only whole sentences are split off.
+void SplitTextIntoChunks(const string& text,
+                         int max_clause_size,
+                         vector<TextChunk>* chunks);
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_TEXT_CHUNKER_H_
@@ -8,6 +8,7 @@
 
 #include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "threading.h"
 
@@ -100,6 +101,13 @@ void* ThreadStart(void *userdata) {
   return NULL;
 }
 
+int64_t Threading::GetTimeMilliseconds() {
+  // Monotonic, so that intervals don't jump when the wall clock is set.
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
 Thread* Threading::StartJoinableThread(Runnable *action) {
   pthread_t* thread = new pthread_t;
   pthread_create(thread, NULL, ThreadStart, action);
@@ -7,6 +7,8 @@
 #ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_THREADING_H_
 #define SPEECH_CLIENT_SYNTHESIS_SERVICE_THREADING_H_
 
+#include <stdint.h>
+
 #include "base.h"
 
 namespace tts_service {
@@ -103,6 +105,9 @@ class Threading {
   virtual CondVar* CreateCondVar();
   virtual Thread* StartJoinableThread(Runnable *action);
 
+  // Returns the current time in milliseconds, for measuring intervals.
+  virtual int64_t GetTimeMilliseconds();
+
   virtual void ThreadSleepMilliseconds(int milliseconds) {
     if (!sleep_mutex_) {
       sleep_mutex_ = CreateMutex();
@@ -0,0 +1,320 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+
+#include <math.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "atomic_ops.h"
+#include "log.h"
+#include "time_stretcher.h"
+
+namespace tts_service {
+
+namespace {
+
+// Segments long enough to hold a couple of pitch periods, cross-faded over
+// a fraction of their length, and shifted by up to about one period of
+// the lowest voices to line them up.
+const int kSegmentMilliseconds = 30;
+const int kOverlapMilliseconds = 8;
+const int kSeekMilliseconds = 12;
+
+// The search first tries every kCoarseStep'th offset, then every offset
+// near the best of those.
+const int kCoarseStep = 4;
+
+// Returns the dot product of |a| and |b|, which have |count| samples, and
+// sets |*energy| to the dot product of |b| with itself.  This is where
+// nearly all the time goes, so it uses SSE where available.
+float DotProduct(const float *a, const float *b, int count, float *energy) {
+  float sum = 0;
+  float b_energy = 0;
+  int i = 0;
+#if defined(__SSE__)
+  __m128 sum4 = _mm_setzero_ps();
+  __m128 energy4 = _mm_setzero_ps();
+  for (; i + 4 <= count; i += 4) {
+    __m128 a4 = _mm_loadu_ps(a + i);
+    __m128 b4 = _mm_loadu_ps(b + i);
+    sum4 = _mm_add_ps(sum4, _mm_mul_ps(a4, b4));
+    energy4 = _mm_add_ps(energy4, _mm_mul_ps(b4, b4));
+  }
+  float sums[4];
+  float energies[4];
+  _mm_storeu_ps(sums, sum4);
+  _mm_storeu_ps(energies, energy4);
+  sum = sums[0] + sums[1] + sums[2] + sums[3];
+  b_energy = energies[0] + energies[1] + energies[2] + energies[3];
+#endif
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+    b_energy += b[i] * b[i];
+  }
+  *energy = b_energy;
+  return sum;
+}
+
+}  // namespace
+
+const float TimeStretcher::kMinSpeed = 0.25f;
+const float TimeStretcher::kMaxSpeed = 5.0f;
+
+TimeStretcher::TimeStretcher(TtsDataReceiver *destination,
+                             int sample_rate,
+                             int channel_count,
+                             int buffer_size)
+    : destination_(destination),
+      sample_rate_(sample_rate),
+      channel_count_(channel_count),
+      buffer_size_(buffer_size),
+      speed_(1.0f),
+      active_(false),
+      input_position_(0),
+      overlap_position_(0),
+      skip_remainder_(0) {
+  segment_frames_ = sample_rate * kSegmentMilliseconds / 1000;
+  overlap_frames_ = sample_rate * kOverlapMilliseconds / 1000;
+  seek_frames_ = sample_rate * kSeekMilliseconds / 1000;
+  if (overlap_frames_ < 1)
+    overlap_frames_ = 1;
+  if (segment_frames_ < 2 * overlap_frames_)
+    segment_frames_ = 2 * overlap_frames_;
+}
+
+TimeStretcher::~TimeStretcher() {
+}
+
+void TimeStretcher::SetSpeed(float speed) {
+  // NaN fails both comparisons below.
+  if (speed != speed)
+    speed = 1.0f;
+  if (speed < kMinSpeed)
+    speed = kMinSpeed;
+  if (speed > kMaxSpeed)
+    speed = kMaxSpeed;
+  ReleaseStore(&speed_, speed);
+}
+
+tts_callback_status TimeStretcher::Receive(int rate,
+                                           int num_channels,
+                                           const int16_t* data,
+                                           int num_samples) {
+  if (!active_) {
+    if (AcquireLoad(&speed_) == 1.0f)
+      return destination_->Receive(rate, num_channels, data, num_samples);
+    active_ = true;
+  }
+
+  if (rate != sample_rate_ || num_channels != channel_count_) {
+    LOG(ERROR) << "Got " << rate << " Hz, " << num_channels << " channels, "
+               << "expected " << sample_rate_ << " Hz, " << channel_count_;
+    return TTS_CALLBACK_ERROR;
+  }
+
+  input_.insert(input_.end(), data, data + num_samples * num_channels);
+  return Process(false);
+}
+
+tts_callback_status TimeStretcher::ReceiveMarker(tts_marker_type type,
+                                                 int text_offset) {
+  if (!active_)
+    return destination_->ReceiveMarker(type, text_offset);
+
+  // Up to a segment and a seek of input are held back, which at slow
+  // speeds is a lot longer in the output, so the marker waits for the
+  // audio after it.
+  Marker marker;
+  marker.frame = input_position_ + input_.size() / channel_count_;
+  marker.type = type;
+  marker.text_offset = text_offset;
+  markers_.push_back(marker);
+  return TTS_CALLBACK_CONTINUE;
+}
+
+tts_callback_status TimeStretcher::Done() {
+  if (active_) {
+    tts_callback_status status = Process(true);
+    active_ = false;
+    if (status == TTS_CALLBACK_ERROR)
+      return status;
+  }
+  return destination_->Done();
+}
+
+tts_callback_status TimeStretcher::Process(bool flush) {
+  for (;;) {
+    int available = input_.size() / channel_count_;
+    int seek_frames = overlap_.empty() ? 0 : seek_frames_;
+    double skip = (segment_frames_ - overlap_frames_) * AcquireLoad(&speed_) +
+        skip_remainder_;
+    int skip_frames = static_cast<int>(skip);
+    if (available < seek_frames + segment_frames_ || available < skip_frames)
+      break;
+
+    // The first segment is taken as is; the others are lined up with the
+    // end of the one before.
+    int offset = seek_frames ? FindBestOffset(seek_frames) : 0;
+    const float *segment = &input_[offset * channel_count_];
+    // Everything but the overlap kept for the next segment is output now.
+    QueueMarkers(input_position_ + offset,
+                 input_position_ + offset + segment_frames_ - overlap_frames_,
+                 output_.size() / channel_count_);
+    if (overlap_.empty())
+      Append(segment, overlap_frames_);
+    else
+      CrossFade(segment, overlap_frames_);
+    Append(segment + overlap_frames_ * channel_count_,
+           segment_frames_ - 2 * overlap_frames_);
+    overlap_.assign(
+        segment + (segment_frames_ - overlap_frames_) * channel_count_,
+        segment + segment_frames_ * channel_count_);
+    overlap_position_ =
+        input_position_ + offset + segment_frames_ - overlap_frames_;
+
+    skip_remainder_ = skip - skip_frames;
+    input_.erase(input_.begin(),
+                 input_.begin() + skip_frames * channel_count_);
+    input_position_ += skip_frames;
+
+    tts_callback_status status = Flush();
+    if (status != TTS_CALLBACK_CONTINUE)
+      return status;
+  }
+
+  if (flush) {
+    // Fade into whatever input is left, too little for a whole segment.
+    int available = input_.size() / channel_count_;
+    QueueMarkers(input_position_, input_position_ + available + 1,
+                 output_.size() / channel_count_);
+    if (overlap_.empty()) {
+      Append(&input_[0], available);
+    } else if (available >= overlap_frames_) {
+      CrossFade(&input_[0], overlap_frames_);
+      Append(&input_[overlap_frames_ * channel_count_],
+             available - overlap_frames_);
+    } else {
+      Append(&overlap_[0], overlap_frames_);
+    }
+    input_.clear();
+    input_position_ = 0;
+    overlap_.clear();
+    skip_remainder_ = 0;
+    return Flush();
+  }
+
+  return TTS_CALLBACK_CONTINUE;
+}
+
+int TimeStretcher::FindBestOffset(int max_offset) {
+  int sample_count = overlap_frames_ * channel_count_;
+  int best_offset = 0;
+  float best_score = -1e30f;
+
+  // Normalize by the energy of the input only, so that a loud match isn't
+  // favored over a better-shaped quiet one.
+  for (int pass = 0; pass < 2; pass++) {
+    int first = 0;
+    int last = max_offset;
+    int step = kCoarseStep;
+    if (pass == 1) {
+      first = best_offset - kCoarseStep + 1;
+      last = best_offset + kCoarseStep - 1;
+      if (first < 0)
+        first = 0;
+      if (last > max_offset)
+        last = max_offset;
+      step = 1;
+    }
+    for (int offset = first; offset <= last; offset += step) {
+      float energy;
+      float dot = DotProduct(&overlap_[0],
+                             &input_[offset * channel_count_],
+                             sample_count,
+                             &energy);
+      float score = dot / sqrtf(energy + 1.0f);
+      if (score > best_score) {
+        best_score = score;
+        best_offset = offset;
+      }
+    }
+  }
+  return best_offset;
+}
+
+void TimeStretcher::CrossFade(const float *input, int frame_count) {
+  for (int i = 0; i < frame_count; i++) {
+    float fade_in = (i + 0.5f) / frame_count;
+    for (int c = 0; c < channel_count_; c++) {
+      int j = i * channel_count_ + c;
+      float value = overlap_[j] + (input[j] - overlap_[j]) * fade_in;
+      output_.push_back(static_cast<int16_t>(value));
+    }
+  }
+}
+
+void TimeStretcher::Append(const float *input, int frame_count) {
+  output_.insert(output_.end(), input, input + frame_count * channel_count_);
+}
+
+void TimeStretcher::QueueMarkers(int input_start,
+                                 int input_end,
+                                 int output_start) {
+  int overlap_end = overlap_.empty() ? 0 : overlap_position_ + overlap_frames_;
+  if (input_end < overlap_end)
+    input_end = overlap_end;
+  size_t count = 0;
+  while (count < markers_.size() && markers_[count].frame < input_end) {
+    // A marker goes before the first output its input is heard in: the
+    // fade out of the overlap, or the new input, or if that input was
+    // skipped, the start of the output.
+    int frame = markers_[count].frame;
+    int offset = frame > input_start ? frame - input_start : 0;
+    if (frame >= overlap_position_ && frame < overlap_end &&
+        frame - overlap_position_ < offset) {
+      offset = frame - overlap_position_;
+    }
+    Marker marker = markers_[count];
+    marker.frame = output_start + offset;
+    output_markers_.push_back(marker);
+    count++;
+  }
+  markers_.erase(markers_.begin(), markers_.begin() + count);
+}
+
+tts_callback_status TimeStretcher::Flush() {
+  int frame_count = output_.size() / channel_count_;
+  tts_callback_status status = TTS_CALLBACK_CONTINUE;
+  size_t marker = 0;
+  int frame = 0;
+  while (status == TTS_CALLBACK_CONTINUE) {
+    if (marker < output_markers_.size() &&
+        (output_markers_[marker].frame <= frame || frame == frame_count)) {
+      status = destination_->ReceiveMarker(output_markers_[marker].type,
+                                           output_markers_[marker].text_offset);
+      marker++;
+      continue;
+    }
+    if (frame == frame_count)
+      break;
+    int frames = frame_count - frame;
+    if (frames > buffer_size_)
+      frames = buffer_size_;
+    if (marker < output_markers_.size() &&
+        output_markers_[marker].frame < frame + frames) {
+      frames = output_markers_[marker].frame - frame;
+    }
+    status = destination_->Receive(sample_rate_,
+                                   channel_count_,
+                                   &output_[frame * channel_count_],
+                                   frames);
+    frame += frames;
+  }
+  output_.clear();
+  output_markers_.clear();
+  return status;
+}
+
+}  // namespace tts_service
@@ -0,0 +1,134 @@
+// Copyright 2011 and beyond, Google Inc.
+// All Rights Reserved.
+//
+// Implementation of TtsDataReceiver that speeds up or slows down the audio
+// without changing its pitch, and passes it through to another callback.
+// The speed can be changed at any time from another thread, and applies
+// to the audio received from then on, so it takes effect in the middle of
+// an utterance rather than with the next one, and isn't limited by the
+// range of rates the engine supports.
+//
+// Uses WSOLA (waveform similarity overlap-add): the input is cut into
+// overlapping segments, spaced according to the speed, and each segment is
+// shifted by up to a few milliseconds to where it best matches the end of
+// the previous one before they're cross-faded, so that the waveform stays
+// continuous.  At a speed of 1, audio is passed through untouched until
+// the speed is first changed.
+
+#ifndef SPEECH_CLIENT_SYNTHESIS_SERVICE_TIME_STRETCHER_H_
+#define SPEECH_CLIENT_SYNTHESIS_SERVICE_TIME_STRETCHER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "tts_receiver.h"
+
+using std::vector;
+
+namespace tts_service {
+
+class TimeStretcher : public TtsDataReceiver {
+ public:
+  // Passes at most |buffer_size| frames at a time to |destination|.
+  TimeStretcher(TtsDataReceiver *destination,
+                int sample_rate,
+                int channel_count,
+                int buffer_size);
+
+  virtual ~TimeStretcher();
+
+  // Sets the speed, where 2 is twice as fast, clamped to the range
+  // supported; NaN is taken as 1.  May be called on any thread.
+  void SetSpeed(float speed);
+
+  virtual tts_callback_status Receive(int rate,
+                                      int num_channels,
+                                      const int16_t* data,
+                                      int num_samples);
+
+  // Markers are held back along with the audio, and passed on just
+  // before the output made from the input that came after them.
+  virtual tts_callback_status ReceiveMarker(tts_marker_type type,
+                                            int text_offset);
+
+  // Passes on the audio that's still held back, then calls Done on the
+  // destination.
+  virtual tts_callback_status Done();
+
+  // The slowest and fastest speeds supported.
+  static const float kMinSpeed;
+  static const float kMaxSpeed;
+
+ private:
+  // A marker that's held back, and the frame it comes before: of the
+  // input, counted from the start of the utterance, in markers_, or of
+  // output_, in output_markers_.
+  struct Marker {
+    int frame;
+    tts_marker_type type;
+    int text_offset;
+  };
+
+  // Makes as many segments as the buffered input allows, or if |flush|,
+  // all of them.
+  tts_callback_status Process(bool flush);
+
+  // Returns the offset in frames, up to |max_offset|, at which the input
+  // best matches the end of the previous segment.
+  int FindBestOffset(int max_offset);
+
+  // Adds the cross-fade from the end of the previous segment into
+  // |frame_count| frames of input to the output.
+  void CrossFade(const float *input, int frame_count);
+
+  // Adds |frame_count| frames of |input| to the output.
+  void Append(const float *input, int frame_count);
+
+  // Moves the markers that came before input frame |input_end|, or
+  // before the end of the overlap, from markers_ to output_markers_,
+  // where the output about to be added starts at output frame
+  // |output_start| with the cross-fade out of the overlap, and has the
+  // input from frame |input_start| on.
+  void QueueMarkers(int input_start, int input_end, int output_start);
+
+  // Passes the output to the destination, with its markers.
+  tts_callback_status Flush();
+
+  TtsDataReceiver *destination_;
+  int sample_rate_;
+  int channel_count_;
+  int buffer_size_;
+  volatile float speed_;
+
+  // In frames.
+  int segment_frames_;
+  int overlap_frames_;
+  int seek_frames_;
+
+  // False until audio is first received at a speed other than 1.
+  bool active_;
+
+  // The input not used up yet, interleaved, and the frame it starts at,
+  // counted from the start of the utterance.
+  vector<float> input_;
+  int input_position_;
+  // The end of the previous segment, to cross-fade into the next one,
+  // and the input frame it starts at.
+  vector<float> overlap_;
+  int overlap_position_;
+  // The fraction of a frame to skip along with the next segment.
+  double skip_remainder_;
+
+  // Output waiting to be passed to the destination.
+  vector<int16_t> output_;
+
+  // Markers received and not yet placed in the output, and the ones
+  // placed in output_, both in order.
+  vector<Marker> markers_;
+  vector<Marker> output_markers_;
+};
+
+}  // namespace tts_service
+
+#endif  // SPEECH_CLIENT_SYNTHESIS_SERVICE_TIME_STRETCHER_H_
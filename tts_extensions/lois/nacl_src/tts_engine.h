@@ -118,6 +118,14 @@ class TtsEngine {
   // Set the object that will receive completed audio samples
   virtual void SetReceiver(TtsDataReceiver* receiver) = 0;
 
+  // Enable or disable calls to the receiver's ReceiveMarker method at
+  // the start of every word and sentence in subsequent calls to
+  // SynthesizeText.
+  // @return TTS_SUCCESS, or TTS_FEATURE_UNSUPPORTED
+  virtual tts_result SetProgressMarkers(bool enabled) {
+    return enabled ? TTS_FEATURE_UNSUPPORTED : TTS_SUCCESS;
+  }
+
   // Set a property for the the TTS engine
   // @param property pointer to the property name
   // @param value    pointer to the new property value, null-terminated utf-8
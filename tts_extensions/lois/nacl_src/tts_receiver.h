@@ -22,6 +22,11 @@ enum tts_callback_status {
                               // return TTS_FAILURE from SynthesizeText().
 };
 
+enum tts_marker_type {
+  TTS_MARKER_WORD = 1,        // A word starts.
+  TTS_MARKER_SENTENCE = 2     // A sentence starts.
+};
+
 template <class DataElement>
 class TtsGenericDataReceiver {
  public:
@@ -53,6 +58,18 @@ class TtsGenericDataReceiver {
                                       const DataElement* data,
                                       int num_data_frames) = 0;
 
+  // Method that the TTS Engine calls, if progress markers are enabled,
+  // when the audio for a word or sentence is about to start: the audio
+  // passed to the next call to Receive belongs to it.
+  //
+  // @param type               The kind of marker.
+  // @param text_offset        Offset in bytes of the start of the word or
+  //                           sentence in the text passed to the engine.
+  virtual tts_callback_status ReceiveMarker(tts_marker_type type,
+                                            int text_offset) {
+    return TTS_CALLBACK_CONTINUE;
+  }
+
   // Method that the TTS Engine calls after it has called Receive for
   // all synthesized audio data.  Should return TTS_CALLBACK_HALT on
   // success and TTS_CALLBACK_ERROR on error.  The non-sensical (in
@@ -3,21 +3,366 @@
 //
 // Author: dmazzoni@google.com (Dominic Mazzoni)
 
+#include <string.h>
+
 #include <algorithm>
 #include <string>
+#include <vector>
 
+#include "atomic_ops.h"
 #include "audio_output.h"
+#include "audio_sink.h"
 #include "earcon_manager.h"
 #include "log.h"
+#include "polyphase_resampler.h"
 #include "resampler.h"
+#include "resampler_cache.h"
+#include "text_chunker.h"
 #include "threading.h"
+#include "time_stretcher.h"
 #include "tts_engine.h"
 #include "tts_service.h"
 
 using std::string;
+using std::vector;
 
 namespace tts_service {
 
+// The length of the fade-out when speech is cut off, to avoid a click.
+static const int kFadeOutMilliseconds = 5;
+
+// Marker type used to find out which chunk of text is playing; the value
+// is the chunk's source offset.
+static const int kChunkStartMarker = 0;
+
+// The number of frames the engine and resampler pass at a time when
+// rendering offline.
+static const int kRenderBufferFrames = 4096;
+
+// Limits on the buffer window, in chunks.  The audio output takes a whole
+// chunk at a time, so the next one can only be synthesized while one
+// plays if there's room for two.
+static const int kMinBufferChunks = 2;
+static const int kInitialBufferChunks = 4;
+
+// The buffer window only shrinks, a chunk at a time, after this many
+// utterances in a row that needed less and had no underrun, or after many
+// more if the last change was growing it after an underrun, since that
+// size is known to be too small.
+static const int kUtterancesBeforeShrinking = 4;
+static const int kUtterancesBeforeShrinkingAfterUnderrun = 32;
+
+// Above this real-time factor, synthesis has little time to spare to
+// catch up after a slow stretch, so an extra chunk is buffered.
+static const float kSlowRealTimeFactor = 0.5f;
+
+// Copies |frame_count| frames from |input| to |output|.  If the channel
+// counts differ, |input| must be mono, and each sample is copied to every
+// output channel.
+static void CopyFrames(const int16_t* input,
+                       int input_channels,
+                       int16_t* output,
+                       int output_channels,
+                       int frame_count) {
+  if (input_channels == output_channels) {
+    memcpy(output, input, frame_count * input_channels * sizeof(int16_t));
+    return;
+  }
+  int output_index = 0;
+  for (int j = 0; j < frame_count; j++) {
+    for (int k = 0; k < output_channels; k++) {
+      output[output_index++] = input[j * input_channels];
+    }
+  }
+}
+
+// An utterance whose synthesis has started.  It's added to the ring buffer
+// as a callback after the utterance's audio, and the audio I/O thread runs
+// it when that audio has been played or discarded.  Until then, Preempt
+// may take the utterance back to put it in the queue again, in which case
+// the completion callback isn't run.
+class Playback : public Runnable {
+ public:
+  enum State {
+    PLAYING = 0,
+    FINISHED = 1,
+    PREEMPTED = 2
+  };
+
+  Playback(Utterance *utterance, volatile int *played_offset)
+      : utterance_(utterance),
+        completion_(NULL),
+        played_offset_(played_offset),
+        state_(PLAYING),
+        delivered_(false) {
+    if (utterance->options)
+      completion_ = utterance->options->completion;
+  }
+
+  virtual ~Playback() {
+    delete utterance_;
+  }
+
+  // Called on the audio I/O thread.
+  virtual void Run() {
+    if (AtomicCompareAndSwap(&state_, static_cast<int>(PLAYING),
+                             static_cast<int>(FINISHED))) {
+      if (completion_)
+        completion_->Run();
+    }
+    ReleaseStore(played_offset_, 0);
+    ReleaseStore(&delivered_, true);
+  }
+
+  // Returns the utterance so it can be spoken again, or NULL if it has
+  // already finished playing.
+  Utterance *Preempt() {
+    if (!AtomicCompareAndSwap(&state_, static_cast<int>(PLAYING),
+                              static_cast<int>(PREEMPTED))) {
+      return NULL;
+    }
+    Utterance *utterance = utterance_;
+    utterance_ = NULL;
+    return utterance;
+  }
+
+  bool IsPlaying() { return AcquireLoad(&state_) == PLAYING; }
+
+  // True once the audio I/O thread will no longer touch this object.
+  bool IsDelivered() { return AcquireLoad(&delivered_); }
+
+  // The priority of the utterance, only valid while it's playing.
+  int priority() { return utterance_->priority; }
+
+ private:
+  Utterance *utterance_;
+  Runnable *completion_;
+  volatile int *played_offset_;
+  volatile int state_;
+  volatile bool delivered_;
+};
+
+// Receives the audio for one chunk of an utterance from the engine and
+// passes it through to the real destination.  Marker offsets are
+// translated from the chunk text to the utterance text, the engine's
+// sentence marker at the start of a chunk that continues a sentence is
+// dropped, and the Done call at the end of each chunk is swallowed so that
+// the destination only sees one at the end of the utterance.
+class ChunkReceiver : public TtsDataReceiver {
+ public:
+  explicit ChunkReceiver(TtsDataReceiver *destination)
+      : destination_(destination),
+        offset_delta_(0),
+        sentence_marker_allowed_(true) {}
+
+  void SetChunk(const TextChunk& chunk) {
+    offset_delta_ = chunk.source_offset - chunk.prefix_size;
+    sentence_marker_allowed_ = chunk.starts_sentence;
+  }
+
+  virtual tts_callback_status Receive(int rate,
+                                      int num_channels,
+                                      const int16_t* data,
+                                      int num_samples) {
+    return destination_->Receive(rate, num_channels, data, num_samples);
+  }
+
+  virtual tts_callback_status ReceiveMarker(tts_marker_type type,
+                                            int text_offset) {
+    if (type == TTS_MARKER_SENTENCE && !sentence_marker_allowed_) {
+      sentence_marker_allowed_ = true;
+      return TTS_CALLBACK_CONTINUE;
+    }
+    return destination_->ReceiveMarker(type, text_offset + offset_delta_);
+  }
+
+  virtual tts_callback_status Done() {
+    return TTS_CALLBACK_HALT;
+  }
+
+ private:
+  TtsDataReceiver *destination_;
+  int offset_delta_;
+  bool sentence_marker_allowed_;
+};
+
+// Receives the audio rendered by RenderToSink, converts it to the sink's
+// channel count and writes it to the sink.
+class SinkReceiver : public TtsDataReceiver {
+ public:
+  SinkReceiver(AudioSink *sink, int channel_count)
+      : sink_(sink),
+        channel_count_(channel_count),
+        buffer_(new int16_t[kRenderBufferFrames * channel_count]),
+        failed_(false) {}
+
+  virtual ~SinkReceiver() {
+    delete[] buffer_;
+  }
+
+  virtual tts_callback_status Receive(int rate,
+                                      int num_channels,
+                                      const int16_t* data,
+                                      int num_samples) {
+    if (num_channels != channel_count_ && num_channels != 1) {
+      LOG(ERROR) << "Can't render " << num_channels << " channels to "
+                 << channel_count_;
+      failed_ = true;
+      return TTS_CALLBACK_ERROR;
+    }
+    while (num_samples > 0) {
+      int frames = num_samples < kRenderBufferFrames ?
+          num_samples : kRenderBufferFrames;
+      CopyFrames(data, num_channels, buffer_, channel_count_, frames);
+      if (!sink_->Write(buffer_, frames)) {
+        failed_ = true;
+        return TTS_CALLBACK_HALT;
+      }
+      data += frames * num_channels;
+      num_samples -= frames;
+    }
+    return TTS_CALLBACK_CONTINUE;
+  }
+
+  virtual tts_callback_status Done() {
+    return TTS_CALLBACK_HALT;
+  }
+
+  bool failed() { return failed_; }
+
+ private:
+  AudioSink *sink_;
+  int channel_count_;
+  int16_t *buffer_;
+  bool failed_;
+};
+
+// Resamples the mono audio rendered by RenderToSink with |resampler|, the
+// same way as the audio played, and passes it on to |destination|.
+class PolyphaseReceiver : public TtsDataReceiver {
+ public:
+  PolyphaseReceiver(PolyphaseResampler *resampler,
+                    TtsDataReceiver *destination)
+      : resampler_(resampler),
+        destination_(destination),
+        buffer_(new int16_t[kRenderBufferFrames]) {}
+
+  virtual ~PolyphaseReceiver() {
+    delete[] buffer_;
+  }
+
+  virtual tts_callback_status Receive(int rate,
+                                      int num_channels,
+                                      const int16_t* data,
+                                      int num_samples) {
+    if (rate != resampler_->source_rate() || num_channels != 1) {
+      LOG(ERROR) << "Can't resample " << rate << " Hz, " << num_channels
+                 << " channels";
+      return TTS_CALLBACK_ERROR;
+    }
+    resampler_->AddInput(data, num_samples);
+    return WriteAvailable();
+  }
+
+  virtual tts_callback_status Done() {
+    // Write out the end of the audio, which the filter holds back.
+    resampler_->Finish();
+    tts_callback_status status = WriteAvailable();
+    if (status != TTS_CALLBACK_CONTINUE)
+      return status;
+    return destination_->Done();
+  }
+
+ private:
+  tts_callback_status WriteAvailable() {
+    int available;
+    while ((available = resampler_->GetAvailableFrames()) > 0) {
+      int frames = available < kRenderBufferFrames ?
+          available : kRenderBufferFrames;
+      resampler_->Read(buffer_, 1, frames);
+      tts_callback_status status = destination_->Receive(
+          resampler_->dest_rate(), 1, buffer_, frames);
+      if (status != TTS_CALLBACK_CONTINUE)
+        return status;
+    }
+    return TTS_CALLBACK_CONTINUE;
+  }
+
+  PolyphaseResampler *resampler_;
+  TtsDataReceiver *destination_;
+  int16_t *buffer_;
+};
+
+// Passes the audio of an utterance through to |destination|, if there is
+// one, and records it with its markers for the phrase cache.  Recording
+// stops if there are more than |max_samples| samples or the format
+// changes.
+class PhraseRecorder : public TtsDataReceiver {
+ public:
+  PhraseRecorder(TtsDataReceiver *destination,
+                 PhraseAudio *audio,
+                 int max_samples)
+      : destination_(destination),
+        audio_(audio),
+        max_samples_(max_samples),
+        complete_(true) {}
+
+  virtual tts_callback_status Receive(int rate,
+                                      int num_channels,
+                                      const int16_t* data,
+                                      int num_samples) {
+    if (complete_ && num_samples > 0) {
+      if (audio_->samples.empty()) {
+        audio_->sample_rate = rate;
+        audio_->channel_count = num_channels;
+      }
+      int sample_count = num_samples * num_channels;
+      if (rate != audio_->sample_rate ||
+          num_channels != audio_->channel_count ||
+          static_cast<int>(audio_->samples.size()) + sample_count >
+              max_samples_) {
+        complete_ = false;
+      } else {
+        audio_->samples.insert(audio_->samples.end(),
+                               data, data + sample_count);
+      }
+    }
+    if (!destination_)
+      return TTS_CALLBACK_CONTINUE;
+    return destination_->Receive(rate, num_channels, data, num_samples);
+  }
+
+  virtual tts_callback_status ReceiveMarker(tts_marker_type type,
+                                            int text_offset) {
+    if (complete_) {
+      PhraseMarker marker;
+      marker.frame = audio_->channel_count ?
+          audio_->samples.size() / audio_->channel_count : 0;
+      marker.type = type;
+      marker.text_offset = text_offset;
+      audio_->markers.push_back(marker);
+    }
+    if (!destination_)
+      return TTS_CALLBACK_CONTINUE;
+    return destination_->ReceiveMarker(type, text_offset);
+  }
+
+  virtual tts_callback_status Done() {
+    if (!destination_)
+      return TTS_CALLBACK_HALT;
+    return destination_->Done();
+  }
+
+  // False if the audio was too long to record.
+  bool complete() { return complete_; }
+
+ private:
+  TtsDataReceiver *destination_;
+  PhraseAudio *audio_;
+  int max_samples_;
+  bool complete_;
+};
+
 TtsService::TtsService(TtsEngine *engine,
                        AudioOutput *audio_output,
                        Threading *threading)
@@ -25,19 +370,67 @@ TtsService::TtsService(TtsEngine *engine,
       audio_output_(audio_output),
       threading_(threading),
       current_utterance_(NULL),
+      progress_listener_(NULL),
       resampler_(NULL),
+      polyphase_resampler_(NULL),
+      resampler_cache_(new ResamplerCache(threading)),
+      audio_buffer_(NULL),
       earcon_manager_(NULL),
+      engine_initialized_(false),
       stop_when_finished_(false),
+      look_ahead_utterances_(0),
+      look_ahead_frames_(0),
+      text_chunking_(false),
+      max_clause_size_(0),
+      phrase_cache_(NULL),
+      max_phrase_size_(0),
+      speed_(1),
+      played_offset_(0),
+      generation_(0),
+      synthesis_generation_(0),
+      played_generation_(0),
+      last_frame_(NULL),
+      fade_frames_(0),
+      stop_time_(0),
+      last_stop_to_silence_(-1),
+      buffer_chunks_(kInitialBufferChunks),
+      max_buffer_chunks_(kInitialBufferChunks),
+      speech_streaming_(false),
+      underrun_count_(0),
+      utterance_frames_(0),
+      utterance_busy_time_(0),
+      max_write_interval_(0),
+      last_write_time_(0),
+      real_time_factor_(-1),
+      seen_underrun_count_(0),
+      steady_utterances_(0),
       mutex_(threading->CreateMutex()),
       cond_var_(threading->CreateCondVar()),
+      engine_mutex_(threading->CreateMutex()),
+      next_sequence_(0),
+      time_stretcher_(NULL),
       service_running_(false),
-      utterance_running_(false) {
+      utterance_running_(false),
+      synthesis_start_time_(0),
+      first_sample_pending_(false),
+      last_time_to_first_sample_(-1),
+      max_time_to_first_sample_(-1),
+      next_speech_pending_(false),
+      last_stop_to_next_speech_(-1) {
 }
 
 TtsService::~TtsService() {
   delete mutex_;
   delete cond_var_;
+  delete engine_mutex_;
   delete[] audio_buffer_;
+  delete[] last_frame_;
+  delete phrase_cache_;
+  delete resampler_cache_;
+  while (!warm_up_phrases_.empty()) {
+    delete warm_up_phrases_.front();
+    warm_up_phrases_.pop_front();
+  }
 }
 
 bool TtsService::StartService() {
@@ -47,16 +440,52 @@ bool TtsService::StartService() {
     return false;
   }
   audio_buffer_size_ = audio_output_->GetChunkSizeInFrames();
+  // The ring buffer has room for the largest window, and WriteFrames keeps
+  // to the current one.
+  max_buffer_chunks_ =
+      audio_output_->GetTotalBufferSizeInFrames() / audio_buffer_size_;
+  if (max_buffer_chunks_ < kMinBufferChunks)
+    max_buffer_chunks_ = kMinBufferChunks;
+  buffer_chunks_ = kInitialBufferChunks < max_buffer_chunks_ ?
+      kInitialBufferChunks : max_buffer_chunks_;
+  underrun_count_ = 0;
+  seen_underrun_count_ = 0;
+  real_time_factor_ = -1;
+  steady_utterances_ = 0;
   ring_buffer_ = new RingBuffer<int16_t>(
-      threading_,
-      audio_output_->GetTotalBufferSizeInFrames(),
+      max_buffer_chunks_ * audio_buffer_size_ + look_ahead_frames_,
       audio_output_->GetChannelCount());
+  delete[] audio_buffer_;
   audio_buffer_ = new int16_t[audio_buffer_size_];
-  if (engine_->Init() != TTS_SUCCESS) {
-    return false;
+  {
+    ScopedLock sl(engine_mutex_);
+    if (!InitEngine()) {
+      return false;
+    }
+    // Compute the filter for resampling the engine's audio now, rather
+    // than when the first utterance is waiting for it.
+    int engine_rate = engine_->GetSampleRate();
+    int output_rate = audio_output_->GetSampleRate();
+    if (engine_rate != output_rate &&
+        PolyphaseResampler::IsSupported(engine_rate, output_rate)) {
+      resampler_cache_->ReleasePolyphaseResampler(
+          resampler_cache_->GetPolyphaseResampler(engine_rate, output_rate));
+    }
   }
-  earcon_manager_ = new EarconManager(
-      audio_output_->GetSampleRate(), audio_output_->GetChannelCount());
+  earcon_manager_ = new EarconManager(audio_output_->GetSampleRate(),
+                                      audio_output_->GetChannelCount(),
+                                      resampler_cache_);
+  earcon_manager_->SetCacheDirectory(earcon_cache_directory_);
+  played_offset_ = 0;
+  last_time_to_first_sample_ = -1;
+  max_time_to_first_sample_ = -1;
+  last_stop_to_silence_ = -1;
+  last_stop_to_next_speech_ = -1;
+  played_generation_ = generation_;
+  delete[] last_frame_;
+  last_frame_ = new int16_t[audio_output_->GetChannelCount()];
+  memset(last_frame_, 0, audio_output_->GetChannelCount() * sizeof(int16_t));
+  fade_frames_ = audio_output_->GetSampleRate() * kFadeOutMilliseconds / 1000;
   LOG(INFO) << "StartService";
   audio_output_->StartAudio();
   service_running_ = true;
@@ -75,6 +504,7 @@ void TtsService::StopService() {
   {
     ScopedLock sl(mutex_);
     service_running_ = false;
+    AtomicIncrement(&generation_, 1U);
     cond_var_->Signal();
   }
 
@@ -87,6 +517,12 @@ void TtsService::StopService() {
   earcon_manager_ = NULL;
 }
 
+bool TtsService::InitEngine() {
+  if (!engine_initialized_)
+    engine_initialized_ = (engine_->Init() == TTS_SUCCESS);
+  return engine_initialized_;
+}
+
 int TtsService::LoadEarconFromWavFile(const char *path, bool loop) {
   if (!service_running_) {
     LOG(ERROR) << "Fatal: can't load earcons before service is running.";
@@ -96,10 +532,12 @@ int TtsService::LoadEarconFromWavFile(const char *path, bool loop) {
   return earcon_manager_->LoadEarconFromWavFile(path, loop);
 }
 
-void TtsService::Speak(string text, UtteranceOptions* options /*= NULL*/) {
-  if (!service_running_) {
-    return;
-  }
+void TtsService::SetEarconCacheDirectory(const char *path) {
+  earcon_cache_directory_ = path;
+}
+
+Utterance *TtsService::NewUtterance(const string& text,
+                                    UtteranceOptions *options) {
   Utterance *utterance = new Utterance;
   utterance->text = text;
   if (options == NULL || options->voice_options == NULL) {
@@ -110,11 +548,33 @@ void TtsService::Speak(string text, UtteranceOptions* options /*= NULL*/) {
       utterance->voice_index = 0;
     }
   }
-  utterance->options = new UtteranceOptions(*options);
+  if (options) {
+    utterance->options = new UtteranceOptions(*options);
+    utterance->priority = options->priority;
+  }
+  return utterance;
+}
+
+void TtsService::Speak(string text, UtteranceOptions* options /*= NULL*/) {
+  if (!service_running_) {
+    return;
+  }
+  Utterance *utterance = NewUtterance(text, options);
+  tts_queue_mode queue_mode = TTS_QUEUE_ENQUEUE;
+  if (options) {
+    queue_mode = options->queue_mode;
+  }
 
   {
     ScopedLock sl(mutex_);
-    utterances_.push_back(utterance);
+    utterance->sequence = next_sequence_++;
+    if (queue_mode == TTS_QUEUE_INTERRUPT) {
+      CancelUtterance();
+      FlushQueue();
+    } else if (queue_mode == TTS_QUEUE_PREEMPT) {
+      Preempt(utterance->priority);
+    }
+    utterances_.push(utterance);
     cond_var_->Signal();
   }
 }
@@ -125,27 +585,198 @@ void TtsService::Stop() {
   }
 
   ScopedLock sl(mutex_);
+  CancelUtterance();
+  FlushQueue();
+  cond_var_->Signal();
+}
+
+bool TtsService::RenderToSink(const string& text,
+                              UtteranceOptions *options,
+                              int sample_rate,
+                              int channel_count,
+                              AudioSink *sink) {
+  if (sample_rate <= 0 || channel_count <= 0) {
+    LOG(ERROR) << "Invalid render format: " << sample_rate << " Hz, "
+               << channel_count << " channels";
+    return false;
+  }
+
+  ScopedLock sl(engine_mutex_);
+  if (!InitEngine()) {
+    return false;
+  }
+
+  UtteranceOptions default_options;
+  if (options == NULL)
+    options = &default_options;
+  int voice_index = 0;
+  if (options->voice_options != NULL &&
+      (voice_index = engine_->GetVoiceIndex(options->voice_options)) == -1) {
+    voice_index = 0;
+  }
+  engine_->SetVoice(voice_index);
+  engine_->SetRate(options->rate);
+  engine_->SetPitch(options->pitch);
+  engine_->SetVolume(options->volume);
+  engine_->SetProgressMarkers(false);
+
+  if (!sink->Start(sample_rate, channel_count)) {
+    return false;
+  }
+
+  // Resample with the same filter as the audio played, if it can.
+  SinkReceiver sink_receiver(sink, channel_count);
+  TtsDataReceiver *receiver = &sink_receiver;
+  int engine_rate = engine_->GetSampleRate();
+  Resampler *resampler = NULL;
+  PolyphaseResampler *polyphase_resampler = NULL;
+  PolyphaseReceiver *polyphase_receiver = NULL;
+  if (engine_rate != sample_rate &&
+      PolyphaseResampler::IsSupported(engine_rate, sample_rate)) {
+    polyphase_resampler = resampler_cache_->GetPolyphaseResampler(
+        engine_rate, sample_rate);
+    polyphase_receiver = new PolyphaseReceiver(polyphase_resampler,
+                                               &sink_receiver);
+    receiver = polyphase_receiver;
+  } else if (engine_rate != sample_rate) {
+    resampler = resampler_cache_->GetResampler(&sink_receiver,
+                                               engine_rate,
+                                               sample_rate,
+                                               kRenderBufferFrames,
+                                               false);
+    receiver = resampler;
+  }
+  engine_->SetReceiver(receiver);
+
+  int16_t *buffer = new int16_t[kRenderBufferFrames];
+  int samples_output = 0;
+  tts_result result = engine_->SynthesizeText(
+      text.c_str(), buffer, kRenderBufferFrames, &samples_output);
+  if (sink_receiver.failed()) {
+    // Discard what's left of the text in the engine.
+    engine_->Stop();
+  }
+  delete[] buffer;
+  if (resampler)
+    resampler_cache_->ReleaseResampler(resampler);
+  if (polyphase_resampler) {
+    delete polyphase_receiver;
+    resampler_cache_->ReleasePolyphaseResampler(polyphase_resampler);
+  }
+
+  bool finished = sink->Finish();
+  return result == TTS_SUCCESS && !sink_receiver.failed() && finished;
+}
+
+bool TtsService::RenderToBuffer(const string& text,
+                                UtteranceOptions *options,
+                                int sample_rate,
+                                int channel_count,
+                                vector<int16_t> *samples) {
+  BufferAudioSink sink(samples);
+  return RenderToSink(text, options, sample_rate, channel_count, &sink);
+}
+
+bool TtsService::RenderToFile(const string& text,
+                              UtteranceOptions *options,
+                              int sample_rate,
+                              int channel_count,
+                              const char *path) {
+  WavFileAudioSink sink(path);
+  return RenderToSink(text, options, sample_rate, channel_count, &sink);
+}
+
+// Discards the audio that hasn't been played yet and makes the engine
+// callbacks for the utterance being synthesized return TTS_CALLBACK_HALT.
+void TtsService::CancelUtterance() {
+  if (utterance_running_ || CountPlayingUtterances() > 0) {
+    utterance_running_ = false;
+    stop_time_ = threading_->GetTimeMilliseconds();
+    next_speech_pending_ = true;
+    AtomicIncrement(&generation_, 1U);
+  }
+  // Reset only once the new generation is visible, so that whatever the
+  // writer commits is either before the position this discards up to, or
+  // late enough for the writer to see the new generation and reset again.
+  MemoryBarrier();
   ring_buffer_->Reset();
+}
+
+void TtsService::FlushQueue() {
   while (!utterances_.empty()) {
-    delete utterances_.front();
-    utterances_.pop_front();
+    delete utterances_.top();
+    utterances_.pop();
+  }
+}
+
+void TtsService::Preempt(int priority) {
+  list<Playback*>::iterator iter = playbacks_.begin();
+  while (iter != playbacks_.end() && !(*iter)->IsPlaying())
+    ++iter;
+  if (iter == playbacks_.end() || (*iter)->priority() >= priority)
+    return;
+
+  // Read where the audio thread is before discarding the audio, which
+  // makes it run through the remaining markers.
+  int resume_offset = AcquireLoad(&played_offset_);
+  CancelUtterance();
+
+  // Everything from the utterance playing on goes back in the queue with
+  // its original priority and sequence number, so they're spoken again in
+  // the same order after the higher-priority utterances.
+  for (; iter != playbacks_.end(); ++iter) {
+    Utterance *utterance = (*iter)->Preempt();
+    if (utterance == NULL) {
+      // It finished playing in the meantime, so the offset we read may
+      // belong to it.
+      resume_offset = 0;
+      continue;
+    }
+    if (resume_offset > utterance->resume_offset)
+      utterance->resume_offset = resume_offset;
+    resume_offset = 0;
+    utterances_.push(utterance);
   }
-  utterance_running_ = false;
-  cond_var_->Signal();
 }
 
+void TtsService::DeleteFinishedPlaybacks() {
+  while (!playbacks_.empty() && playbacks_.front()->IsDelivered()) {
+    delete playbacks_.front();
+    playbacks_.pop_front();
+  }
+}
+
+int TtsService::CountPlayingUtterances() {
+  int count = 0;
+  for (list<Playback*>::iterator iter = playbacks_.begin();
+       iter != playbacks_.end();
+       ++iter) {
+    if ((*iter)->IsPlaying())
+      count++;
+  }
+  return count;
+}
+
+// The earcon manager passes these on to the audio thread without
+// locking, so they don't wait for synthesis.
+
 void TtsService::PlayEarcon(int earcon_id) {
-  ScopedLock sl(mutex_);
   earcon_manager_->Play(earcon_id);
 }
 
+void TtsService::PlayEarcon(int earcon_id, float gain, float pan) {
+  earcon_manager_->Play(earcon_id, gain, pan);
+}
+
+void TtsService::SetEarconGain(int earcon_id, float gain, float pan) {
+  earcon_manager_->SetGain(earcon_id, gain, pan);
+}
+
 void TtsService::StopEarcon(int earcon_id) {
-  ScopedLock sl(mutex_);
   earcon_manager_->Stop(earcon_id);
 }
 
 void TtsService::StopAllEarcons() {
-  ScopedLock sl(mutex_);
   earcon_manager_->StopAll();
 }
 
@@ -175,47 +806,360 @@ void TtsService::SetStopWhenFinished(bool stop_when_finished) {
   stop_when_finished_ = stop_when_finished;
 }
 
+void TtsService::SetLookAhead(int utterance_count, int cache_size_in_frames) {
+  if (service_running_) {
+    LOG(ERROR) << "Look-ahead must be set before starting the service.";
+    return;
+  }
+  look_ahead_utterances_ = utterance_count > 0 ? utterance_count : 0;
+  look_ahead_frames_ = cache_size_in_frames > 0 ? cache_size_in_frames : 0;
+}
+
+void TtsService::SetTextChunking(bool enabled, int max_clause_size) {
+  ScopedLock sl(mutex_);
+  text_chunking_ = enabled;
+  max_clause_size_ = max_clause_size > 0 ? max_clause_size : 0;
+}
+
+void TtsService::SetPhraseCache(int size_in_bytes, int max_phrase_size) {
+  if (service_running_) {
+    LOG(ERROR) << "The phrase cache must be set before starting the service.";
+    return;
+  }
+  delete phrase_cache_;
+  phrase_cache_ = NULL;
+  if (size_in_bytes > 0 && max_phrase_size > 0)
+    phrase_cache_ = new PhraseCache(threading_, size_in_bytes);
+  max_phrase_size_ = max_phrase_size;
+}
+
+bool TtsService::SetDiskPhraseCache(const char *path, int size_in_bytes) {
+  if (service_running_) {
+    LOG(ERROR) << "The phrase cache must be set before starting the service.";
+    return false;
+  }
+  if (!phrase_cache_) {
+    LOG(ERROR) << "There's no phrase cache to keep on disk.";
+    return false;
+  }
+  return phrase_cache_->OpenDiskCache(path, size_in_bytes);
+}
+
+void TtsService::AddWarmUpPhrase(const string& text,
+                                 UtteranceOptions *options) {
+  if (!phrase_cache_ ||
+      static_cast<int>(text.size()) > max_phrase_size_) {
+    return;
+  }
+  Utterance *utterance = NewUtterance(text, options);
+  ScopedLock sl(mutex_);
+  warm_up_phrases_.push_back(utterance);
+  cond_var_->Signal();
+}
+
+void TtsService::SetSpeed(float speed) {
+  ScopedLock sl(mutex_);
+  speed_ = speed;
+  if (time_stretcher_)
+    time_stretcher_->SetSpeed(speed);
+}
+
+PhraseCacheStats TtsService::GetPhraseCacheStats() {
+  if (!phrase_cache_) {
+    PhraseCacheStats stats = { 0 };
+    return stats;
+  }
+  return phrase_cache_->GetStats();
+}
+
+string TtsService::GetPhraseKey(const string& text,
+                                int voice_index,
+                                UtteranceOptions *options) {
+  UtteranceOptions default_options;
+  if (options == NULL)
+    options = &default_options;
+  return PhraseCache::MakeKey(text, voice_index, options->rate,
+                              options->pitch, options->volume);
+}
+
+// Synthesizes a warm-up phrase into the cache, unless it's already there.
+void TtsService::WarmUpPhrase(Utterance *utterance) {
+  string key = GetPhraseKey(utterance->text, utterance->voice_index,
+                            utterance->options);
+  if (phrase_cache_->Contains(key))
+    return;
+
+  UtteranceOptions default_options;
+  UtteranceOptions *options = utterance->options;
+  if (options == NULL)
+    options = &default_options;
+
+  ScopedLock engine_lock(engine_mutex_);
+  engine_->SetVoice(utterance->voice_index);
+  engine_->SetRate(options->rate);
+  engine_->SetPitch(options->pitch);
+  engine_->SetVolume(options->volume);
+  engine_->SetProgressMarkers(true);
+
+  PhraseAudio audio;
+  PhraseRecorder recorder(NULL, &audio, phrase_cache_->max_samples());
+  engine_->SetReceiver(&recorder);
+  int samples_output = 0;
+  if (engine_->SynthesizeText(utterance->text.c_str(),
+                              audio_buffer_,
+                              audio_buffer_size_,
+                              &samples_output) == TTS_SUCCESS &&
+      recorder.complete()) {
+    PhraseCache::MapMarkersToKey(utterance->text, &audio);
+    phrase_cache_->Insert(key, audio);
+  }
+}
+
+// Passes cached audio and its markers to |receiver| the way the engine
+// would, a buffer at a time.
+void TtsService::PlayPhrase(const PhraseAudio& audio,
+                            TtsDataReceiver *receiver) {
+  int frame_count = audio.channel_count ?
+      audio.samples.size() / audio.channel_count : 0;
+  size_t next_marker = 0;
+  int frame = 0;
+  tts_callback_status status = TTS_CALLBACK_CONTINUE;
+  while (status == TTS_CALLBACK_CONTINUE && frame < frame_count) {
+    if (next_marker < audio.markers.size() &&
+        audio.markers[next_marker].frame <= frame) {
+      const PhraseMarker& marker = audio.markers[next_marker++];
+      status = receiver->ReceiveMarker(marker.type, marker.text_offset);
+      continue;
+    }
+    int frames = frame_count - frame;
+    if (frames > audio_buffer_size_)
+      frames = audio_buffer_size_;
+    if (next_marker < audio.markers.size() &&
+        audio.markers[next_marker].frame < frame + frames) {
+      frames = audio.markers[next_marker].frame - frame;
+    }
+    status = receiver->Receive(audio.sample_rate,
+                               audio.channel_count,
+                               &audio.samples[frame * audio.channel_count],
+                               frames);
+    frame += frames;
+  }
+  receiver->Done();
+}
+
+int TtsService::GetLastTimeToFirstSample() {
+  ScopedLock sl(mutex_);
+  return last_time_to_first_sample_;
+}
+
+int TtsService::GetMaxTimeToFirstSample() {
+  ScopedLock sl(mutex_);
+  return max_time_to_first_sample_;
+}
+
+int TtsService::GetLastStopToSilence() {
+  return AcquireLoad(&last_stop_to_silence_);
+}
+
+int TtsService::GetLastStopToNextSpeech() {
+  ScopedLock sl(mutex_);
+  return last_stop_to_next_speech_;
+}
+
+int TtsService::GetBufferWindowFrames() {
+  return AcquireLoad(&buffer_chunks_) * audio_buffer_size_;
+}
+
+int TtsService::GetUnderrunCount() {
+  return AcquireLoad(&underrun_count_);
+}
+
+void TtsService::AdaptBufferWindow(bool utterance_done) {
+  int chunks = buffer_chunks_;
+  int underrun_count = AcquireLoad(&underrun_count_);
+  if (underrun_count != seen_underrun_count_) {
+    // Grow right away, even in the middle of an utterance.
+    seen_underrun_count_ = underrun_count;
+    if (chunks < max_buffer_chunks_)
+      chunks++;
+    steady_utterances_ = kUtterancesBeforeShrinking -
+        kUtterancesBeforeShrinkingAfterUnderrun;
+  } else if (utterance_done && utterance_frames_ > 0) {
+    int rate = audio_output_->GetSampleRate();
+    float real_time_factor = utterance_busy_time_ * rate /
+        (1000.0f * utterance_frames_);
+    if (real_time_factor_ < 0)
+      real_time_factor_ = real_time_factor;
+    else
+      real_time_factor_ = 0.75f * real_time_factor_ + 0.25f * real_time_factor;
+
+    // Enough to keep playing through the longest wait for the engine,
+    // besides the chunk playing.  If the engine is slower than real time,
+    // no window is enough, so buffer as much as possible.
+    int target = max_buffer_chunks_;
+    if (real_time_factor_ < 1) {
+      int wait_frames = static_cast<int>(max_write_interval_ * rate / 1000);
+      target = (wait_frames + audio_buffer_size_ - 1) / audio_buffer_size_ + 1;
+      if (real_time_factor_ > kSlowRealTimeFactor)
+        target++;
+    }
+    if (target < kMinBufferChunks)
+      target = kMinBufferChunks;
+    if (target > max_buffer_chunks_)
+      target = max_buffer_chunks_;
+
+    steady_utterances_++;
+    if (target > chunks) {
+      chunks = target;
+    } else if (target < chunks &&
+               steady_utterances_ >= kUtterancesBeforeShrinking) {
+      chunks--;
+    }
+  }
+
+  if (chunks != buffer_chunks_) {
+    if (steady_utterances_ > 0)
+      steady_utterances_ = 0;
+    ReleaseStore(&buffer_chunks_, chunks);
+    LOG(INFO) << "Buffer window: " << chunks << " chunks, "
+              << chunks * audio_buffer_size_ * 1000 /
+                 audio_output_->GetSampleRate()
+              << " ms (real-time factor " << real_time_factor_
+              << ", " << underrun_count << " underruns)";
+  }
+}
+
 void TtsService::Run() {
   if (!service_running_) {
     return;
   }
   LOG(INFO) << "Running background thread";
   for (;;) {
+    Playback *playback = NULL;
+    Utterance *warm_up_phrase = NULL;
+    string utterance_text;
+    int voice_index = 0;
+    int resume_offset = 0;
+    UtteranceOptions options;
+    bool text_chunking;
+    int max_clause_size;
     {
       ScopedLock sl(mutex_);
+      DeleteFinishedPlaybacks();
+
       // If there are no utterances and there's no signal to stop,
       // wait on our condition variable, which will allow this thread to
       // sleep with no CPU usage and wake up immediately when there's
       // work for us to do.
-      if (utterances_.empty() && service_running_ == true) {
+      if (utterances_.empty() && warm_up_phrases_.empty() &&
+          service_running_ == true) {
         cond_var_->Wait(mutex_);
       }
 
+      // In look-ahead mode, don't start another utterance while the one
+      // playing and the ones after it that we've already synthesized
+      // exceed the look-ahead count.  The audio thread can't signal us,
+      // so check again every chunk.
+      while (look_ahead_frames_ > 0 &&
+             service_running_ == true &&
+             !utterances_.empty() &&
+             CountPlayingUtterances() > look_ahead_utterances_) {
+        cond_var_->WaitWithTimeout(
+            mutex_, audio_buffer_size_ * 1000 / audio_output_->GetSampleRate());
+        DeleteFinishedPlaybacks();
+      }
+
       if (service_running_ == false) {
         LOG(INFO) << "Exiting background thread";
-        while (!utterances_.empty()) {
-          delete utterances_.front();
-          utterances_.pop_front();
+        FlushQueue();
+        while (!warm_up_phrases_.empty()) {
+          delete warm_up_phrases_.front();
+          warm_up_phrases_.pop_front();
+        }
+        while (!playbacks_.empty()) {
+          delete playbacks_.front();
+          playbacks_.pop_front();
         }
         return;
       }
 
       if (current_utterance_ == NULL && !utterances_.empty()) {
-        current_utterance_ = utterances_.front();
-        utterances_.pop_front();
+        current_utterance_ = utterances_.top();
+        utterances_.pop();
+
+        // Copy everything we need now: once the mutex is released, the
+        // utterance may be preempted, put back in the queue and deleted by
+        // Stop.
+        playback = new Playback(current_utterance_, &played_offset_);
+        playbacks_.push_back(playback);
+        utterance_text = current_utterance_->text;
+        voice_index = current_utterance_->voice_index;
+        resume_offset = current_utterance_->resume_offset;
+        if (current_utterance_->options) {
+          options.rate = current_utterance_->options->rate;
+          options.pitch = current_utterance_->options->pitch;
+          options.volume = current_utterance_->options->volume;
+          options.progress = current_utterance_->options->progress;
+        }
+
+        utterance_running_ = true;
+        synthesis_generation_ = generation_;
+        synthesis_start_time_ = threading_->GetTimeMilliseconds();
+        first_sample_pending_ = true;
+        utterance_frames_ = 0;
+        utterance_busy_time_ = 0;
+        max_write_interval_ = 0;
+        last_write_time_ = 0;
+      } else if (current_utterance_ == NULL && !warm_up_phrases_.empty()) {
+        // Nothing to speak, so use the time to fill the phrase cache.
+        warm_up_phrase = warm_up_phrases_.front();
+        warm_up_phrases_.pop_front();
       }
 
-      utterance_running_ = true;
+      text_chunking = text_chunking_;
+      max_clause_size = max_clause_size_;
     }  // ScopedLock sl(mutex_);
 
+    if (warm_up_phrase) {
+      WarmUpPhrase(warm_up_phrase);
+      delete warm_up_phrase;
+      continue;
+    }
+
     if (!current_utterance_) {
       continue;
     }
 
-    if (current_utterance_->options) {
-      engine_->SetRate(current_utterance_->options->rate);
-      engine_->SetPitch(current_utterance_->options->pitch);
-      engine_->SetVolume(current_utterance_->options->volume);
+    // Short phrases are looked up in the phrase cache, and recorded into
+    // it if they're not there.
+    string phrase_key;
+    PhraseAudio phrase_audio;
+    bool phrase_cached = false;
+    if (phrase_cache_ &&
+        resume_offset == 0 &&
+        static_cast<int>(utterance_text.size()) <= max_phrase_size_) {
+      phrase_key = GetPhraseKey(utterance_text, voice_index, &options);
+      phrase_cached = phrase_cache_->Lookup(phrase_key, &phrase_audio);
+      if (phrase_cached)
+        PhraseCache::MapMarkersFromKey(utterance_text, &phrase_audio);
+    }
+
+    // Rendering offline uses the engine too.
+    ScopedLock engine_lock(engine_mutex_);
+
+    // Utterances without options get the default prosody rather than that
+    // of the previous utterance, so that they can share cached phrases.
+    progress_listener_ = options.progress;
+    if (!phrase_cached) {
+      engine_->SetRate(options.rate);
+      engine_->SetPitch(options.pitch);
+      engine_->SetVolume(options.volume);
+      // Phrases are recorded with their markers, in case they're spoken
+      // again with a progress listener.
+      if (engine_->SetProgressMarkers(progress_listener_ != NULL ||
+                                      !phrase_key.empty()) != TTS_SUCCESS) {
+        progress_listener_ = NULL;
+      }
     }
 
     // Synthesize the current utterance.  The TTS engine will call our
@@ -225,37 +1169,126 @@ void TtsService::Run() {
     // until this utterance is done synthesizing, and then current_utterance_
     // will be set to NULL.
     int samples_output = 0;
-    engine_->SetVoice(current_utterance_->voice_index);
+    int source_rate = phrase_audio.sample_rate;
+    if (!phrase_cached) {
+      engine_->SetVoice(voice_index);
+      source_rate = engine_->GetSampleRate();
+    }
 
     resampler_ = NULL;
-    if (audio_output_->GetSampleRate() != engine_->GetSampleRate()) {
-      resampler_ = new Resampler(this,
-                                 engine_->GetSampleRate(),
-                                 audio_output_->GetSampleRate(),
-                                 audio_buffer_size_);
-      engine_->SetReceiver(resampler_);
+    polyphase_resampler_ = NULL;
+    TtsDataReceiver *receiver = this;
+    if (audio_output_->GetSampleRate() != source_rate) {
+      if (PolyphaseResampler::IsSupported(source_rate,
+                                          audio_output_->GetSampleRate())) {
+        polyphase_resampler_ = resampler_cache_->GetPolyphaseResampler(
+            source_rate, audio_output_->GetSampleRate());
+      } else {
+        resampler_ = resampler_cache_->GetResampler(
+            this,
+            source_rate,
+            audio_output_->GetSampleRate(),
+            audio_buffer_size_,
+            false);
+        receiver = resampler_;
+      }
+    }
+
+    // Stretched before resampling, where there are fewer samples, and
+    // after recording, so that cached phrases play at any speed.  The
+    // engine's audio is mono.
+    TimeStretcher time_stretcher(receiver, source_rate, 1, audio_buffer_size_);
+    {
+      ScopedLock sl(mutex_);
+      time_stretcher.SetSpeed(speed_);
+      time_stretcher_ = &time_stretcher;
+    }
+    receiver = &time_stretcher;
+
+    PhraseAudio recorded_audio;
+    PhraseRecorder recorder(receiver, &recorded_audio,
+                            phrase_cache_ ? phrase_cache_->max_samples() : 0);
+    if (!phrase_key.empty() && !phrase_cached)
+      receiver = &recorder;
+    bool synthesized = true;
+
+    if (phrase_cached) {
+      PlayPhrase(phrase_audio, receiver);
+    } else if (text_chunking) {
+      // Synthesize one piece at a time, checking for Stop in between.  A
+      // marker before each piece tells us where to resume if this
+      // utterance is preempted.
+      vector<TextChunk> chunks;
+      SplitTextIntoChunks(utterance_text, max_clause_size, &chunks);
+      ChunkReceiver chunk_receiver(receiver);
+      engine_->SetReceiver(&chunk_receiver);
+      for (size_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i].source_offset < resume_offset)
+          continue;
+        if (AcquireLoad(&generation_) != synthesis_generation_)
+          break;
+        ring_buffer_->AddMarker(this, kChunkStartMarker,
+                                chunks[i].source_offset);
+        chunk_receiver.SetChunk(chunks[i]);
+        if (engine_->SynthesizeText(chunks[i].text.c_str(),
+                                    audio_buffer_,
+                                    audio_buffer_size_,
+                                    &samples_output) != TTS_SUCCESS) {
+          synthesized = false;
+          break;
+        }
+      }
+      receiver->Done();
     } else {
-      engine_->SetReceiver(this);
+      engine_->SetReceiver(receiver);
+      synthesized = (engine_->SynthesizeText(
+          utterance_text.c_str(),
+          audio_buffer_,
+          audio_buffer_size_,
+          &samples_output) == TTS_SUCCESS);
     }
 
-    // Save the utterance text and the completion callback because
-    // current_utterance_ is deleted by the Done() callback before the call to
-    // SynthesizeText exits.
-    string utterance_text = current_utterance_->text;
-    Runnable* completion_callback = NULL;
-    if (current_utterance_->options) {
-      completion_callback = current_utterance_->options->completion;
+    // Only cache phrases that were synthesized all the way through.
+    if (receiver == &recorder &&
+        synthesized &&
+        recorder.complete() &&
+        AcquireLoad(&generation_) == synthesis_generation_) {
+      PhraseCache::MapMarkersToKey(utterance_text, &recorded_audio);
+      phrase_cache_->Insert(phrase_key, recorded_audio);
     }
 
-    engine_->SynthesizeText(
-        utterance_text.c_str(),
-        audio_buffer_,
-        audio_buffer_size_,
-        &samples_output);
+    // The rest of the audio is at most a chunk, which the audio output
+    // waits for, so it's no longer an underrun if it runs out.  Only
+    // utterances that ran the engine and weren't cut off say how fast the
+    // engine is; a cached phrase is written as fast as there's room.
+    ReleaseStore(&speech_streaming_, false);
+    AdaptBufferWindow(!phrase_cached && synthesized &&
+                      AcquireLoad(&generation_) == synthesis_generation_);
 
-    ring_buffer_->AddCallback(completion_callback);
+    // The playback runs the completion callback once the audio written so
+    // far has been played, unless the utterance was preempted.
+    while (!ring_buffer_->AddCallback(playback) && service_running_) {
+      // Too many markers are pending; wait for the reader to catch up.
+      threading_->ThreadSleepMilliseconds(
+          audio_buffer_size_ * 1000 / audio_output_->GetSampleRate());
+    }
     LOG(INFO) << "Done: " << utterance_text;
 
+    // FillAudioBuffer only takes whole chunks from the ring buffer, so if
+    // nothing else is queued, pad with a chunk of silence to make sure the
+    // end of this utterance is played and its callback is run.
+    bool queue_empty;
+    {
+      ScopedLock sl(mutex_);
+      queue_empty = utterances_.empty();
+      first_sample_pending_ = false;
+    }
+    if (queue_empty) {
+      memset(audio_buffer_, 0, audio_buffer_size_ * sizeof(int16_t));
+      Receive(audio_output_->GetSampleRate(), 1, audio_buffer_,
+              audio_buffer_size_);
+    }
+
     {
       ScopedLock sl(mutex_);
       if (utterance_running_ == false) {
@@ -263,14 +1296,20 @@ void TtsService::Run() {
         engine_->Stop();
       }
       utterance_running_ = false;
+      time_stretcher_ = NULL;
       cond_var_->Signal();
     }
 
-    delete current_utterance_;
+    // The playback owns the utterance now.
     current_utterance_ = NULL;
 
     if (resampler_) {
-      delete resampler_;
+      resampler_cache_->ReleaseResampler(resampler_);
+      resampler_ = NULL;
+    }
+    if (polyphase_resampler_) {
+      resampler_cache_->ReleasePolyphaseResampler(polyphase_resampler_);
+      polyphase_resampler_ = NULL;
     }
   }
 }
@@ -279,14 +1318,33 @@ tts_callback_status TtsService::Receive(int rate,
                                         int num_channels,
                                         const int16_t* data,
                                         int num_frames) {
-  // Check if we need to exit prematurely
-  {
-    ScopedLock sl(mutex_);
-    if (service_running_ == false || utterance_running_ == false) {
-      return TTS_CALLBACK_HALT;
+  // Check if we need to exit prematurely.  This is called for every few
+  // milliseconds of audio, so it checks the generation instead of taking
+  // the mutex.
+  if (AcquireLoad(&generation_) != synthesis_generation_) {
+    return TTS_CALLBACK_HALT;
+  }
+
+  // The engine's audio is resampled, upmixed and clipped in one pass as
+  // it's written to the ring buffer.
+  if (polyphase_resampler_ && rate == polyphase_resampler_->source_rate()) {
+    if (num_channels != 1) {
+      LOG(ERROR) << "Unsupported num_channels " << num_channels;
+      return TTS_CALLBACK_ERROR;
     }
+    polyphase_resampler_->AddInput(data, num_frames);
+    return WriteFrames(NULL, 1, polyphase_resampler_->GetAvailableFrames());
   }
 
+  return WriteFrames(data, num_channels, num_frames);
+}
+
+// Writes |num_frames| frames of |data| to the ring buffer, converting
+// them to the audio output's channel count, or if |data| is NULL, takes
+// them from the polyphase resampler.
+tts_callback_status TtsService::WriteFrames(const int16_t* data,
+                                            int num_channels,
+                                            int num_frames) {
   // If there's no audio data, just return success
   if (num_frames == 0) {
     return TTS_CALLBACK_CONTINUE;
@@ -301,64 +1359,150 @@ tts_callback_status TtsService::Receive(int rate,
     exit(-1);
   }
 
-  int16_t* output_data = NULL;
-  if (num_channels != output_num_channels) {
-    // If the number of channels the engine supports is different from the
-    // number that the audio output supports, convert accordingly.
-    if (num_channels == 1 && output_num_channels > 1) {
-      int output_num_samples = num_frames * output_num_channels;
-      output_data = new int16_t[output_num_samples];
+  // If the number of channels the engine supports is different from the
+  // number that the audio output supports, we convert while writing into
+  // the ring buffer below.
+  if (num_channels != output_num_channels &&
+      !(num_channels == 1 && output_num_channels > 1)) {
+    LOG(ERROR) << "The audio output must have at least as many channels as "
+               << "the engine. Audio Output: " << output_num_channels
+               << "Engine: " << num_channels;
+    exit(1);
+  }
 
-      int output_index = 0;
-      for (int i = 0; i < num_frames; i++) {
-        // Copy the first input channel's sample to every output channel
-        for (int j = 0; j < output_num_channels; j++) {
-          output_data[output_index++] = data[i];
-        }
+  // Resampling up makes more frames than the engine passed at once, so
+  // write at most a buffer-full at a time.
+  int rate = audio_output_->GetSampleRate();
+  while (num_frames > 0) {
+    int frames = num_frames < audio_buffer_size_ ? num_frames
+                                                 : audio_buffer_size_;
+
+    // The time since the last write was spent synthesizing.
+    int64_t now = threading_->GetTimeMilliseconds();
+    if (last_write_time_ > 0) {
+      int64_t interval = now - last_write_time_;
+      utterance_busy_time_ += interval;
+      if (interval > max_write_interval_)
+        max_write_interval_ = interval;
+    }
+
+    // If the buffer window is full, compute the amount of time we expect
+    // it to take for that many audio samples to be output, and sleep for
+    // that long.  The part of the ring buffer beyond the window and the
+    // look-ahead is kept free.
+    for (;;) {
+      AdaptBufferWindow(false);
+      int unused_frames = ring_buffer_->GetFrameCapacity() -
+          buffer_chunks_ * audio_buffer_size_ - look_ahead_frames_;
+      if (ring_buffer_->WriteAvail() - unused_frames >= frames)
+        break;
+      int ms_to_sleep = frames * 1000 / rate;
+      ScopedLock sl(mutex_);
+      cond_var_->WaitWithTimeout(mutex_, ms_to_sleep);
+      if (generation_ != synthesis_generation_) {
+        return TTS_CALLBACK_HALT;
       }
-    } else {
-      LOG(ERROR) << "The audio output must have at least as many channels as "
-                 << "the engine. Audio Output: " << output_num_channels
-                 << "Engine: " << num_channels;
-      exit(1);
     }
-  }
 
-  // If the ring buffer is full, compute the amount of time we expect
-  // it to take for that many audio samples to be output, and sleep for
-  // that long.
-  while (ring_buffer_->WriteAvail() < num_frames) {
-    int ms_to_sleep = num_frames * 1000 / rate;
-    ScopedLock sl(mutex_);
-    cond_var_->WaitWithTimeout(mutex_, ms_to_sleep);
-    if (service_running_ == false || utterance_running_ == false) {
+    RingBuffer<int16_t>::Span spans[2];
+    if (ring_buffer_->BeginWrite(frames, spans) < frames) {
+      LOG(INFO) << "Unable to write to ring buffer";
+      exit(0);
+    }
+    for (int i = 0; i < 2; i++) {
+      if (data) {
+        CopyFrames(data, num_channels, spans[i].data, output_num_channels,
+                   spans[i].frame_count);
+        data += spans[i].frame_count * num_channels;
+      } else {
+        polyphase_resampler_->Read(spans[i].data, output_num_channels,
+                                   spans[i].frame_count);
+      }
+    }
+    ring_buffer_->CommitWrite(frames);
+    num_frames -= frames;
+    last_write_time_ = threading_->GetTimeMilliseconds();
+    utterance_frames_ += frames;
+    if (utterance_frames_ >= audio_buffer_size_ && !speech_streaming_)
+      ReleaseStore(&speech_streaming_, true);
+
+    // If the utterance was cancelled while we were writing, the frames we
+    // just committed may have missed the reset, so discard them too.
+    MemoryBarrier();
+    if (AcquireLoad(&generation_) != synthesis_generation_) {
+      ring_buffer_->Reset();
       return TTS_CALLBACK_HALT;
     }
-  }
 
-  bool success;
-  if (output_data) {
-    success = ring_buffer_->Write(output_data, num_frames);
-    delete[] output_data;
-  } else {
-    success = ring_buffer_->Write(data, num_frames);
+    // Only this thread modifies first_sample_pending_, so it can be checked
+    // without the mutex.
+    if (first_sample_pending_) {
+      ScopedLock sl(mutex_);
+      int64_t now = threading_->GetTimeMilliseconds();
+      first_sample_pending_ = false;
+      last_time_to_first_sample_ =
+          static_cast<int>(now - synthesis_start_time_);
+      if (last_time_to_first_sample_ > max_time_to_first_sample_)
+        max_time_to_first_sample_ = last_time_to_first_sample_;
+      LOG(INFO) << "Time to first sample: " << last_time_to_first_sample_
+                << " ms";
+      if (next_speech_pending_) {
+        next_speech_pending_ = false;
+        last_stop_to_next_speech_ = static_cast<int>(now - stop_time_);
+        LOG(INFO) << "Stop to next speech: " << last_stop_to_next_speech_
+                  << " ms";
+      }
+    }
   }
-  if (!success) {
-    LOG(INFO) << "Unable to write to ring buffer";
-    exit(0);
+
+  return TTS_CALLBACK_CONTINUE;
+}
+
+tts_callback_status TtsService::ReceiveMarker(tts_marker_type type,
+                                              int text_offset) {
+  if (AcquireLoad(&generation_) != synthesis_generation_) {
+    return TTS_CALLBACK_HALT;
   }
 
+  // Schedule the marker right before the next audio written to the ring
+  // buffer.  Unlike completion callbacks, progress markers are simply
+  // dropped if too many are pending.
+  if (progress_listener_) {
+    ring_buffer_->AddMarker(progress_listener_, type, text_offset);
+  }
   return TTS_CALLBACK_CONTINUE;
 }
 
 tts_callback_status TtsService::Done() {
+  // Write out the end of the audio, which the resampling filter holds
+  // back.
+  if (polyphase_resampler_ &&
+      AcquireLoad(&generation_) == synthesis_generation_) {
+    polyphase_resampler_->Finish();
+    WriteFrames(NULL, 1, polyphase_resampler_->GetAvailableFrames());
+  }
   current_utterance_ = NULL;
   return TTS_CALLBACK_HALT;
 }
 
+void TtsService::OnMarker(int type, int value) {
+  if (type == kChunkStartMarker)
+    ReleaseStore(&played_offset_, value);
+}
+
 bool TtsService::FillAudioBuffer(int16_t* samples,
                                  int frame_count,
                                  int channel_count) {
+  // Check for a cancellation before ReadAvail applies the ring buffer
+  // reset that comes with it.
+  unsigned int generation = AcquireLoad(&generation_);
+  bool cancelled = (generation != played_generation_);
+  played_generation_ = generation;
+  if (cancelled) {
+    ReleaseStore(&last_stop_to_silence_, static_cast<int>(
+        threading_->GetTimeMilliseconds() - stop_time_));
+  }
+
   int avail = ring_buffer_->ReadAvail();
 
   // If the ring buffer is finished, play until the end.  Otherwise,
@@ -374,6 +1518,36 @@ bool TtsService::FillAudioBuffer(int16_t* samples,
   for (int i = copy_len * channel_count; i < frame_count * channel_count; i++)
     samples[i] = 0;
 
+  // Running out in the middle of speech, rather than because it was
+  // cancelled, means the buffer window is too small.
+  if (copy_len < frame_count &&
+      !cancelled &&
+      AcquireLoad(&speech_streaming_) &&
+      AcquireLoad(&generation_) == generation) {
+    AtomicIncrement(&underrun_count_, 1);
+  }
+
+  if (cancelled) {
+    // Instead of jumping from the last sample played to whatever comes
+    // next, which clicks, ramp from the last sample to zero.
+    int fade_frames = fade_frames_ < frame_count ? fade_frames_ : frame_count;
+    for (int i = 0; i < fade_frames; i++) {
+      for (int c = 0; c < channel_count; c++) {
+        int value = samples[i * channel_count + c] +
+            last_frame_[c] * (fade_frames - i) / (fade_frames + 1);
+        if (value > 32767)
+          value = 32767;
+        if (value < -32768)
+          value = -32768;
+        samples[i * channel_count + c] = static_cast<int16_t>(value);
+      }
+    }
+  }
+  if (frame_count > 0) {
+    memcpy(last_frame_, &samples[(frame_count - 1) * channel_count],
+           channel_count * sizeof(int16_t));
+  }
+
   earcon_manager_->FillAudioBuffer(samples, frame_count, channel_count);
 
   if (stop_when_finished_)
@@ -13,15 +13,20 @@
 #include <stdint.h>
 
 #include <list>
+#include <queue>
 #include <string>
+#include <vector>
 
 #include "audio_output.h"
+#include "phrase_cache.h"
 #include "ringbuffer.h"
 #include "tts_engine.h"
 #include "tts_receiver.h"
 
 using std::list;
+using std::priority_queue;
 using std::string;
+using std::vector;
 
 namespace tts_service {
 
@@ -31,13 +36,38 @@ enum tts_status {
   TTS_ERROR = 2,
 };
 
+// How a new utterance is combined with the ones that are already queued
+// or playing.
+enum tts_queue_mode {
+  // Add it to the queue after all utterances of the same or higher
+  // priority.
+  TTS_QUEUE_ENQUEUE = 0,
+  // Interrupt the current utterance, discard the queue, and speak this one.
+  TTS_QUEUE_INTERRUPT = 1,
+  // If the utterance playing has a lower priority, interrupt it and speak
+  // this one first.  The interrupted utterance and any after it that were
+  // already synthesized go back in the queue and are spoken again
+  // afterwards, starting from the sentence that was playing if text
+  // chunking is enabled.  Otherwise the same as TTS_QUEUE_ENQUEUE.
+  TTS_QUEUE_PREEMPT = 2,
+};
+
+class AudioSink;
 class EarconManager;
+class Playback;
+class PolyphaseResampler;
 class Resampler;
+class ResamplerCache;
+class TimeStretcher;
 
 // Add more such as rate, pitch etc. in the future.
 struct UtteranceOptions {
  public:
   Runnable *completion;
+  // If not NULL, gets a TTS_MARKER_WORD or TTS_MARKER_SENTENCE marker
+  // with the byte offset of the word or sentence in the text when its
+  // audio starts playing.  Called on the audio thread.
+  MarkerListener *progress;
   struct TtsVoice *voice_options;
   // Default is 1. Use higher or lower values to increase or decrease the
   // speaking rate. Map default to ~100 words/min if possible. Speech
@@ -50,19 +80,30 @@ struct UtteranceOptions {
   // Default is 1. Use higher or lower values to increase or decrease the
   // speaking volume.
   float volume;
+  // Default is TTS_QUEUE_ENQUEUE.
+  tts_queue_mode queue_mode;
+  // Default is 0. Utterances with a higher priority are spoken before
+  // queued utterances with a lower priority, and can preempt them.
+  int priority;
   UtteranceOptions()
       : completion(NULL),
+        progress(NULL),
         voice_options(NULL),
         rate(1),
         pitch(1),
-        volume(1) { }
+        volume(1),
+        queue_mode(TTS_QUEUE_ENQUEUE),
+        priority(0) { }
 
   UtteranceOptions(const UtteranceOptions& options)
       : completion(options.completion),
+        progress(options.progress),
         voice_options(NULL),
         rate(options.rate),
         pitch(options.pitch),
-        volume(options.volume) {
+        volume(options.volume),
+        queue_mode(options.queue_mode),
+        priority(options.priority) {
     if (options.voice_options)
       voice_options = new TtsVoice(*options.voice_options);
   }
@@ -70,7 +111,7 @@ struct UtteranceOptions {
 
 class Utterance {
  public:
-  Utterance() : options(NULL) {}
+  Utterance() : options(NULL), priority(0), sequence(0), resume_offset(0) {}
   virtual ~Utterance() {
     delete options;
   }
@@ -78,12 +119,29 @@ class Utterance {
   string text;
   int voice_index;
   struct UtteranceOptions *options;
+  int priority;
+  // The order in which Speak was called.
+  unsigned int sequence;
+  // The byte offset in |text| to start speaking from, if the utterance
+  // was preempted.
+  int resume_offset;
+};
+
+// Orders the utterance queue: the highest priority first, and utterances
+// of the same priority in the order in which Speak was called.
+struct UtteranceOrder {
+  bool operator()(const Utterance *a, const Utterance *b) const {
+    if (a->priority != b->priority)
+      return a->priority < b->priority;
+    return a->sequence > b->sequence;
+  }
 };
 
 class TtsService
     : public AudioProvider,
       public Runnable,
-      public TtsDataReceiver {
+      public TtsDataReceiver,
+      public MarkerListener {
  public:
   TtsService(TtsEngine *engine,
              AudioOutput *audio_output,
@@ -106,6 +164,12 @@ class TtsService
   // audio output's desired sample rate.
   int LoadEarconFromWavFile(const char *path, bool loop);
 
+  // Keep earcons that need converting to the audio output's format in the
+  // directory at |path|, which must exist, once they're converted, so that
+  // they're played straight from the file when they're loaded again.  Must
+  // be called before StartService; by default they're kept in memory.
+  void SetEarconCacheDirectory(const char *path);
+
   // Queue up this text to be spoken and return immediately. The
   // UtteranceOptions contains other settings such as language name, voice,
   // pitch, rate etc. Currently language name specified as:
@@ -116,10 +180,46 @@ class TtsService
   // in the queue. Does not interrupt earcons.
   void Stop();
 
+  // Synthesizes |text| as fast as the engine can and passes the audio to
+  // |sink| at |sample_rate| with |channel_count| channels, converted the
+  // same way as for the audio output, but without using the audio output
+  // or the queue.  Only the voice, rate, pitch and volume in |options| are
+  // used.  Works whether or not the service is running; if it is, this
+  // waits until the utterance being synthesized is buffered, and holds up
+  // the queue until rendering is done.  Returns false on error or if the
+  // sink stopped rendering.
+  bool RenderToSink(const string& text,
+                    UtteranceOptions *options,
+                    int sample_rate,
+                    int channel_count,
+                    AudioSink *sink);
+
+  // Renders into |samples|, replacing its contents with interleaved frames.
+  bool RenderToBuffer(const string& text,
+                      UtteranceOptions *options,
+                      int sample_rate,
+                      int channel_count,
+                      vector<int16_t> *samples);
+
+  // Renders into a 16-bit PCM WAV file at |path|, which is written as the
+  // audio is rendered.
+  bool RenderToFile(const string& text,
+                    UtteranceOptions *options,
+                    int sample_rate,
+                    int channel_count,
+                    const char *path);
+
   // Start playing the given earcon. If it was already playing, this
   // starts playing it again from the beginning.
   void PlayEarcon(int earcon_id);
 
+  // The same, with a |gain| from 0 to 1 and a stereo |pan| from -1 (left)
+  // to 1 (right), which apply until the earcon is played again.
+  void PlayEarcon(int earcon_id, float gain, float pan);
+
+  // Changes the gain and pan of the given earcon without restarting it.
+  void SetEarconGain(int earcon_id, float gain, float pan);
+
   // Stop playing the given earcon id.
   void StopEarcon(int earcon_id);
 
@@ -137,6 +237,73 @@ class TtsService
   // will be kept open continuously.
   void SetStopWhenFinished(bool stop_when_finished);
 
+  // Enable look-ahead synthesis: while one utterance is playing, keep
+  // synthesizing up to |utterance_count| of the following queued
+  // utterances, buffering up to |cache_size_in_frames| frames of audio
+  // (at the audio output's sample rate) beyond what the audio output
+  // needs.  Stop discards everything buffered.  Must be called before
+  // StartService; by default look-ahead is off.
+  void SetLookAhead(int utterance_count, int cache_size_in_frames);
+
+  // If enabled, each utterance is split into sentences, and sentences
+  // longer than |max_clause_size| bytes into clauses, which are passed to
+  // the engine one at a time, so audio starts after the engine has
+  // analyzed the first piece instead of the whole text.  SSML is kept
+  // well-formed in each piece.  Takes effect with the next utterance.
+  void SetTextChunking(bool enabled, int max_clause_size);
+
+  // Enable caching the audio of utterances up to |max_phrase_size| bytes
+  // long in up to |size_in_bytes| of memory, so that phrases spoken again
+  // with the same voice and prosody are played without running the
+  // engine.  Must be called before StartService; by default there's no
+  // cache.
+  void SetPhraseCache(int size_in_bytes, int max_phrase_size);
+
+  // Keep the phrase cache in the file at |path| too, up to
+  // |size_in_bytes|, so that phrases are still cached after a restart.
+  // Must be called after SetPhraseCache and before StartService.  Returns
+  // false if there's no phrase cache or the file can't be used.
+  bool SetDiskPhraseCache(const char *path, int size_in_bytes);
+
+  // Queue up a phrase to be synthesized into the phrase cache while the
+  // service is running and there's nothing else to speak.  Only the voice,
+  // rate, pitch and volume in |options| are used.
+  void AddWarmUpPhrase(const string& text, UtteranceOptions *options = NULL);
+
+  // Speeds up or slows down speech by |speed|, where 2 is twice as fast,
+  // without changing its pitch.  Unlike the rate in UtteranceOptions, this
+  // applies in the middle of an utterance, to all audio synthesized from
+  // then on, and goes beyond the range of the engine's own rates, from
+  // TimeStretcher::kMinSpeed to kMaxSpeed.  Default is 1.
+  void SetSpeed(float speed);
+
+  // The phrase cache counters; all zero if there's no cache.
+  PhraseCacheStats GetPhraseCacheStats();
+
+  // The time in milliseconds from when the background thread started
+  // synthesizing an utterance until its first audio was buffered for the
+  // audio output, for the most recent utterance and the maximum since the
+  // service started.  -1 if nothing has been measured yet.
+  int GetLastTimeToFirstSample();
+  int GetMaxTimeToFirstSample();
+
+  // For the most recent Stop, or interrupting or preempting Speak, that
+  // cut off speech: the time in milliseconds until the audio output
+  // stopped taking that speech from the buffer, and until the first audio
+  // of the next utterance was buffered.  -1 if nothing has been measured.
+  int GetLastStopToSilence();
+  int GetLastStopToNextSpeech();
+
+  // How much audio the background thread keeps buffered ahead of the
+  // audio output, not counting look-ahead, in frames.  It starts at four
+  // of the audio output's chunks and adapts, up to the output's total
+  // buffer size, to how fast the engine synthesizes and to underruns.
+  int GetBufferWindowFrames();
+
+  // The number of times the audio output ran out of speech in the middle
+  // of an utterance since the service started.
+  int GetUnderrunCount();
+
   //
   // Internal implementation
   //
@@ -154,22 +321,121 @@ class TtsService
                               const int16_t* data,
                               int num_samples);
 
+  // Part of the implementation of TtsDataReceiver.
+  tts_callback_status ReceiveMarker(tts_marker_type type, int text_offset);
+
   // Part of the implementation of TtsDataReceive.
   tts_callback_status Done();
 
+  // Implementation of MarkerListener, called by the audio output thread
+  // when it starts playing each chunk of text.
+  void OnMarker(int type, int value);
 
  private:
+  // Must be called with the engine mutex held.
+  bool InitEngine();
+
+  Utterance *NewUtterance(const string& text, UtteranceOptions *options);
+
+  // Called by Run.
+  string GetPhraseKey(const string& text,
+                      int voice_index,
+                      UtteranceOptions *options);
+  void WarmUpPhrase(Utterance *utterance);
+  void PlayPhrase(const PhraseAudio& audio, TtsDataReceiver *receiver);
+
+  // Called by Receive and Done.
+  tts_callback_status WriteFrames(const int16_t* data,
+                                  int num_channels,
+                                  int num_frames);
+
+  // Called by the background thread to grow the buffer window after an
+  // underrun, and when |utterance_done|, to resize it to suit the
+  // utterance the engine just synthesized.
+  void AdaptBufferWindow(bool utterance_done);
+
+  // These must be called with the mutex held.
+  void CancelUtterance();
+  void FlushQueue();
+  void Preempt(int priority);
+  void DeleteFinishedPlaybacks();
+  int CountPlayingUtterances();
+
   TtsEngine *engine_;
   AudioOutput *audio_output_;
   RingBuffer<int16_t> *ring_buffer_;
   Threading *threading_;
   Thread *thread_;
   Utterance *current_utterance_;
+  MarkerListener *progress_listener_;
   Resampler *resampler_;
+  // If not NULL, Receive resamples the engine's audio with this as it
+  // writes it to the ring buffer, instead of resampler_ doing it first.
+  PolyphaseResampler *polyphase_resampler_;
+  // Where resampler_ and polyphase_resampler_ come from and go back to
+  // after each utterance, shared with rendering and the earcon manager.
+  ResamplerCache *resampler_cache_;
   int16_t *audio_buffer_;
   EarconManager* earcon_manager_;
+  bool engine_initialized_;
   int audio_buffer_size_;
   bool stop_when_finished_;
+  int look_ahead_utterances_;
+  int look_ahead_frames_;
+  bool text_chunking_;
+  int max_clause_size_;
+  PhraseCache *phrase_cache_;
+  string earcon_cache_directory_;
+  int max_phrase_size_;
+  float speed_;
+
+  // The source offset of the chunk of text playing, set by the audio I/O
+  // thread and reset to 0 at the end of each utterance.
+  volatile int played_offset_;
+
+  // Incremented, with the mutex held, whenever the utterance being
+  // synthesized and the audio that hasn't been played are cancelled.
+  // Receive compares it with the value when synthesis started, which
+  // doesn't need the mutex, and the audio I/O thread compares it with the
+  // value it last saw to know when to fade out.
+  volatile unsigned int generation_;
+  unsigned int synthesis_generation_;
+
+  // Owned by the audio I/O thread: the last frame of speech it played,
+  // to fade out from when speech is cut off.
+  unsigned int played_generation_;
+  int16_t *last_frame_;
+  int fade_frames_;
+
+  // The time of the last cancellation, written with the mutex held before
+  // generation_ is incremented.
+  int64_t stop_time_;
+  volatile int last_stop_to_silence_;
+
+  // The buffer window, in chunks of audio_buffer_size_ frames, which only
+  // the background thread changes, and its upper limit.
+  volatile int buffer_chunks_;
+  int max_buffer_chunks_;
+
+  // Set by the background thread once the utterance it's synthesizing has
+  // buffered a whole chunk, until its last audio is written.  If the audio
+  // I/O thread runs out of audio in between, it counts an underrun.
+  volatile bool speech_streaming_;
+  volatile int underrun_count_;
+
+  // Owned by the background thread.  For the utterance being synthesized:
+  // the frames written, the time spent synthesizing them and the longest
+  // of those times between two writes, and the time of the last write, or
+  // 0 before the first.  Over all utterances: the smoothed real-time
+  // factor, or -1 before the first, the underruns already seen, and the
+  // utterances synthesized since the window last changed size.
+  int utterance_frames_;
+  int64_t utterance_busy_time_;
+  int64_t max_write_interval_;
+  int64_t last_write_time_;
+  float real_time_factor_;
+  int seen_underrun_count_;
+  int steady_utterances_;
 
   // Notes on synchronization: There are three thread contexts here:
   //
@@ -192,11 +458,29 @@ class TtsService
   Mutex *mutex_;
   CondVar *cond_var_;
 
+  // Held while the engine is in use, by #2 while it synthesizes an
+  // utterance and by #1 while it renders offline.  Never acquired while
+  // holding the other mutex.
+  Mutex *engine_mutex_;
+
   // Variables that are protected by the mutex and signaled by the
   // condition variable.
-  list<Utterance*> utterances_;
+  priority_queue<Utterance*, vector<Utterance*>, UtteranceOrder> utterances_;
+  unsigned int next_sequence_;
+  // Utterances whose synthesis has started, oldest first, until the audio
+  // I/O thread is done with them.
+  list<Playback*> playbacks_;
+  list<Utterance*> warm_up_phrases_;
+  // The time stretcher of the utterance being synthesized, if any.
+  TimeStretcher *time_stretcher_;
   bool service_running_;
   bool utterance_running_;
+  int64_t synthesis_start_time_;
+  bool first_sample_pending_;
+  int last_time_to_first_sample_;
+  int max_time_to_first_sample_;
+  bool next_speech_pending_;
+  int last_stop_to_next_speech_;
 };
 }  // namespace tts_service
 